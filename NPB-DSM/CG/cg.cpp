@@ -28,6 +28,7 @@ c---------------------------------------------------------------------
 
 #include "argo.hpp"
 #include <iostream>
+#include <cstring>
 #include "npbparams.hpp"
 #include "npb-CPP.hpp"
 
@@ -56,13 +57,17 @@ double *aelt;	/* aelt[1:NZ] 		*/
 double *a;		/* a[1:NZ] */
 
 /* common /global_mem/ */
-double *gnorm_temps;
+double *gnorm_temps;	/* x.z and z.z of each node, then d and rho of conj_grad */
 double *x;		/* x[1:NA+2]		*/
 double *z;		/* z[1:NA+2] 		*/
 double *p;		/* p[1:NA+2] 		*/
 double *q;		/* q[1:NA+2] 		*/
 double *r;		/* r[1:NA+2] 		*/
 double *w;		/* w[1:NA+2] 		*/
+double *w1;		/* w1[1:NA+2]: second w of the pipelined CG */
+double *s;		/* s[1:NA+2]: A.p in the pipelined CG */
+double *u;		/* u[1:NA+2]: A.s in the pipelined CG */
+double *gpipe_temps;	/* gamma and delta of each node, for two iterations */
 
 /* common /urando/ */
 static double amult;
@@ -73,10 +78,19 @@ int workrank;
 int numtasks;
 int nthreads;
 
+/* common /kernel_mode/ */
+static boolean fused_kernels;
+static boolean pipelined_cg;
+static boolean partition_rows;
+
 /* function declarations */
 static void conj_grad (int colidx[], int rowstr[], double x[], 
 	double z[], double a[], double p[], double q[], double r[], 
 	double w[], double *rnorm);
+static void conj_grad_pipelined (int colidx[], int rowstr[], double x[],
+	double z[], double a[], double p[], double q[], double r[],
+	double w[], double w1[], double s[], double u[]);
+static int node_first_row(int rank);
 static void makea(int n, int nz, double a[], int colidx[], int rowstr[],
 	int nonzer, int firstrow, int lastrow, int firstcol,
 	int lastcol, double rcond, int arow[], int acol[],
@@ -128,7 +142,7 @@ int main(int argc, char **argv)
 	workrank = argo::node_id();
     numtasks = argo::number_of_nodes();
 
-	gnorm_temps = argo::conew_array<double>(2*numtasks);
+	gnorm_temps = argo::conew_array<double>(4*numtasks);
 	x = argo::conew_array<double>(NA+2+1);
 	z = argo::conew_array<double>(NA+2+1);
 	p = argo::conew_array<double>(NA+2+1);
@@ -176,6 +190,39 @@ int main(int argc, char **argv)
 		printf(" Iterations: %5d\n", NITER);
 	}
 
+	if(const char * fk = std::getenv("CG_FUSED")) {
+		fused_kernels = atoi(fk);
+	} else {
+		fused_kernels = FALSE;
+	}
+	if (fused_kernels && workrank == 0) {
+		printf(" Fused SpMV/dot/axpy kernels enabled\n");
+	}
+
+	if(const char * cp = std::getenv("CG_PARTITION")) {
+		partition_rows = (strcmp(cp, "nnz") == 0);
+	} else {
+		partition_rows = FALSE;
+	}
+	if (partition_rows && workrank == 0) {
+		printf(" Row partition: nnz-balanced across %d nodes\n", numtasks);
+	}
+
+	if(const char * pc = std::getenv("CG_PIPELINED")) {
+		pipelined_cg = atoi(pc);
+	} else {
+		pipelined_cg = FALSE;
+	}
+	if (pipelined_cg) {
+		if (workrank == 0) {
+			printf(" Pipelined CG: one global reduction per iteration\n");
+		}
+		w1 = argo::conew_array<double>(NA+2+1);
+		s = argo::conew_array<double>(NA+2+1);
+		u = argo::conew_array<double>(NA+2+1);
+		gpipe_temps = argo::conew_array<double>(4*numtasks);
+	}
+
 	naa = NA;
 	nzz = NZ;
 
@@ -424,6 +471,12 @@ int main(int argc, char **argv)
 	argo::codelete_array(q);
 	argo::codelete_array(r);
 	argo::codelete_array(w);
+	if (pipelined_cg) {
+		argo::codelete_array(w1);
+		argo::codelete_array(s);
+		argo::codelete_array(u);
+		argo::codelete_array(gpipe_temps);
+	}
 
 	argo::finalize();
 
@@ -455,220 +508,260 @@ c---------------------------------------------------------------------*/
 	int j, k;
 	int cgit, cgitmax = 25;
 
+	/*--------------------------------------------------------------------
+	c  d (and the final sum) and rho are published in slots of their own,
+	c  so a node may publish rho before the others have read its d, and
+	c  the sum before they have read its rho
+	c-------------------------------------------------------------------*/
+	double *gd = &gnorm_temps[2*numtasks], *grho = &gnorm_temps[3*numtasks];
+
 	static int chunk_naa = (naa+1) / numtasks;
     static int beg_naa = 1 + workrank * chunk_naa;
     static int end_naa = (workrank != numtasks - 1) ? workrank * chunk_naa + chunk_naa : naa+1;
 
-	static int chunk_row = (lastrow-firstrow+1) / numtasks;
-	static int beg_row = 1 + workrank * chunk_row;
-	static int end_row = (workrank != numtasks - 1) ? workrank * chunk_row + chunk_row : lastrow-firstrow+1;
+	static int beg_row = node_first_row(workrank);
+	static int end_row = node_first_row(workrank+1) - 1;
 
 	static int chunk_col = (lastcol-firstcol+1) / numtasks;
     static int beg_col = 1 + workrank * chunk_col;
     static int end_col = (workrank != numtasks - 1) ? workrank * chunk_col + chunk_col : lastcol-firstcol+1;
 
-	#pragma omp single nowait
-		rho = 0.0;
-
-	/*--------------------------------------------------------------------
-	c  Initialize the CG algorithm:
-	c-------------------------------------------------------------------*/
-	#pragma omp for nowait
-	    for (j = beg_naa; j <= end_naa; j++) {
-			q[j] = 0.0;
-			z[j] = 0.0;
-			r[j] = x[j];
-			p[j] = r[j];
-			w[j] = 0.0;
-	    }
-
-	/*--------------------------------------------------------------------
-	c  rho = r.r
-	c  Now, obtain the norm of r: First, sum squares of r elements locally...
-	c-------------------------------------------------------------------*/	
-	#pragma omp for reduction(+:rho)
-	for (j = beg_col; j <= end_col; j++) {
-		rho = rho + x[j]*x[j];
-	}
-
-	#pragma omp master
-	gnorm_temps[workrank] = rho;
-
-	argo::barrier(nthreads);
-
-	#pragma omp single
-	for (j = 0; j < numtasks; j++)
-		if (j != workrank)
-			rho += gnorm_temps[j];
-
-	/*--------------------------------------------------------------------
-	c---->
-	c  The conj grad iteration loop
-	c---->
-	c-------------------------------------------------------------------*/
-    for (cgit = 1; cgit <= cgitmax; cgit++) {
+	if (pipelined_cg) {
+		conj_grad_pipelined(colidx, rowstr, x, z, a, p, q, r, w, w1, s, u);
+	} else {
 		#pragma omp single nowait
-		{	
-			rho0 = rho;
-			d = 0.0;
 			rho = 0.0;
-		} /* end single */
-      
-		/*--------------------------------------------------------------------
-		c  q = A.p
-		c  The partition submatrix-vector multiply: use workspace w
-		c---------------------------------------------------------------------
-		C
-		C  NOTE: this version of the multiply is actually (slightly: maybe %5) 
-		C        faster on the sp2 on 16 nodes than is the unrolled-by-2 version 
-		C        below.   On the Cray t3d, the reverse is true, i.e., the 
-		C        unrolled-by-two version is some 10% faster.  
-		C        The unrolled-by-8 version below is significantly faster
-		C        on the Cray t3d - overall speed of code is 1.5 times faster.
-		*/
-
-		argo::barrier(nthreads);
-
-		/* rolled version */      
-		#pragma omp for private(sum,k)
-		for (j = beg_row; j <= end_row; j++) {
-			sum = 0.0;
-			for (k = rowstr[j]; k < rowstr[j+1]; k++) {
-				sum = sum + a[k]*p[colidx[k]];
-		    }
-			w[j] = sum;
-		}
 
-		argo::barrier(nthreads);
-		
-	/* unrolled-by-two version
-		#pragma omp for private(i,k)
-		for (j = 1; j <= lastrow-firstrow+1; j++) {
-			int iresidue;
-			double sum1, sum2;
-			i = rowstr[j]; 
-			iresidue = (rowstr[j+1]-i) % 2;
-			sum1 = 0.0;
-			sum2 = 0.0;
-			if (iresidue == 1) sum1 = sum1 + a[i]*p[colidx[i]];
-			for (k = i+iresidue; k <= rowstr[j+1]-2; k += 2) {
-				sum1 = sum1 + a[k]   * p[colidx[k]];
-				sum2 = sum2 + a[k+1] * p[colidx[k+1]];
-			}
-			w[j] = sum1 + sum2;
-		}
-	*/
-	/* unrolled-by-8 version
-		#pragma omp for private(i,k,sum)
-		for (j = 1; j <= lastrow-firstrow+1; j++) {
-			int iresidue;
-			i = rowstr[j]; 
-			iresidue = (rowstr[j+1]-i) % 8;
-			sum = 0.0;
-			for (k = i; k <= i+iresidue-1; k++) {
-				sum = sum +  a[k] * p[colidx[k]];
-			}
-			for (k = i+iresidue; k <= rowstr[j+1]-8; k += 8) {
-				sum = sum + a[k  ] * p[colidx[k  ]]
-				+ a[k+1] * p[colidx[k+1]]
-				+ a[k+2] * p[colidx[k+2]]
-				+ a[k+3] * p[colidx[k+3]]
-				+ a[k+4] * p[colidx[k+4]]
-				+ a[k+5] * p[colidx[k+5]]
-				+ a[k+6] * p[colidx[k+6]]
-				+ a[k+7] * p[colidx[k+7]];
-			}
-			w[j] = sum;
-		}
-	*/
-		
-		#pragma omp for
-		for (j = beg_col; j <= end_col; j++) {
-			q[j] = w[j];
-		}
-	
 		/*--------------------------------------------------------------------
-		c  Clear w for reuse...
+		c  Initialize the CG algorithm:
 		c-------------------------------------------------------------------*/
-		#pragma omp for	nowait
-		for (j = beg_col; j <= end_col; j++) {
-			w[j] = 0.0;
-		}
+		#pragma omp for nowait
+		    for (j = beg_naa; j <= end_naa; j++) {
+				q[j] = 0.0;
+				z[j] = 0.0;
+				r[j] = x[j];
+				p[j] = r[j];
+				w[j] = 0.0;
+		    }
 
 		/*--------------------------------------------------------------------
-		c  Obtain p.q
-		c-------------------------------------------------------------------*/
-		#pragma omp for reduction(+:d)
+		c  rho = r.r
+		c  Now, obtain the norm of r: First, sum squares of r elements locally...
+		c-------------------------------------------------------------------*/	
+		#pragma omp for reduction(+:rho)
 		for (j = beg_col; j <= end_col; j++) {
-			d = d + p[j]*q[j];
+			rho = rho + x[j]*x[j];
 		}
 
 		#pragma omp master
-		gnorm_temps[workrank] = d;
+		grho[workrank] = rho;
 
 		argo::barrier(nthreads);
 
 		#pragma omp single
 		for (j = 0; j < numtasks; j++)
 			if (j != workrank)
-				d += gnorm_temps[j];
+				rho += grho[j];
 
 		/*--------------------------------------------------------------------
-		c  Obtain alpha = rho / (p.q)
+		c---->
+		c  The conj grad iteration loop
+		c---->
 		c-------------------------------------------------------------------*/
-		#pragma omp single	
-			alpha = rho0 / d;
+	    for (cgit = 1; cgit <= cgitmax; cgit++) {
+			#pragma omp single nowait
+			{	
+				rho0 = rho;
+				d = 0.0;
+				rho = 0.0;
+			} /* end single */
+      
+			/*--------------------------------------------------------------------
+			c  q = A.p
+			c  The partition submatrix-vector multiply: use workspace w
+			c---------------------------------------------------------------------
+			C
+			C  NOTE: this version of the multiply is actually (slightly: maybe %5) 
+			C        faster on the sp2 on 16 nodes than is the unrolled-by-2 version 
+			C        below.   On the Cray t3d, the reverse is true, i.e., the 
+			C        unrolled-by-two version is some 10% faster.  
+			C        The unrolled-by-8 version below is significantly faster
+			C        on the Cray t3d - overall speed of code is 1.5 times faster.
+			*/
 
-		/*--------------------------------------------------------------------
-		c  Save a temporary of rho
-		c-------------------------------------------------------------------*/
-			/*	rho0 = rho;*/
+			argo::barrier(nthreads);
 
-		/*---------------------------------------------------------------------
-		c  Obtain z = z + alpha*p
-		c  and    r = r - alpha*q
-		c---------------------------------------------------------------------*/
-		#pragma omp for
-		for (j = beg_col; j <= end_col; j++) {
-			z[j] = z[j] + alpha*p[j];
-			r[j] = r[j] - alpha*q[j];
-		}
+			if (fused_kernels) {
+				/*--------------------------------------------------------------------
+				c  Fused: q = A.p is written directly and p.q is accumulated
+				c  in the same sweep, so w, its copy and its clear are skipped
+				c-------------------------------------------------------------------*/
+				#pragma omp for private(sum,k) reduction(+:d)
+				for (j = beg_row; j <= end_row; j++) {
+					sum = 0.0;
+					for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+						sum = sum + a[k]*p[colidx[k]];
+					}
+					q[j] = sum;
+					d = d + p[j]*sum;
+				}
+			} else {
+				/* rolled version */      
+				#pragma omp for private(sum,k)
+				for (j = beg_row; j <= end_row; j++) {
+					sum = 0.0;
+					for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+						sum = sum + a[k]*p[colidx[k]];
+				    }
+					w[j] = sum;
+				}
 
-		argo::barrier(nthreads);
+				argo::barrier(nthreads);
+			}
+		
+		/* unrolled-by-two version
+			#pragma omp for private(i,k)
+			for (j = 1; j <= lastrow-firstrow+1; j++) {
+				int iresidue;
+				double sum1, sum2;
+				i = rowstr[j]; 
+				iresidue = (rowstr[j+1]-i) % 2;
+				sum1 = 0.0;
+				sum2 = 0.0;
+				if (iresidue == 1) sum1 = sum1 + a[i]*p[colidx[i]];
+				for (k = i+iresidue; k <= rowstr[j+1]-2; k += 2) {
+					sum1 = sum1 + a[k]   * p[colidx[k]];
+					sum2 = sum2 + a[k+1] * p[colidx[k+1]];
+				}
+				w[j] = sum1 + sum2;
+			}
+		*/
+		/* unrolled-by-8 version
+			#pragma omp for private(i,k,sum)
+			for (j = 1; j <= lastrow-firstrow+1; j++) {
+				int iresidue;
+				i = rowstr[j]; 
+				iresidue = (rowstr[j+1]-i) % 8;
+				sum = 0.0;
+				for (k = i; k <= i+iresidue-1; k++) {
+					sum = sum +  a[k] * p[colidx[k]];
+				}
+				for (k = i+iresidue; k <= rowstr[j+1]-8; k += 8) {
+					sum = sum + a[k  ] * p[colidx[k  ]]
+					+ a[k+1] * p[colidx[k+1]]
+					+ a[k+2] * p[colidx[k+2]]
+					+ a[k+3] * p[colidx[k+3]]
+					+ a[k+4] * p[colidx[k+4]]
+					+ a[k+5] * p[colidx[k+5]]
+					+ a[k+6] * p[colidx[k+6]]
+					+ a[k+7] * p[colidx[k+7]];
+				}
+				w[j] = sum;
+			}
+		*/
+		
+			if (!fused_kernels) {
+				#pragma omp for
+				for (j = beg_col; j <= end_col; j++) {
+					q[j] = w[j];
+				}
+	
+				/*--------------------------------------------------------------------
+				c  Clear w for reuse...
+				c-------------------------------------------------------------------*/
+				#pragma omp for	nowait
+				for (j = beg_col; j <= end_col; j++) {
+					w[j] = 0.0;
+				}
+
+				/*--------------------------------------------------------------------
+				c  Obtain p.q
+				c-------------------------------------------------------------------*/
+				#pragma omp for reduction(+:d)
+				for (j = beg_col; j <= end_col; j++) {
+					d = d + p[j]*q[j];
+				}
+			}
+
+			#pragma omp master
+			gd[workrank] = d;
+
+			argo::barrier(nthreads);
+
+			#pragma omp single
+			for (j = 0; j < numtasks; j++)
+				if (j != workrank)
+					d += gd[j];
+
+			/*--------------------------------------------------------------------
+			c  Obtain alpha = rho / (p.q)
+			c-------------------------------------------------------------------*/
+			#pragma omp single	
+				alpha = rho0 / d;
+
+			/*--------------------------------------------------------------------
+			c  Save a temporary of rho
+			c-------------------------------------------------------------------*/
+				/*	rho0 = rho;*/
+
+			/*---------------------------------------------------------------------
+			c  Obtain z = z + alpha*p
+			c  and    r = r - alpha*q
+			c---------------------------------------------------------------------*/
+			if (fused_kernels) {
+				/*---------------------------------------------------------------------
+				c  Fused: rho = r.r is accumulated while r is updated
+				c---------------------------------------------------------------------*/
+				#pragma omp for reduction(+:rho)
+				for (j = beg_col; j <= end_col; j++) {
+					z[j] = z[j] + alpha*p[j];
+					r[j] = r[j] - alpha*q[j];
+					rho = rho + r[j]*r[j];
+				}
+			} else {
+				#pragma omp for
+				for (j = beg_col; j <= end_col; j++) {
+					z[j] = z[j] + alpha*p[j];
+					r[j] = r[j] - alpha*q[j];
+				}
+
+				argo::barrier(nthreads);
             
-		/*---------------------------------------------------------------------
-		c  rho = r.r
-		c  Now, obtain the norm of r: First, sum squares of r elements locally...
-		c---------------------------------------------------------------------*/
-		#pragma omp for reduction(+:rho)	
-		for (j = beg_col; j <= end_col; j++) {
-			rho = rho + r[j]*r[j];
-		}
+				/*---------------------------------------------------------------------
+				c  rho = r.r
+				c  Now, obtain the norm of r: First, sum squares of r elements locally...
+				c---------------------------------------------------------------------*/
+				#pragma omp for reduction(+:rho)	
+				for (j = beg_col; j <= end_col; j++) {
+					rho = rho + r[j]*r[j];
+				}
+			}
 
-		#pragma omp master
-		gnorm_temps[workrank] = rho;
+			#pragma omp master
+			grho[workrank] = rho;
 
-		argo::barrier(nthreads);
+			argo::barrier(nthreads);
 
-		#pragma omp single
-		for (j = 0; j < numtasks; j++)
-			if (j != workrank)
-				rho += gnorm_temps[j];
+			#pragma omp single
+			for (j = 0; j < numtasks; j++)
+				if (j != workrank)
+					rho += grho[j];
 
-		/*--------------------------------------------------------------------
-		c  Obtain beta:
-		c-------------------------------------------------------------------*/
-		#pragma omp single	
-		beta = rho / rho0;
+			/*--------------------------------------------------------------------
+			c  Obtain beta:
+			c-------------------------------------------------------------------*/
+			#pragma omp single	
+			beta = rho / rho0;
 
-		/*--------------------------------------------------------------------
-		c  p = r + beta*p
-		c-------------------------------------------------------------------*/
-		#pragma omp for
-		for (j = beg_col; j <= end_col; j++) {
-			p[j] = r[j] + beta*p[j];
-		}
-	} /* end of do cgit=1,cgitmax */
+			/*--------------------------------------------------------------------
+			c  p = r + beta*p
+			c-------------------------------------------------------------------*/
+			#pragma omp for
+			for (j = beg_col; j <= end_col; j++) {
+				p[j] = r[j] + beta*p[j];
+			}
+		} /* end of do cgit=1,cgitmax */
+	}
 
 	/*---------------------------------------------------------------------
 	c  Compute residual norm explicitly:  ||r|| = ||x - A.z||
@@ -678,40 +771,56 @@ c---------------------------------------------------------------------*/
 	#pragma omp single nowait
 		sum = 0.0;
     
-	#pragma omp for private(d, k)
-	for (j = beg_row; j <= end_row; j++) {
-		d = 0.0;
-		for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
-			d = d + a[k]*z[colidx[k]];
+	if (fused_kernels) {
+		/*--------------------------------------------------------------------
+		c  Fused: r = A.z and ||x - r||^2 in a single sweep
+		c-------------------------------------------------------------------*/
+		#pragma omp for reduction(+:sum) private(d, k)
+		for (j = beg_row; j <= end_row; j++) {
+			d = 0.0;
+			for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			r[j] = d;
+			d = x[j] - d;
+			sum = sum + d*d;
+		}
+	} else {
+		#pragma omp for private(d, k)
+		for (j = beg_row; j <= end_row; j++) {
+			d = 0.0;
+			for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			w[j] = d;
 		}
-		w[j] = d;
-	}
 
-	argo::barrier(nthreads);
+		argo::barrier(nthreads);
 
-	#pragma omp for
-	for (j = beg_col; j <= end_col; j++) {
-		r[j] = w[j];
-	}
+		#pragma omp for
+		for (j = beg_col; j <= end_col; j++) {
+			r[j] = w[j];
+		}
 
-	/*--------------------------------------------------------------------
-	c  At this point, r contains A.z
-	c-------------------------------------------------------------------*/
-	#pragma omp for reduction(+:sum) private(d)
-	for (j = beg_col; j <= end_col; j++) {
-		d = x[j] - r[j];
-		sum = sum + d*d;
+		/*--------------------------------------------------------------------
+		c  At this point, r contains A.z
+		c-------------------------------------------------------------------*/
+		#pragma omp for reduction(+:sum) private(d)
+		for (j = beg_col; j <= end_col; j++) {
+			d = x[j] - r[j];
+			sum = sum + d*d;
+		}
 	}
 
 	#pragma omp single nowait
-		gnorm_temps[workrank] = sum;
+		gd[workrank] = sum;
 
 	argo::barrier(nthreads);
 
 	#pragma omp single
 	for (j = 0; j < numtasks; j++)
 		if (j != workrank)
-			sum += gnorm_temps[j];
+			sum += gd[j];
 
 	#pragma omp single
 	{
@@ -719,6 +828,179 @@ c---------------------------------------------------------------------*/
 	} /* end single */
 }
 
+/*--------------------------------------------------------------------
+c  Pipelined CG (Ghysels and Vanroose): the cgitmax iterations of
+c  conj_grad with a single global reduction each.  gamma = r.r and
+c  delta = w.r are published together, and one thread adds up the
+c  other nodes' parts while the rest already compute q = A.w:
+c
+c    w = A.r, q = A.w, s = A.p, u = A.s
+c    beta = gamma/gamma0, alpha = gamma/(delta - beta*gamma/alpha0)
+c    u = q + beta*u, s = w + beta*s, p = r + beta*p
+c    z = z + alpha*p, r = r - alpha*s, w = w - alpha*u
+c
+c  w is the only vector read across nodes, so it alternates between
+c  w and w1, and the argo barrier that publishes the dot products is
+c  the only one of the iteration.  The vector loops run over the rows
+c  of the node, as the products do, so q and w are read only by the
+c  node that wrote them even when CG_PARTITION=nnz moves the rows.
+c  The recurred r drifts from x - A.z, so the explicit residual and
+c  the zeta check tell how close it is
+c-------------------------------------------------------------------*/
+static void conj_grad_pipelined (
+	int colidx[],	/* colidx[1:nzz] */
+	int rowstr[],	/* rowstr[1:naa+1] */
+	double x[],		/* x[*] */
+	double z[],		/* z[*] */
+	double a[],		/* a[1:nzz] */
+	double p[],		/* p[*] */
+	double q[],		/* q[*] */
+	double r[],		/* r[*] */
+	double w[],		/* w[*] */
+	double w1[],	/* w1[*] */
+	double s[],		/* s[*] */
+	double u[] )	/* u[*] */
+{
+	static double gamma, gamma0, delta, alpha, beta, sum;
+	int j, k, t;
+	int cgit, cgitmax = 25;
+
+	static int chunk_naa = (naa+1) / numtasks;
+	static int beg_naa = 1 + workrank * chunk_naa;
+	static int end_naa = (workrank != numtasks - 1) ? workrank * chunk_naa + chunk_naa : naa+1;
+
+	static int beg_row = node_first_row(workrank);
+	static int end_row = node_first_row(workrank+1) - 1;
+
+	/*--------------------------------------------------------------------
+	c  Initialize the CG algorithm, then w = A.r
+	c-------------------------------------------------------------------*/
+	#pragma omp for nowait
+	for (j = beg_naa; j <= end_naa; j++) {
+		z[j] = 0.0;
+		r[j] = x[j];
+		p[j] = 0.0;
+		s[j] = 0.0;
+		u[j] = 0.0;
+	}
+
+	argo::barrier(nthreads);
+
+	#pragma omp for private(sum,k)
+	for (j = beg_row; j <= end_row; j++) {
+		sum = 0.0;
+		for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+			sum = sum + a[k]*r[colidx[k]];
+		}
+		w[j] = sum;
+	}
+
+	for (cgit = 1; cgit <= cgitmax; cgit++) {
+		double *wc = (cgit % 2) ? w : w1;	/* w of this iteration */
+		double *wn = (cgit % 2) ? w1 : w;	/* w of the next one */
+		double *gt = &gpipe_temps[2*numtasks*(cgit % 2)];
+
+		#pragma omp single
+		{
+			gamma0 = gamma;
+			gamma = 0.0;
+			delta = 0.0;
+		} /* end single */
+
+		/*--------------------------------------------------------------------
+		c  gamma = r.r and delta = w.r, published in one barrier
+		c-------------------------------------------------------------------*/
+		#pragma omp for reduction(+:gamma,delta)
+		for (j = beg_row; j <= end_row; j++) {
+			gamma = gamma + r[j]*r[j];
+			delta = delta + wc[j]*r[j];
+		}
+
+		#pragma omp master
+		{
+			gt[2*workrank] = gamma;
+			gt[2*workrank+1] = delta;
+		} /* end master */
+
+		argo::barrier(nthreads);
+
+		/*--------------------------------------------------------------------
+		c  Finish the reduction and get alpha and beta
+		c  while q = A.w is being computed
+		c-------------------------------------------------------------------*/
+		#pragma omp single nowait
+		{
+			for (t = 0; t < numtasks; t++) {
+				if (t != workrank) {
+					gamma += gt[2*t];
+					delta += gt[2*t+1];
+				}
+			}
+			if (cgit == 1) {
+				beta = 0.0;
+				alpha = gamma / delta;
+			} else {
+				beta = gamma / gamma0;
+				alpha = gamma / (delta - beta*gamma/alpha);
+			}
+		} /* end single */
+
+		#pragma omp for private(sum,k)
+		for (j = beg_row; j <= end_row; j++) {
+			sum = 0.0;
+			for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+				sum = sum + a[k]*wc[colidx[k]];
+			}
+			q[j] = sum;
+		}
+
+		#pragma omp for
+		for (j = beg_row; j <= end_row; j++) {
+			u[j] = q[j] + beta*u[j];
+			s[j] = wc[j] + beta*s[j];
+			p[j] = r[j] + beta*p[j];
+			z[j] = z[j] + alpha*p[j];
+			r[j] = r[j] - alpha*s[j];
+			wn[j] = wc[j] - alpha*u[j];
+		}
+	} /* end of do cgit=1,cgitmax */
+
+	/*--------------------------------------------------------------------
+	c  z is read across nodes by the residual
+	c-------------------------------------------------------------------*/
+	argo::barrier(nthreads);
+}
+
+/*---------------------------------------------------------------------
+c       first row of node rank in the products.  The rows are split
+c       by count, or with CG_PARTITION=nnz so that every node gets
+c       about the same number of nonzeros (plus one per row, for the
+c       vector work).  rank numtasks gives the row past the last
+c---------------------------------------------------------------------*/
+static int node_first_row(int rank)
+{
+	int nrows = lastrow-firstrow+1;
+	int lo = 1, hi = nrows+1;
+	double target;
+
+	if (rank >= numtasks) {
+		return nrows+1;
+	}
+	if (!partition_rows) {
+		return 1 + rank * (nrows / numtasks);
+	}
+	target = (double)rank * ((rowstr[nrows+1] - rowstr[1]) + nrows) / numtasks;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if ((rowstr[mid] - rowstr[1]) + (mid - 1) < target) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
 /*---------------------------------------------------------------------
 c       generate the test problem for benchmark 6
 c       makea generates a sparse matrix with a
@@ -18,6 +18,7 @@
 #include <cstdio>
 #include <omp.h>
 #include <iostream>
+#include "argo.hpp"
 
 
 /*****************************************************************/
@@ -30,8 +31,8 @@
 /* Example:  SGI Indy5000: 50% slowdown with buckets             */
 /* Example:  SGI O2000:   400% slowdown with buckets (Wow!)      */
 /*****************************************************************/
-/* To disable the use of buckets, comment out the following line */
-#define USE_BUCKETS
+/* The DSM version always uses buckets: the nodes exchange their  */
+/* bucket counts and each node ranks a contiguous range of them    */
 
 /* Uncomment below for cyclic schedule */
 /*#define SCHED_CYCLIC*/
@@ -117,6 +118,7 @@
 
 #define  MAX_ITERATIONS      10
 #define  TEST_ARRAY_SIZE     5
+#define  VERIFY_BLOCK        (1 << 16)
 
 
 /*************************************/
@@ -144,17 +146,41 @@ int      passed_verification;
 /* These are the three main arrays. */
 /* See SIZE_OF_BUFFERS def above    */
 /************************************/
+/* key_array holds the keys of this node and key_buff1 the ranks of */
+/* its buckets; key_buff2 is global (argo): all the keys, in bucket */
+/* order after the exchange of rank()                               */
 INT_TYPE key_array[SIZE_OF_BUFFERS],
          key_buff1[MAX_KEY],
-         key_buff2[SIZE_OF_BUFFERS],
-         partial_verify_vals[TEST_ARRAY_SIZE],
-         **key_buff1_aptr = NULL;
+         *key_buff2,
+         partial_verify_vals[TEST_ARRAY_SIZE];
 
-#ifdef USE_BUCKETS
 INT_TYPE **bucket_size,
          bucket_ptrs[NUM_BUCKETS];
 #pragma omp threadprivate(bucket_ptrs)
-#endif
+
+
+/**********************/
+/* Distribution info  */
+/**********************/
+/* The keys are generated as by numtasks*nthreads processors, and  */
+/* node workrank keeps the global keys [node_k1, node_k1+node_keys) */
+int      workrank,
+         numtasks,
+         nthreads = 1;
+INT_TYPE node_k1,
+         node_keys;
+
+/* gbucket_size[node*NUM_BUCKETS+i] is the number of keys of node  */
+/* in bucket i; from them every node works out bucket_end[i], the  */
+/* end of bucket i in key_buff2, node_ptrs[i], where its own keys  */
+/* of bucket i go, and bucket_first, the range of buckets of each  */
+/* node: [bucket_first[n], bucket_first[n+1])                      */
+INT_TYPE *gbucket_size,
+         *gpartial_vals,               /* argo: the test keys of rank() */
+         *gverify_temps,               /* argo: 4 per node, see full_verify */
+         bucket_end[NUM_BUCKETS],
+         node_ptrs[NUM_BUCKETS];
+int      *bucket_first;
 
 
 /**********************/
@@ -398,12 +424,14 @@ void	create_seq( double seed, double a )
         int myid, num_procs;
         INT_TYPE mq;
 
-        myid = omp_get_thread_num();
-        num_procs = omp_get_num_threads();
+        /*  Thread t of node n is processor n*nthreads+t of the sequence */
+        myid = workrank*nthreads + omp_get_thread_num();
+        num_procs = numtasks*nthreads;
 
         mq = (NUM_KEYS + num_procs - 1) / num_procs;
         k1 = mq * myid;
         k2 = k1 + mq;
+        if ( k1 > NUM_KEYS ) k1 = NUM_KEYS;
         if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
 
         KS = 0;
@@ -417,7 +445,7 @@ void	create_seq( double seed, double a )
             x += randlc(&s, &an);
             x += randlc(&s, &an);
 
-            key_array[i] = k*x;
+            key_array[i-node_k1] = k*x;
         }
     } /*omp parallel*/
 }
@@ -447,27 +475,13 @@ void alloc_key_buff( void )
 
     num_procs = omp_get_max_threads();
 
-#ifdef USE_BUCKETS
     bucket_size = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
 
     for (i = 0; i < num_procs; i++) {
         bucket_size[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * NUM_BUCKETS);
     }
 
-    #pragma omp parallel for
-    for( i=0; i<NUM_KEYS; i++ )
-        key_buff2[i] = 0;
-
-#else /*USE_BUCKETS*/
-
-    key_buff1_aptr = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
-
-    key_buff1_aptr[0] = key_buff1;
-    for (i = 1; i < num_procs; i++) {
-        key_buff1_aptr[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * MAX_KEY);
-    }
-
-#endif /*USE_BUCKETS*/
+    bucket_first = (int *)alloc_mem(sizeof(int) * (numtasks+1));
 }
 
 
@@ -479,72 +493,80 @@ void alloc_key_buff( void )
 
 void full_verify( void )
 {
-    INT_TYPE   i, j;
-    INT_TYPE   k, k1;
+    INT_TYPE   i, j, n;
+    INT_TYPE   k, k1, b;
+    INT_TYPE   first, last;
 
 
     /*  Now, finally, sort the keys:  */
 
-    /*  Copy keys into work array; keys in key_array will be reassigned. */
-
-#ifdef USE_BUCKETS
+    /*  The keys of the buckets of this node, global positions [first, */
+    /*  last), are sorted into key_array, which is reassigned           */
+    first = (bucket_first[workrank] > 0)? bucket_end[bucket_first[workrank]-1] : 0;
+    last = (bucket_first[workrank+1] > 0)? bucket_end[bucket_first[workrank+1]-1] : 0;
 
     /* Buckets are already sorted.  Sorting keys within each bucket */
 #ifdef SCHED_CYCLIC
-    #pragma omp parallel for private(i,j,k,k1) schedule(static,1)
+    #pragma omp parallel for private(i,k,k1) schedule(static,1)
 #else
-    #pragma omp parallel for private(i,j,k,k1) schedule(dynamic)
+    #pragma omp parallel for private(i,k,k1) schedule(dynamic)
 #endif
-    for( j=0; j< NUM_BUCKETS; j++ ) {
+    for( b=bucket_first[workrank]; b< bucket_first[workrank+1]; b++ ) {
 
-        k1 = (j > 0)? bucket_ptrs[j-1] : 0;
-        for ( i = k1; i < bucket_ptrs[j]; i++ ) {
+        k1 = (b > 0)? bucket_end[b-1] : 0;
+        for ( i = k1; i < bucket_end[b]; i++ ) {
             k = --key_buff_ptr_global[key_buff2[i]];
-            key_array[k] = key_buff2[i];
+            key_array[k-first] = key_buff2[i];
         }
     }
 
-#else
 
-    #pragma omp parallel private(i,j,k,k1)
-    {
-        #pragma omp for
-        for( i=0; i<NUM_KEYS; i++ )
-            key_buff2[i] = key_array[i];
-
-        /* This is actual sorting. Each thread is responsible for
-        a subset of key values */
-        j = omp_get_num_threads();
-        j = (MAX_KEY + j - 1) / j;
-        k1 = j * omp_get_thread_num();
-        INT_TYPE k2 = k1 + j;
-        if (k2 > MAX_KEY) k2 = MAX_KEY;
-
-        for( i=0; i<NUM_KEYS; i++ ) {
-            if (key_buff2[i] >= k1 && key_buff2[i] < k2) {
-                k = --key_buff_ptr_global[key_buff2[i]];
-                key_array[k] = key_buff2[i];
+    /*  Confirm keys correctly sorted: the blocks of VERIFY_BLOCK keys are
+    checked in parallel, and all stop once one finds a key out of sort  */
+
+    j = 0;
+    #pragma omp parallel for private(i,k,k1) schedule(dynamic)
+    for( b=0; b< (last-first+VERIFY_BLOCK-1)/VERIFY_BLOCK; b++ ) {
+        #pragma omp atomic read
+        k = j;
+        if( k != 0 ) continue;
+
+        k1 = (b+1)*VERIFY_BLOCK;
+        if( k1 > last-first ) k1 = last-first;
+        for( i=(b > 0)? b*VERIFY_BLOCK : 1; i<k1; i++ ) {
+            if( key_array[i-1] > key_array[i] ) {
+                #pragma omp atomic write
+                j = 1;
+                break;
             }
         }
-    } /*omp parallel*/
-
-#endif
-
+    }
 
-    /*  Confirm keys correctly sorted: count incorrectly sorted keys, if any */
+    /*  Every node publishes its first and last key and whether it is */
+    /*  sorted, so that node 0 also checks both sides of each border   */
+    gverify_temps[4*workrank] = (last > first)? key_array[0] : -1;
+    gverify_temps[4*workrank+1] = (last > first)? key_array[last-first-1] : -1;
+    gverify_temps[4*workrank+2] = j;
+
+    argo::barrier();
+
+    if (workrank == 0) {
+        k = -1;
+        j = 0;
+        for( n=0; n<numtasks; n++ ) {
+            j += gverify_temps[4*n+2];
+            if (gverify_temps[4*n] < 0) continue;
+            if (gverify_temps[4*n] < k)
+                j++;
+            k = gverify_temps[4*n+1];
+        }
 
-    j = 0;
-    #pragma omp parallel for reduction(+:j)
-    for( i=1; i<NUM_KEYS; i++ ) {
-        if( key_array[i-1] > key_array[i] )
-            j++;
+        if( j != 0 )
+            printf( "Full_verify: keys out of sort on %ld nodes or borders\n", (long)j );
+        else
+            passed_verification++;
     }
 
-    if( j != 0 )
-        printf( "Full_verify: number of keys out of sort: %ld\n", (long)j );
-    else
-        passed_verification++;
-
 }
 
 
@@ -558,44 +580,40 @@ void full_verify( void )
 void rank( int iteration )
 {
 
-    INT_TYPE    i, k;
-    INT_TYPE    *key_buff_ptr, *key_buff_ptr2;
+    INT_TYPE    i, k, b, sum;
+    INT_TYPE    *key_buff_ptr;
 
-#ifdef USE_BUCKETS
     int shift = MAX_KEY_LOG_2 - NUM_BUCKETS_LOG_2;
     INT_TYPE num_bucket_keys = (1L << shift);
-#endif
 
 
-    key_array[iteration] = iteration;
-    key_array[iteration+MAX_ITERATIONS] = MAX_KEY - iteration;
+    /*  The node that holds them changes the two keys */
+    if( iteration - node_k1 >= 0 && iteration - node_k1 < node_keys )
+        key_array[iteration-node_k1] = iteration;
+    if( iteration+MAX_ITERATIONS - node_k1 >= 0 && iteration+MAX_ITERATIONS - node_k1 < node_keys )
+        key_array[iteration+MAX_ITERATIONS-node_k1] = MAX_KEY - iteration;
 
 
     /*  Determine where the partial verify test keys are, load into  */
-    /*  top of array bucket_size                                     */
+    /*  gpartial_vals, for all the nodes                              */
     for( i=0; i<TEST_ARRAY_SIZE; i++ )
-        partial_verify_vals[i] = key_array[test_index_array[i]];
+        if( test_index_array[i] - node_k1 >= 0 && test_index_array[i] - node_k1 < node_keys )
+            gpartial_vals[i] = key_array[test_index_array[i]-node_k1];
 
 
     /*  Setup pointers to key buffers  */
-#ifdef USE_BUCKETS
-    key_buff_ptr2 = key_buff2;
-#else
-    key_buff_ptr2 = key_array;
-#endif
     key_buff_ptr = key_buff1;
 
 
     #pragma omp parallel private(i, k)
     {
-        INT_TYPE *work_buff, m, k1, k2;
+        INT_TYPE *work_buff;
         int myid = omp_get_thread_num();
         int num_procs = omp_get_num_threads();
 
         /*  Bucket sort is known to improve cache performance on some   */
         /*  cache based systems.  But the actual performance may depend */
         /*  on cache size, problem size. */
-#ifdef USE_BUCKETS
 
         work_buff = bucket_size[myid];
 
@@ -603,127 +621,123 @@ void rank( int iteration )
         for( i=0; i<NUM_BUCKETS; i++ )
             work_buff[i] = 0;
 
-        /*  Determine the number of keys in each bucket */
+        /*  Determine the number of keys of this node in each bucket */
         #pragma omp for schedule(static)
-        for( i=0; i<NUM_KEYS; i++ )
+        for( i=0; i<node_keys; i++ )
             work_buff[key_array[i] >> shift]++;
 
-        /*  Accumulative bucket sizes are the bucket pointers.
-        These are global sizes accumulated upon to each bucket */
-        bucket_ptrs[0] = 0;
-        for( k=0; k< myid; k++ )  {
-            bucket_ptrs[0] += bucket_size[k][0];
+        #pragma omp for schedule(static)
+        for( i=0; i<NUM_BUCKETS; i++ ) {
+            INT_TYPE size = 0;
+            for( k=0; k< num_procs; k++ )
+                size += bucket_size[k][i];
+            gbucket_size[workrank*NUM_BUCKETS+i] = size;
+        }
+    } /*omp parallel*/
+
+    argo::barrier();
+
+    for( i=0; i<TEST_ARRAY_SIZE; i++ )
+        partial_verify_vals[i] = gpartial_vals[i];
+
+    /*  Accumulative bucket sizes are the bucket pointers.
+    The keys of the nodes are put in key_buff2 in bucket order and, inside
+    a bucket, in node order: node_ptrs[i] is where this node writes in
+    bucket i and bucket_end[i] the end of the bucket                      */
+    sum = 0;
+    for( i=0; i< NUM_BUCKETS; i++ ) {
+        for( k=0; k< numtasks; k++ ) {
+            if( k == workrank )
+                node_ptrs[i] = sum;
+            sum += gbucket_size[k*NUM_BUCKETS+i];
         }
+        bucket_end[i] = sum;
+    }
+
+    /*  Node n ranks the buckets from bucket_first[n]: the buckets are  */
+    /*  split where the keys before them reach n*NUM_KEYS/numtasks      */
+    b = 0;
+    bucket_first[0] = 0;
+    for( k=1; k< numtasks; k++ ) {
+        while( b < NUM_BUCKETS && (b > 0? bucket_end[b-1] : 0) < k*(NUM_KEYS/numtasks) )
+            b++;
+        bucket_first[k] = b;
+    }
+    bucket_first[numtasks] = NUM_BUCKETS;
+
+
+    #pragma omp parallel private(i, k)
+    {
+        int myid = omp_get_thread_num();
 
-        for( i=1; i< NUM_BUCKETS; i++ ) {
-            bucket_ptrs[i] = bucket_ptrs[i-1];
+        /*  The keys of the threads of lower id go first */
+        for( i=0; i< NUM_BUCKETS; i++ ) {
+            bucket_ptrs[i] = node_ptrs[i];
             for( k=0; k< myid; k++ )
                 bucket_ptrs[i] += bucket_size[k][i];
-            for( k=myid; k< num_procs; k++ )
-                bucket_ptrs[i] += bucket_size[k][i-1];
         }
 
-
-        /*  Sort into appropriate bucket */
+        /*  Sort into appropriate bucket, moving the keys to the node */
+        /*  that ranks it                                              */
         #pragma omp for schedule(static)
-        for( i=0; i<NUM_KEYS; i++ ) {
+        for( i=0; i<node_keys; i++ ) {
             k = key_array[i];
             key_buff2[bucket_ptrs[k >> shift]++] = k;
-
-        }
-        /*  The bucket pointers now point to the final accumulated sizes */
-        if (myid < num_procs-1) {
-            for( i=0; i< NUM_BUCKETS; i++ )
-                for( k=myid+1; k< num_procs; k++ )
-                    bucket_ptrs[i] += bucket_size[k][i];
         }
+    } /*omp parallel*/
+
+    argo::barrier();
 
 
-        /*  Now, buckets are sorted.  We only need to sort keys inside
-        each bucket, which can be done in parallel.  Because the distribution
-        of the number of keys in the buckets is Gaussian, the use of
-        a dynamic schedule should improve load balance, thus, performance     */
+    /*  Now, buckets are sorted.  We only need to sort keys inside
+    each bucket of this node, which can be done in parallel.  Because the
+    distribution of the number of keys in the buckets is Gaussian, the use of
+    a dynamic schedule should improve load balance, thus, performance     */
 
 #ifdef SCHED_CYCLIC
-        #pragma omp for schedule(static,1)
+    #pragma omp parallel for private(i, k) schedule(static,1)
 #else
-        #pragma omp for schedule(dynamic)
+    #pragma omp parallel for private(i, k) schedule(dynamic)
 #endif
-        for( i=0; i< NUM_BUCKETS; i++ ) {
-
-            /*  Clear the work array section associated with each bucket */
-            k1 = i * num_bucket_keys;
-            k2 = k1 + num_bucket_keys;
-            for ( k = k1; k < k2; k++ )
-                key_buff1[k] = 0;
-
-            /*  Ranking of all keys occurs in this section:                 */
-
-            /*  In this section, the keys themselves are used as their
-            own indexes to determine how many of each there are: their
-            individual population                                       */
-            m = (i > 0)? bucket_ptrs[i-1] : 0;
-            for ( k = m; k < bucket_ptrs[i]; k++ )
-                key_buff1[key_buff2[k]]++;  /* Now they have individual key   */
-            /* population                     */
-
-            /*  To obtain ranks of each key, successively add the individual key
-            population, not forgetting to add m, the total of lesser keys,
-            to the first key population                                          */
-            key_buff1[k1] += m;
-            for ( k = k1+1; k < k2; k++ )
-                key_buff1[k] += key_buff1[k-1];
-
-        }
-
-#else /*USE_BUCKETS*/
-
-
-        work_buff = key_buff1_aptr[myid];
-
-
-        /*  Clear the work array */
-        for( i=0; i<MAX_KEY; i++ )
-            work_buff[i] = 0;
+    for( b=bucket_first[workrank]; b< bucket_first[workrank+1]; b++ ) {
+        INT_TYPE m, k1, k2;
 
+        /*  Clear the work array section associated with each bucket */
+        k1 = b * num_bucket_keys;
+        k2 = k1 + num_bucket_keys;
+        for ( k = k1; k < k2; k++ )
+            key_buff1[k] = 0;
 
         /*  Ranking of all keys occurs in this section:                 */
 
         /*  In this section, the keys themselves are used as their
         own indexes to determine how many of each there are: their
         individual population                                       */
-
-        #pragma omp for nowait schedule(static)
-        for( i=0; i<NUM_KEYS; i++ )
-            work_buff[key_buff_ptr2[i]]++;  /* Now they have individual key   */
+        m = (b > 0)? bucket_end[b-1] : 0;
+        for ( k = m; k < bucket_end[b]; k++ )
+            key_buff1[key_buff2[k]]++;  /* Now they have individual key   */
         /* population                     */
 
         /*  To obtain ranks of each key, successively add the individual key
-        population                                          */
-
-        for( i=0; i<MAX_KEY-1; i++ )
-            work_buff[i+1] += work_buff[i];
-
-        #pragma omp barrier
+        population, not forgetting to add m, the total of lesser keys,
+        to the first key population                                          */
+        key_buff1[k1] += m;
+        for ( k = k1+1; k < k2; k++ )
+            key_buff1[k] += key_buff1[k-1];
 
-        /*  Accumulate the global key population */
-        for( k=1; k<num_procs; k++ ) {
-            #pragma omp for nowait schedule(static)
-            for( i=0; i<MAX_KEY; i++ )
-                key_buff_ptr[i] += key_buff1_aptr[k][i];
-        }
-
-#endif /*USE_BUCKETS*/
-
-    } /*omp parallel*/
+    }
 
     /* This is the partial verify test section */
     /* Observe that test_rank_array vals are   */
     /* shifted differently for different cases */
+    /* Each key is checked by the node that    */
+    /* ranked it                               */
     for( i=0; i<TEST_ARRAY_SIZE; i++ )
     {
         k = partial_verify_vals[i];          /* test vals were put here */
-        if( 0 < k  &&  k <= NUM_KEYS-1 )
+        b = (k-1) >> shift;
+        if( 0 < k  &&  k <= NUM_KEYS-1  &&
+            b >= bucket_first[workrank]  &&  b < bucket_first[workrank+1] )
         {
             INT_TYPE key_rank = key_buff_ptr[k-1];
             int failed = 0;
@@ -835,12 +849,38 @@ void rank( int iteration )
 
 int main( int argc, char **argv )
 {
-    int nthreads=1;
+    /*  Room for key_buff2 and the small shared arrays */
+    argo::init((size_t)SIZE_OF_BUFFERS*sizeof(INT_TYPE) + 256*1024*1024UL);
+
     int   i, iteration, timer_on;
+    INT_TYPE mq;
     double  timecounter;
 
     FILE *fp;
 
+    #pragma omp parallel
+    {
+        #if defined(_OPENMP)
+        #pragma omp master
+            nthreads = omp_get_num_threads();
+        #endif /* _OPENMP */
+    }
+
+    workrank = argo::node_id();
+    numtasks = argo::number_of_nodes();
+
+    key_buff2 = argo::conew_array<INT_TYPE>(SIZE_OF_BUFFERS);
+    gbucket_size = argo::conew_array<INT_TYPE>(numtasks*NUM_BUCKETS);
+    gpartial_vals = argo::conew_array<INT_TYPE>(TEST_ARRAY_SIZE);
+    gverify_temps = argo::conew_array<INT_TYPE>(4*numtasks);
+
+    /*  The keys of this node: those of its nthreads processors */
+    mq = (NUM_KEYS + numtasks*nthreads - 1) / (numtasks*nthreads);
+    node_k1 = mq * nthreads * workrank;
+    if ( node_k1 > NUM_KEYS ) node_k1 = NUM_KEYS;
+    node_keys = mq * nthreads;
+    if ( node_k1 + node_keys > NUM_KEYS ) node_keys = NUM_KEYS - node_k1;
+
 
     /*  Initialize timers  */
     timer_on = 0;
@@ -891,12 +931,15 @@ int main( int argc, char **argv )
 
 
     /*  Printout initial NPB info */
-    printf  ( "\n\n NAS Parallel Benchmarks 4.0 OpenMP C++ version - IS Benchmark\n\n" );
-    printf("\n\n Developed by: Dalvan Griebler <dalvan.griebler@acad.pucrs.br>\n");
-    printf( " Size:  %ld  (class %c)\n", (long)TOTAL_KEYS, CLASS );
-    printf( " Iterations:  %d\n", MAX_ITERATIONS );
-    printf( " Number of available threads:  %d\n", omp_get_max_threads() );
-    printf( "\n" );
+    if (workrank == 0) {
+        printf  ( "\n\n NAS Parallel Benchmarks 4.0 OpenMP C++ version - IS Benchmark\n\n" );
+        printf("\n\n Developed by: Dalvan Griebler <dalvan.griebler@acad.pucrs.br>\n");
+        printf( " Size:  %ld  (class %c)\n", (long)TOTAL_KEYS, CLASS );
+        printf( " Iterations:  %d\n", MAX_ITERATIONS );
+        printf( " Number of nodes:  %d\n", numtasks );
+        printf( " Number of available threads:  %d\n", omp_get_max_threads() );
+        printf( "\n" );
+    }
 
     if (timer_on) timer_start( 1 );
 
@@ -915,7 +958,9 @@ int main( int argc, char **argv )
     /*  Start verification counter */
     passed_verification = 0;
 
-    if( CLASS != 'S' ) printf( "\n   iteration\n" );
+    if( CLASS != 'S' && workrank == 0 ) printf( "\n   iteration\n" );
+
+    argo::barrier();
 
     /*  Start timer  */
     timer_start( 0 );
@@ -924,12 +969,13 @@ int main( int argc, char **argv )
     /*  This is the main iteration */
     for( iteration=1; iteration<=MAX_ITERATIONS; iteration++ )
     {
-        if( CLASS != 'S' ) printf( "        %d\n", iteration );
+        if( CLASS != 'S' && workrank == 0 ) printf( "        %d\n", iteration );
         rank( iteration );
     }
 
 
     /*  End of timing, obtain maximum time of all processors */
+    argo::barrier();
     timer_stop( 0 );
     
     timecounter = timer_read( 0 );
@@ -944,18 +990,26 @@ int main( int argc, char **argv )
     if (timer_on) timer_stop( 3 );
 
 
+    /*  The verifications passed on all the nodes */
+    gverify_temps[4*workrank+3] = passed_verification;
+    argo::barrier();
+    passed_verification = 0;
+    for( i=0; i<numtasks; i++ )
+        passed_verification += gverify_temps[4*i+3];
+
     /*  The final printout  */
     if( passed_verification != 5*MAX_ITERATIONS + 1 )
         passed_verification = 0;
     /*c_print_results( "IS", CLASS, (int)(TOTAL_KEYS/64), 64, 0, MAX_ITERATIONS, timecounter, ((double) (MAX_ITERATIONS*TOTAL_KEYS))
     /timecounter/1000000., "keys ranked", passed_verification, NPBVERSION, COMPILETIME, CC, CLINK, C_LIB, C_INC,
     CFLAGS, CLINKFLAGS );*/
-    c_print_results( (char*)"IS", CLASS, TOTAL_KEYS, 0, 0, MAX_ITERATIONS, nthreads, timecounter,
-                     ((double) (MAX_ITERATIONS*TOTAL_KEYS))/timecounter/1000000.0, (char*)"keys ranked", passed_verification,
-                     (char*)NPBVERSION, (char*)COMPILETIME, (char*)CC, (char*)CLINK, (char*)C_LIB, (char*)C_INC, (char*)CFLAGS, (char*)CLINKFLAGS, (char*)"randlc");
+    if (workrank == 0)
+        c_print_results( (char*)"IS", CLASS, TOTAL_KEYS, 0, 0, MAX_ITERATIONS, numtasks*nthreads, timecounter,
+                         ((double) (MAX_ITERATIONS*TOTAL_KEYS))/timecounter/1000000.0, (char*)"keys ranked", passed_verification,
+                         (char*)NPBVERSION, (char*)COMPILETIME, (char*)CC, (char*)CLINK, (char*)C_LIB, (char*)C_INC, (char*)CFLAGS, (char*)CLINKFLAGS, (char*)"randlc");
 
     /*  Print additional timers  */
-    if (timer_on) {
+    if (timer_on && workrank == 0) {
         double t_total, t_percent;
 
         t_total = timer_read( 3 );
@@ -972,6 +1026,14 @@ int main( int argc, char **argv )
         t_percent = timecounter/t_total * 100.;
         printf(" Sorting        : %8.3f (%5.2f%%)\n", timecounter, t_percent);
     }
+
+    argo::codelete_array(key_buff2);
+    argo::codelete_array(gbucket_size);
+    argo::codelete_array(gpartial_vals);
+    argo::codelete_array(gverify_temps);
+
+    argo::finalize();
+
     return 0;
 }
 /**************************/
@@ -28,6 +28,7 @@ c---------------------------------------------------------------------
 
 #include <ff/parallel_for.hpp>
 #include <iostream>
+#include <cstring>
 #include "npb-CPP.hpp"
 #include "npbparams.hpp"
 
@@ -76,17 +77,60 @@ static void makea(int n, int nz, double a[], int colidx[], int rowstr[],
 	double aelt[], double v[], int iv[], double shift );
 static void sparse(double a[], int colidx[], int rowstr[], int n,
 	int arow[], int acol[], double aelt[],
-	int firstrow, int lastrow,
-	double x[], boolean mark[], int nzloc[], int nnza);
+	int firstrow, int lastrow, int nnza);
+static void prefix_sum(const int src[], int dst[], int lo, int hi, int base);
 static void sprnvc(int n, int nz, double v[], int iv[], int nzloc[], int mark[]);
 static int icnvrt(double x, int ipwr2);
 static void vecset(int n, double v[], int iv[], int *nzv, int i, double val);
+static void partition_build(int rowstr[], int nrows);
 
 
 
 ff::ParallelFor * pf;
 int num_workers;
 
+/* common /kernel_mode/ */
+static boolean fused_kernels;
+static double * dot_queue;
+static boolean partition_rows;
+
+/* common /part_mem/ */
+static int part_count;
+static int *part_first;		/* part_first[0:part_count]: first row of each part, NULL if off */
+
+/*--------------------------------------------------------------------
+c  Loops over rows and vector entries.  Without a partition they are
+c  the plain FastFlow loops; with CG_PARTITION=nnz the parts are run
+c  with static scheduling (grain 0), one part per worker, and body
+c  gets the part as id, so the partial sums are added in part order
+c-------------------------------------------------------------------*/
+template <class Body>
+static void partitioned_for_thid(int lo, int hi, int grain, const Body& body)
+{
+	if (part_first == NULL) {
+		pf->parallel_for_thid(lo, hi, 1, grain, body);
+		return;
+	}
+	pf->parallel_for_thid(0, part_count, 1, 0, [&](int part, int){
+		int end = min(hi, part_first[part+1]);
+		for (int j = max(lo, part_first[part]); j < end; j++) {
+			body(j, part);
+		}
+	});
+}
+
+template <class Body>
+static void partitioned_for(int lo, int hi, const Body& body)
+{
+	if (part_first == NULL) {
+		pf->parallel_for(lo, hi, 1, body);
+		return;
+	}
+	partitioned_for_thid(lo, hi, 0, [&](int j, int){
+		body(j);
+	});
+}
+
 /*--------------------------------------------------------------------
       program cg
 --------------------------------------------------------------------*/
@@ -151,6 +195,25 @@ int main(int argc, char **argv)
 	
 	pf = new ff::ParallelFor(num_workers, true);
 
+	if(const char * fk = std::getenv("CG_FUSED")) {
+		fused_kernels = atoi(fk);
+	} else {
+		fused_kernels = FALSE;
+	}
+	if (fused_kernels) {
+		printf(" Fused SpMV/dot/axpy kernels enabled\n");
+	}
+	dot_queue = new double[num_workers];
+
+	if(const char * cp = std::getenv("CG_PARTITION")) {
+		partition_rows = (strcmp(cp, "nnz") == 0);
+		if (!partition_rows && strcmp(cp, "rows") != 0) {
+			printf(" Unknown CG_PARTITION %s, using rows\n", cp);
+		}
+	} else {
+		partition_rows = FALSE;
+	}
+
 
 	/*--------------------------------------------------------------------
 	c  
@@ -175,6 +238,10 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (partition_rows) {
+		partition_build(rowstr, lastrow-firstrow+1);
+	}
+
 	/*--------------------------------------------------------------------
 	c  set starting vector to (1, 1, .... 1)
 	c-------------------------------------------------------------------*/
@@ -392,14 +459,35 @@ c---------------------------------------------------------------------*/
 		C        The unrolled-by-8 version below is significantly faster
 		C        on the Cray t3d - overall speed of code is 1.5 times faster.
 		*/
-		/* rolled version */      
-		pf->parallel_for(1, lastrow-firstrow+2, 1, [&](int j){
-			double sum = 0.0;
-			for (int k = rowstr[j]; k < rowstr[j+1]; k++) {
-				sum += a[k]*p[colidx[k]];
-		    }
-			w[j] = sum;
-		});
+		if (fused_kernels) {
+			/*--------------------------------------------------------------------
+			c  Fused: q = A.p is written directly and p.q is accumulated
+			c  in the same sweep, so w, its copy and its clear are skipped
+			c-------------------------------------------------------------------*/
+			for(int i=0; i<num_workers; i++)
+				dot_queue[i] = 0.0;
+
+			partitioned_for_thid(1, lastrow-firstrow+2, (int)((lastrow-firstrow+2)/num_workers)+1, [&](int j, int id){
+				double sum = 0.0;
+				for (int k = rowstr[j]; k < rowstr[j+1]; k++) {
+					sum += a[k]*p[colidx[k]];
+				}
+				q[j] = sum;
+				dot_queue[id] += p[j]*sum;
+			});
+
+			for(int i=0; i<num_workers; i++)
+				d += dot_queue[i];
+		} else {
+			/* rolled version */      
+			partitioned_for(1, lastrow-firstrow+2, [&](int j){
+				double sum = 0.0;
+				for (int k = rowstr[j]; k < rowstr[j+1]; k++) {
+					sum += a[k]*p[colidx[k]];
+			    }
+				w[j] = sum;
+			});
+		}
 
 		/* unrolled-by-two version
 		for (j = 1; j <= lastrow-firstrow+1; j++) {
@@ -441,22 +529,24 @@ c---------------------------------------------------------------------*/
 			w[j] = sum;
 		}
 		*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			q[j] = w[j];
-		}
+		if (!fused_kernels) {
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				q[j] = w[j];
+			}
 
-		/*--------------------------------------------------------------------
-		c  Clear w for reuse...
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			w[j] = 0.0;
-		}
+			/*--------------------------------------------------------------------
+			c  Clear w for reuse...
+			c-------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				w[j] = 0.0;
+			}
 
-		/*--------------------------------------------------------------------
-		c  Obtain p.q
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			d = d + p[j]*q[j];
+			/*--------------------------------------------------------------------
+			c  Obtain p.q
+			c-------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				d = d + p[j]*q[j];
+			}
 		}
 
 		/*--------------------------------------------------------------------
@@ -473,17 +563,34 @@ c---------------------------------------------------------------------*/
 		c  Obtain z = z + alpha*p
 		c  and    r = r - alpha*q
 		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			z[j] = z[j] + alpha*p[j];
-			r[j] = r[j] - alpha*q[j];
-		}
+		if (fused_kernels) {
+			/*---------------------------------------------------------------------
+			c  Fused: rho = r.r is accumulated while r is updated
+			c---------------------------------------------------------------------*/
+			for(int i=0; i<num_workers; i++)
+				dot_queue[i] = 0.0;
+
+			partitioned_for_thid(1, lastcol-firstcol+2, (int)((lastcol-firstcol+2)/num_workers)+1, [&](int j, int id){
+				z[j] = z[j] + alpha*p[j];
+				r[j] = r[j] - alpha*q[j];
+				dot_queue[id] += r[j]*r[j];
+			});
+
+			for(int i=0; i<num_workers; i++)
+				rho += dot_queue[i];
+		} else {
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				z[j] = z[j] + alpha*p[j];
+				r[j] = r[j] - alpha*q[j];
+			}
             
-		/*---------------------------------------------------------------------
-		c  rho = r.r
-		c  Now, obtain the norm of r: First, sum squares of r elements locally...
-		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			rho = rho + r[j]*r[j];
+			/*---------------------------------------------------------------------
+			c  rho = r.r
+			c  Now, obtain the norm of r: First, sum squares of r elements locally...
+			c---------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				rho = rho + r[j]*r[j];
+			}
 		}
 
 		/*--------------------------------------------------------------------
@@ -505,40 +612,98 @@ c---------------------------------------------------------------------*/
 	c  The partition submatrix-vector multiply
 	c---------------------------------------------------------------------*/
 	sum = 0.0;
-    
-    pf->parallel_for(1, lastrow-firstrow+2, 1, [&](int j){
-		double d = 0.0;
-		for (int k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
-			d = d + a[k]*z[colidx[k]];
-		}
-		w[j] = d;
-	});
 
-	for (j = 1; j <= lastcol-firstcol+1; j++) {
-		r[j] = w[j];
-	}
+	if (fused_kernels) {
+		/*--------------------------------------------------------------------
+		c  Fused: r = A.z and ||x - r||^2 in a single sweep
+		c-------------------------------------------------------------------*/
+		for(int i=0; i<num_workers; i++)
+			dot_queue[i] = 0.0;
 
-	/*--------------------------------------------------------------------
-	c  At this point, r contains A.z
-	c-------------------------------------------------------------------*/
-	double * sum_queue = new double[num_workers];
+		partitioned_for_thid(1, lastrow-firstrow+2, (int)((lastrow-firstrow+2)/num_workers)+1, [&](int j, int id){
+			double d = 0.0;
+			for (int k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			r[j] = d;
+			d = x[j] - d;
+			dot_queue[id] += d*d;
+		});
+
+		for(int i=0; i<num_workers; i++)
+			sum += dot_queue[i];
+	} else {
+	    partitioned_for(1, lastrow-firstrow+2, [&](int j){
+			double d = 0.0;
+			for (int k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			w[j] = d;
+		});
+
+		for (j = 1; j <= lastcol-firstcol+1; j++) {
+			r[j] = w[j];
+		}
+
+		/*--------------------------------------------------------------------
+		c  At this point, r contains A.z
+		c-------------------------------------------------------------------*/
+		double * sum_queue = new double[num_workers];
 	
-	// map
-	for(int i=0; i<num_workers; i++)
-		sum_queue[i] = 0.0;
+		// map
+		for(int i=0; i<num_workers; i++)
+			sum_queue[i] = 0.0;
 
-	pf->parallel_for_thid(1, lastcol-firstcol+2, 1, (int)((lastcol-firstcol+2)/num_workers)+1,[&](int j, int id){
-		double d = x[j] - r[j];
-		sum_queue[id] += d*d;
-	});
+		partitioned_for_thid(1, lastcol-firstcol+2, (int)((lastcol-firstcol+2)/num_workers)+1,[&](int j, int id){
+			double d = x[j] - r[j];
+			sum_queue[id] += d*d;
+		});
 
-	// reduce
-	for(int i=0; i<num_workers; i++)
-		sum += sum_queue[i];
+		// reduce
+		for(int i=0; i<num_workers; i++)
+			sum += sum_queue[i];
+	}
 	
 	(*rnorm) = sqrt(sum);
 }
 
+/*---------------------------------------------------------------------
+c       split the rows in num_workers parts of about the same number
+c       of nonzeros (plus one per row, for the vector work).
+c       The last part also owns the padding entries up to NA+2
+c---------------------------------------------------------------------*/
+static void partition_build(int rowstr[], int nrows)
+{
+	int part, j;
+	int nnz = rowstr[nrows+1] - rowstr[1];
+	int minrows = nrows, maxrows = 0;
+	int minnz = nnz, maxnz = 0;
+
+	part_count = max(1, min(num_workers, nrows));
+	part_first = new int[part_count+1];
+	part_first[0] = 1;
+	j = 1;
+	for (part = 1; part < part_count; part++) {
+		double target = (double)part * (nnz + nrows) / part_count;
+		while (j <= nrows && (rowstr[j] - rowstr[1]) + (j - 1) < target) {
+			j++;
+		}
+		part_first[part] = max(j, part_first[part-1]);
+	}
+	part_first[part_count] = NA+3;
+
+	for (part = 0; part < part_count; part++) {
+		int rows = min(part_first[part+1], nrows+1) - part_first[part];
+		int pnz = rowstr[min(part_first[part+1], nrows+1)] - rowstr[part_first[part]];
+		minrows = min(minrows, rows);
+		maxrows = max(maxrows, rows);
+		minnz = min(minnz, pnz);
+		maxnz = max(maxnz, pnz);
+	}
+	printf(" Row partition: %d nnz-balanced parts, %d..%d rows, %d..%d nonzeros each\n",
+		part_count, minrows, maxrows, minnz, maxnz);
+}
+
 /*---------------------------------------------------------------------
 c       generate the test problem for benchmark 6
 c       makea generates a sparse matrix with a
@@ -583,79 +748,108 @@ static void makea(
 	int iv[],		/* iv[1:2*n+1] */
 	double shift )
 {
-	int i, nnza, iouter, ivelt, ivelt1, irow, nzv;
+	int i, nnza, iouter, ndiag;
 
 	/*--------------------------------------------------------------------
 	c      nonzer is approximately  (int(sqrt(nnza /n)));
 	c-------------------------------------------------------------------*/
 
-	double size, ratio, scale;
-	int jcol;
+	double size, ratio;
+	int stride = nonzer+2;
+	int *nzv = new int[n+1];					/* nzv[1:n]: nonzeros of each outer vector */
+	int *offset = new int[n+2];					/* offset[1:n+1]: first triple of each outer product, less one */
+	double *vecv = new double[(size_t)n*stride];	/* values of the n outer vectors */
+	int *veci = new int[(size_t)n*stride];		/* positions of the n outer vectors */
 
 	size = 1.0;
 	ratio = pow(rcond, (1.0 / (double)n));
-	nnza = 0;
 
 	/*---------------------------------------------------------------------
-	c  Initialize colidx(n+1 .. 2n) to zero.
-	c  Used by sprnvc to mark nonzero positions
+	c  Draw the n sparse vectors.  The number of draws a vector takes
+	c  depends on the rejections in sprnvc, so the random stream cannot
+	c  be split ahead of time; this pass is cheap next to the products.
+	c  v keeps the scale of each product and iv is the sprnvc workspace
 	c---------------------------------------------------------------------*/
 	for (i = 1; i <= n; i++) {
-		colidx[n+i] = 0;
+		iv[n+i] = 0;
 	}
 	for (iouter = 1; iouter <= n; iouter++) {
-		nzv = nonzer;
-		sprnvc(n, nzv, v, iv, &(colidx[0]), &(colidx[n]));
-		vecset(n, v, iv, &nzv, iouter, 0.5);
-		for (ivelt = 1; ivelt <= nzv; ivelt++){
-			jcol = iv[ivelt];
+		double *vo = &vecv[(size_t)(iouter-1)*stride];
+		int *io = &veci[(size_t)(iouter-1)*stride];
+		nzv[iouter] = nonzer;
+		sprnvc(n, nzv[iouter], vo, io, &(iv[0]), &(iv[n]));
+		vecset(n, vo, io, &nzv[iouter], iouter, 0.5);
+		v[iouter] = size;
+		size = size * ratio;
+	}
+
+	/*---------------------------------------------------------------------
+	c  Count the triples of each outer product and place them
+	c---------------------------------------------------------------------*/
+	pf->parallel_for(1, n+1, 1, [&](int iouter){
+		int *io = &veci[(size_t)(iouter-1)*stride];
+		int ncol = 0, nrow = 0;
+		for (int ivelt = 1; ivelt <= nzv[iouter]; ivelt++) {
+			if (io[ivelt] >= firstcol && io[ivelt] <= lastcol) ncol++;
+			if (io[ivelt] >= firstrow && io[ivelt] <= lastrow) nrow++;
+		}
+		offset[iouter+1] = ncol*nrow;
+	});
+	offset[1] = 0;
+	prefix_sum(offset, offset, 2, n+2, 0);
+
+	ndiag = max(0, min(lastrow, lastcol) - max(firstrow, firstcol) + 1);
+	nnza = offset[n+1] + ndiag;
+	if (nnza > nz) {
+		for (iouter = 1; iouter <= n && offset[iouter+1] <= nz; iouter++);
+		if (iouter > n) iouter = n + max(firstrow, firstcol) + nz - offset[n+1];
+		printf("Space for matrix elements exceeded in" " makea\n");
+		printf("nnza, nzmax = %d, %d\n", nnza, nz);
+		printf("iouter = %d\n", iouter);
+		exit(1);
+	}
+
+	pf->parallel_for(1, n+1, 1, [&](int iouter){
+		double *vo = &vecv[(size_t)(iouter-1)*stride];
+		int *io = &veci[(size_t)(iouter-1)*stride];
+		int nza = offset[iouter];
+		for (int ivelt = 1; ivelt <= nzv[iouter]; ivelt++) {
+			int jcol = io[ivelt];
 			if (jcol >= firstcol && jcol <= lastcol) {
-				scale = size * v[ivelt];
-				for (ivelt1 = 1; ivelt1 <= nzv; ivelt1++) {
-					irow = iv[ivelt1];
+				double scale = v[iouter] * vo[ivelt];
+				for (int ivelt1 = 1; ivelt1 <= nzv[iouter]; ivelt1++) {
+					int irow = io[ivelt1];
 					if (irow >= firstrow && irow <= lastrow) {
-						nnza = nnza + 1;
-						if (nnza > nz) {
-							printf("Space for matrix elements exceeded in" " makea\n");
-							printf("nnza, nzmax = %d, %d\n", nnza, nz);
-							printf("iouter = %d\n", iouter);
-							exit(1);
-						}
-						acol[nnza] = jcol;
-						arow[nnza] = irow;
-						aelt[nnza] = v[ivelt1] * scale;
+						nza = nza + 1;
+						acol[nza] = jcol;
+						arow[nza] = irow;
+						aelt[nza] = vo[ivelt1] * scale;
 					}
 				}
 			}
 		}
-		size = size * ratio;
-	}
+	});
 
 	/*---------------------------------------------------------------------
 	c       ... add the identity * rcond to the generated matrix to bound
 	c           the smallest eigenvalue from below by rcond
 	c---------------------------------------------------------------------*/
-	for (i = firstrow; i <= lastrow; i++) {
-		if (i >= firstcol && i <= lastcol) {
-			iouter = n + i;
-			nnza = nnza + 1;
-			if (nnza > nz) {
-				printf("Space for matrix elements exceeded in makea\n");
-				printf("nnza, nzmax = %d, %d\n", nnza, nz);
-				printf("iouter = %d\n", iouter);
-				exit(1);
-			}
-			acol[nnza] = i;
-			arow[nnza] = i;
-			aelt[nnza] = rcond - shift;
-		}
-	}
+	pf->parallel_for(1, ndiag+1, 1, [&](int i){
+		int nza = offset[n+1] + i;
+		acol[nza] = max(firstrow, firstcol) + i - 1;
+		arow[nza] = max(firstrow, firstcol) + i - 1;
+		aelt[nza] = rcond - shift;
+	});
+
+	delete[] nzv;
+	delete[] offset;
+	delete[] vecv;
+	delete[] veci;
 
 	/*---------------------------------------------------------------------
 	c       ... make the sparse matrix from list of elements with duplicates
-	c           (v and iv are used as  workspace)
 	c---------------------------------------------------------------------*/
-	sparse(a, colidx, rowstr, n, arow, acol, aelt, firstrow, lastrow, v, &(iv[0]), &(iv[n]), nnza);
+	sparse(a, colidx, rowstr, n, arow, acol, aelt, firstrow, lastrow, nnza);
 }
 
 /*---------------------------------------------------
@@ -672,41 +866,49 @@ static void sparse(
 	double aelt[],	/* aelt[1:*] */
 	int firstrow,
 	int lastrow,
-	double x[],		/* x[1:n] */
-	boolean mark[],	/* mark[1:n] */
-	int nzloc[],	/* nzloc[1:n] */
 	int nnza)
 /*---------------------------------------------------------------------
 c       rows range from firstrow to lastrow
 c       the rowstr pointers are defined for nrows = lastrow-firstrow+1 values
+c
+c       The triples are split in nblocks contiguous blocks.  Each block
+c       counts its own row lengths, so that after the prefix sum every block
+c       knows where its part of every row starts and the bucket sort
+c       keeps the order of the serial one.  The result is identical to
+c       the serial sparse
 c---------------------------------------------------------------------*/
 {
-	int nrows;
-	int i, j, jajp1, nza, k, nzrow;
-	double xi;
+	int nrows = lastrow - firstrow + 1;
+	int nblocks = max(1, min(num_workers, nnza));
+	int bsize = (nnza + nblocks - 1) / nblocks;
+	int *count = new int[(size_t)nblocks*(nrows+1)];	/* count[b*(nrows+1)+j] */
+	int *nzrow = new int[nrows+2];
 
 	/*--------------------------------------------------------------------
-	c    how many rows of result
+	c     ...count the number of triples in each row, per block
 	c-------------------------------------------------------------------*/
-	nrows = lastrow - firstrow + 1;
+	pf->parallel_for(0, nblocks, 1, [&](int b){
+		int *cnt = &count[(size_t)b*(nrows+1)];
+		for (int j = 1; j <= nrows; j++) {
+			cnt[j] = 0;
+		}
+		for (int nza = b*bsize+1; nza <= min((b+1)*bsize, nnza); nza++) {
+			cnt[arow[nza] - firstrow + 1]++;
+		}
+	});
 
-	/*--------------------------------------------------------------------
-	c     ...count the number of triples in each row
-	c-------------------------------------------------------------------*/
-	for (j = 1; j <= n; j++) {
-		rowstr[j] = 0;
-		mark[j] = FALSE;
-	}
-	rowstr[n+1] = 0;
+	pf->parallel_for(1, nrows+1, 1, [&](int j){
+		int len = 0;
+		for (int b = 0; b < nblocks; b++) {
+			int c = count[(size_t)b*(nrows+1)+j];
+			count[(size_t)b*(nrows+1)+j] = len;
+			len += c;
+		}
+		nzrow[j+1] = len;
+	});
 
-	for (nza = 1; nza <= nnza; nza++) {
-		j = (arow[nza] - firstrow + 1) + 1;
-		rowstr[j] = rowstr[j] + 1;
-	}
 	rowstr[1] = 1;
-	for (j = 2; j <= nrows+1; j++) {
-		rowstr[j] = rowstr[j] + rowstr[j-1];
-	}
+	prefix_sum(nzrow, rowstr, 2, nrows+2, 1);
 
 	/*---------------------------------------------------------------------
 	c     ... rowstr(j) now is the location of the first nonzero
@@ -716,65 +918,131 @@ c---------------------------------------------------------------------*/
 	/*--------------------------------------------------------------------
 	c     ... do a bucket sort of the triples on the row index
 	c-------------------------------------------------------------------*/
-	for (nza = 1; nza <= nnza; nza++) {
-		j = arow[nza] - firstrow + 1;
-		k = rowstr[j];
-		a[k] = aelt[nza];
-		colidx[k] = acol[nza];
-		rowstr[j] = rowstr[j] + 1;
-	}
+	pf->parallel_for(0, nblocks, 1, [&](int b){
+		int *cnt = &count[(size_t)b*(nrows+1)];
+		for (int nza = b*bsize+1; nza <= min((b+1)*bsize, nnza); nza++) {
+			int j = arow[nza] - firstrow + 1;
+			int k = rowstr[j] + cnt[j]++;
+			a[k] = aelt[nza];
+			colidx[k] = acol[nza];
+		}
+	});
 
-	/*--------------------------------------------------------------------
-	c       ... rowstr(j) now points to the first element of row j+1
-	c-------------------------------------------------------------------*/
-	for (j = nrows; j >= 1; j--) {
-		rowstr[j+1] = rowstr[j];
-	}
-	rowstr[1] = 1;
+	delete[] count;
 
 	/*--------------------------------------------------------------------
-	c       ... generate the actual output rows by adding elements
+	c       ... generate the actual output rows by adding elements.
+	c       Each block of rows has its own x, mark and nzloc, and
+	c       merges its rows into the front of their own range;
+	c       nzrow[j+1] gets the new length of row j
 	c-------------------------------------------------------------------*/
-	nza = 0;
-	for (i = 1; i <= n; i++) {
-		x[i] = 0.0;
-		mark[i] = FALSE;
-	}
+	int rblock = (nrows + nblocks - 1) / nblocks;
+	pf->parallel_for(0, nblocks, 1, [&](int b){
+		double *x = new double[n+1];
+		boolean *mark = new boolean[n+1];
+		int *nzloc = new int[n+1];
+		for (int i = 1; i <= n; i++) {
+			x[i] = 0.0;
+			mark[i] = FALSE;
+		}
+		for (int j = b*rblock+1; j <= min((b+1)*rblock, nrows); j++) {
+			int nzr = 0, nza = rowstr[j] - 1;
 
-	jajp1 = rowstr[1];
-	for (j = 1; j <= nrows; j++) {
-		nzrow = 0;
+			/*--------------------------------------------------------------------
+			c          ...loop over the jth row of a
+			c-------------------------------------------------------------------*/
+			for (int k = rowstr[j]; k < rowstr[j+1]; k++) {
+				int i = colidx[k];
+				x[i] = x[i] + a[k];
+				if ( mark[i] == FALSE && x[i] != 0.0) {
+					mark[i] = TRUE;
+					nzr = nzr + 1;
+					nzloc[nzr] = i;
+				}
+			}
 
-		/*--------------------------------------------------------------------
-		c          ...loop over the jth row of a
-		c-------------------------------------------------------------------*/
-		for (k = jajp1; k < rowstr[j+1]; k++) {
-			i = colidx[k];
-			x[i] = x[i] + a[k];
-			if ( mark[i] == FALSE && x[i] != 0.0) {
-				mark[i] = TRUE;
-				nzrow = nzrow + 1;
-				nzloc[nzrow] = i;
+			/*--------------------------------------------------------------------
+			c          ... extract the nonzeros of this row
+			c-------------------------------------------------------------------*/
+			for (int k = 1; k <= nzr; k++) {
+				int i = nzloc[k];
+				double xi = x[i];
+				mark[i] = FALSE;
+				x[i] = 0.0;
+				if (xi != 0.0) {
+					nza = nza + 1;
+					a[nza] = xi;
+					colidx[nza] = i;
+				}
 			}
+			nzrow[j+1] = nza - rowstr[j] + 1;
 		}
+		delete[] x;
+		delete[] mark;
+		delete[] nzloc;
+	});
 
-		/*--------------------------------------------------------------------
-		c          ... extract the nonzeros of this row
-		c-------------------------------------------------------------------*/
-		for (k = 1; k <= nzrow; k++) {
-			i = nzloc[k];
-			mark[i] = FALSE;
-			xi = x[i];
-			x[i] = 0.0;
-			if (xi != 0.0) {
-				nza = nza + 1;
-				a[nza] = xi;
-				colidx[nza] = i;
-			}
+	/*--------------------------------------------------------------------
+	c       ... compact the merged rows through acol and aelt
+	c-------------------------------------------------------------------*/
+	nzrow[1] = 1;
+	prefix_sum(nzrow, nzrow, 2, nrows+2, 1);
+
+	pf->parallel_for(1, nrows+1, 1, [&](int j){
+		for (int m = 0; m < nzrow[j+1] - nzrow[j]; m++) {
+			acol[nzrow[j]+m] = colidx[rowstr[j]+m];
+			aelt[nzrow[j]+m] = a[rowstr[j]+m];
 		}
-		jajp1 = rowstr[j+1];
-		rowstr[j+1] = nza + rowstr[1];
+	});
+
+	pf->parallel_for(1, nzrow[nrows+1], 1, [&](int k){
+		colidx[k] = acol[k];
+		a[k] = aelt[k];
+	});
+
+	pf->parallel_for(1, nrows+2, 1, [&](int j){
+		rowstr[j] = nzrow[j];
+	});
+
+	delete[] nzrow;
+}
+
+/*---------------------------------------------------------------------
+c       dst[i] = base + src[lo] + ... + src[i] for lo <= i < hi, in two
+c       passes over num_workers blocks: each block sums its entries,
+c       the block sums are scanned, and each block then scans its
+c       entries from the sum of the blocks before it.  src and dst may
+c       be the same array
+c---------------------------------------------------------------------*/
+static void prefix_sum(const int src[], int dst[], int lo, int hi, int base)
+{
+	int b;
+	int nblocks = max(1, min(num_workers, hi-lo));
+	int bsize = (hi - lo + nblocks - 1) / nblocks;
+	int *bsum = new int[nblocks+1];	/* bsum[b]: base plus the sum of the blocks before b */
+
+	pf->parallel_for(0, nblocks, 1, [&](int b){
+		int sum = 0;
+		for (int i = lo + b*bsize; i < min(lo + (b+1)*bsize, hi); i++) {
+			sum += src[i];
+		}
+		bsum[b+1] = sum;
+	});
+
+	bsum[0] = base;
+	for (b = 1; b <= nblocks; b++) {
+		bsum[b] += bsum[b-1];
 	}
+
+	pf->parallel_for(0, nblocks, 1, [&](int b){
+		int sum = bsum[b];
+		for (int i = lo + b*bsize; i < min(lo + (b+1)*bsize, hi); i++) {
+			sum += src[i];
+			dst[i] = sum;
+		}
+	});
+
+	delete[] bsum;
 }
 
 /*---------------------------------------------------------------------
@@ -18,6 +18,8 @@
 #include "npbparams.hpp"
 #include <cstdlib>
 #include <cstdio>
+#include <cstdint>
+#include <atomic>
 
 /*****************************************************************/
 /* For serial IS, buckets are not really req'd to solve NPB1 IS  */
@@ -116,6 +118,7 @@
 
 #define  MAX_ITERATIONS      10
 #define  TEST_ARRAY_SIZE     5
+#define  VERIFY_BLOCK        (1 << 16)
 
 
 /*************************************/
@@ -152,6 +155,13 @@ INT_TYPE key_array[SIZE_OF_BUFFERS],
 #ifdef USE_BUCKETS
 INT_TYPE **bucket_size, ** bucket_ptrs2,
          bucket_ptrs[NUM_BUCKETS];
+
+/*  Write-combining buffers of the scatter: each worker keeps one     */
+/*  cache line of keys per bucket and writes key_buff2 a line at a    */
+/*  time; wc_start holds where the worker starts inside each bucket   */
+#define  WC_LINE_BYTES       64
+#define  WC_KEYS             (WC_LINE_BYTES/(int)sizeof(INT_TYPE))
+INT_TYPE **wc_buff, **wc_start;
 #endif
 
 int num_workers;
@@ -455,6 +465,16 @@ void alloc_key_buff( void )
         key_buff2[i] = 0;
     }
 
+    wc_buff = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+    wc_start = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+    for (i = 0; i < num_procs; i++) {
+        if (posix_memalign((void **)&wc_buff[i], WC_LINE_BYTES, sizeof(INT_TYPE) * NUM_BUCKETS * WC_KEYS) != 0) {
+            perror("Memory allocation error");
+            exit(1);
+        }
+        wc_start[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * NUM_BUCKETS);
+    }
+
 #else /*USE_BUCKETS*/
 
     key_buff1_aptr = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
@@ -476,9 +496,6 @@ void alloc_key_buff( void )
 
 void full_verify( void )
 {
-    INT_TYPE   i, j;
-    INT_TYPE   k, k1;
-
 
     /*  Now, finally, sort the keys:  */
 
@@ -497,44 +514,71 @@ void full_verify( void )
 
 #else
 
-    for(int myid=0; myid<num_workers; myid++){
-        for( i=0; i<NUM_KEYS; i++ )
-            key_buff2[i] = key_array[i];
+    INT_TYPE mq = (NUM_KEYS + num_workers - 1) / num_workers;
 
-        /* This is actual sorting. Each thread is responsible for a subset of key values */
-        j = (MAX_KEY + j - 1) / j;
-        k1 = j*myid;
-        INT_TYPE k2 = k1 + j;
+    pf->parallel_for(0, NUM_KEYS, 1, [&](INT_TYPE i) {
+        key_buff2[i] = key_array[i];
+    });
 
-        if (k2 > MAX_KEY) k2 = MAX_KEY;
+    /* This is actual sorting.  Worker myid scatters the keys of its
+    chunk of rank(), from its own end of each key: the population of
+    the chunks above 0 is counted again in key_buff1_aptr, and walking
+    the chunks down from the end of each key gives the end of each    */
+    pf->parallel_for(1,num_workers,1,1,[&](int myid){
+        INT_TYPE *work_buff = key_buff1_aptr[myid];
+        INT_TYPE k1 = mq * myid;
+        INT_TYPE k2 = (k1 + mq < NUM_KEYS) ? k1 + mq : NUM_KEYS;
+
+        for(INT_TYPE i=0; i<MAX_KEY; i++ )
+            work_buff[i] = 0;
+        for(INT_TYPE i=k1; i<k2; i++ )
+            work_buff[key_buff2[i]]++;
+    });
 
-        for( i=0; i<NUM_KEYS; i++ ) {
-            if (key_buff2[i] >= k1 && key_buff2[i] < k2) {
-                k = --key_buff_ptr_global[key_buff2[i]];
-                key_array[k] = key_buff2[i];
-            }
+    pf->parallel_for(0, MAX_KEY, 1, [&](INT_TYPE i) {
+        INT_TYPE end = key_buff_ptr_global[i];
+        for(int k=num_workers-1; k>0; k-- ) {
+            INT_TYPE c = key_buff1_aptr[k][i];
+            key_buff1_aptr[k][i] = end;
+            end -= c;
         }
-    }
+        key_buff_ptr_global[i] = end;
+    });
 
-#endif
+    pf->parallel_for(0,num_workers,1,1,[&](int myid){
+        INT_TYPE *ptrs = (myid > 0)? key_buff1_aptr[myid] : key_buff_ptr_global;
+        INT_TYPE k1 = mq * myid;
+        INT_TYPE k2 = (k1 + mq < NUM_KEYS) ? k1 + mq : NUM_KEYS;
 
+        for(INT_TYPE i=k1; i<k2; i++ ) {
+            INT_TYPE k = --ptrs[key_buff2[i]];
+            key_array[k] = key_buff2[i];
+        }
+    });
 
-    /*  Confirm keys correctly sorted: count incorrectly sorted keys, if any */
+#endif
 
-    j = 0;
-    INT_TYPE * j_temp = new INT_TYPE[num_workers];
-    for(int i=0; i<num_workers; i++) j_temp[i] = 0;
 
-    pf->parallel_for_thid(1, NUM_KEYS, 1, (int)(NUM_KEYS/num_workers)+1, [&](INT_TYPE i, int id_worker) {
-        if( key_array[i-1] > key_array[i] )
-            j_temp[id_worker]++;
-    });
+    /*  Confirm keys correctly sorted: the blocks of VERIFY_BLOCK keys are
+    checked in parallel, and all stop once one finds a key out of sort */
+    std::atomic<INT_TYPE> first_out(NUM_KEYS);
 
-    for(int i=0; i<num_workers; i++) j += j_temp[i];
+    pf->parallel_for(0, (NUM_KEYS + VERIFY_BLOCK - 1) / VERIFY_BLOCK, 1, 1, [&](INT_TYPE b) {
+        INT_TYPE k1 = (b > 0)? b*VERIFY_BLOCK : 1;
+        INT_TYPE k2 = (b*VERIFY_BLOCK + VERIFY_BLOCK < NUM_KEYS) ? b*VERIFY_BLOCK + VERIFY_BLOCK : NUM_KEYS;
 
+        if (first_out.load(std::memory_order_relaxed) < NUM_KEYS) return;
+        for(INT_TYPE i=k1; i<k2; i++ ) {
+            if( key_array[i-1] > key_array[i] ) {
+                INT_TYPE seen = first_out.load();
+                while (i < seen && !first_out.compare_exchange_weak(seen, i));
+                return;
+            }
+        }
+    });
 
-    if( j != 0 )
-        printf( "Full_verify: number of keys out of sort: %ld\n", (long)j );
+    if( first_out < NUM_KEYS )
+        printf( "Full_verify: keys out of sort, first found at %ld\n", (long)first_out.load() );
     else
         passed_verification++;
 
@@ -557,6 +601,8 @@ void rank( int iteration )
 #ifdef USE_BUCKETS
     int shift = MAX_KEY_LOG_2 - NUM_BUCKETS_LOG_2;
     INT_TYPE num_bucket_keys = (1L << shift);
+    /*  slot of key_buff2[0] in its cache line */
+    INT_TYPE wc_base = ((uintptr_t)key_buff2 / sizeof(INT_TYPE)) & (WC_KEYS-1);
 #endif
 
     key_array[iteration] = iteration;
@@ -576,20 +622,26 @@ void rank( int iteration )
 #endif
     key_buff_ptr = key_buff1;
 
+    INT_TYPE mq = (NUM_KEYS + num_workers - 1) / num_workers;
+
     /*  Bucket sort is known to improve cache performance on some   */
     /*  cache based systems.  But the actual performance may depend */
     /*  on cache size, problem size. */
 #ifdef USE_BUCKETS
 
-    pf->parallel_for(0,num_workers,1,[&](int myid){
+    /*  Determine the number of keys in each bucket: worker myid counts
+    the contiguous chunk of keys myid*mq .. (myid+1)*mq-1               */
+    pf->parallel_for(0,num_workers,1,1,[&](int myid){
+        INT_TYPE *work_buff = bucket_size[myid];
+        INT_TYPE k1 = mq * myid;
+        INT_TYPE k2 = (k1 + mq < NUM_KEYS) ? k1 + mq : NUM_KEYS;
+
         /*  Initialize */
         for(INT_TYPE i=0; i<NUM_BUCKETS; i++ )
-            bucket_size[myid][i] = 0;
-    });
+            work_buff[i] = 0;
 
-    /*  Determine the number of keys in each bucket */
-    pf->parallel_for_thid(0, NUM_KEYS, 1, (int)(NUM_KEYS/num_workers)+1, [&](int i, int id) {
-        bucket_size[id][key_array[i] >> shift]++;
+        for(INT_TYPE i=k1; i<k2; i++ )
+            work_buff[key_array[i] >> shift]++;
     });
 
     /*  Accumulative bucket sizes are the bucket pointers.
@@ -608,10 +660,50 @@ void rank( int iteration )
         }
     });
 
-    /*  Sort into appropriate bucket */
-    pf->parallel_for_thid(0, NUM_KEYS, 1, (int)(NUM_KEYS/num_workers)+1, [&](int i, int id) {
-        INT_TYPE k = key_array[i];
-        key_buff2[bucket_ptrs2[id][k >> shift]++] = k;
+    /*  Sort into appropriate bucket.  The keys of a bucket are gathered
+    in the worker's line of wc_buff at the slot they have in their cache
+    line of key_buff2, and a line is written out once its last slot is
+    filled.  The first and the last line of the worker's part of a
+    bucket are shared with other buckets or workers, so only the
+    worker's own slots of those lines are written                     */
+    pf->parallel_for(0,num_workers,1,1,[&](int myid){
+        INT_TYPE *ptrs = bucket_ptrs2[myid];
+        INT_TYPE *start = wc_start[myid];
+        INT_TYPE *buff = wc_buff[myid];
+        INT_TYPE k1 = mq * myid;
+        INT_TYPE k2 = (k1 + mq < NUM_KEYS) ? k1 + mq : NUM_KEYS;
+
+        for(INT_TYPE i=0; i< NUM_BUCKETS; i++ )
+            start[i] = ptrs[i];
+
+        for(INT_TYPE i=k1; i<k2; i++ ) {
+            INT_TYPE k = key_array[i];
+            INT_TYPE b = k >> shift;
+            INT_TYPE p = ptrs[b]++;
+            INT_TYPE slot = (p + wc_base) & (WC_KEYS-1);
+            INT_TYPE *line = &buff[b*WC_KEYS];
+            line[slot] = k;
+            if (slot == WC_KEYS-1) {
+                INT_TYPE first = p - slot;
+                if (first >= start[b]) {
+                    for(int m=0; m<WC_KEYS; m++)
+                        key_buff2[first+m] = line[m];
+                } else {
+                    for(INT_TYPE m=start[b]; m<=p; m++)
+                        key_buff2[m] = line[m-first];
+                }
+            }
+        }
+
+        /*  Write out the lines that are not full */
+        for(INT_TYPE b=0; b< NUM_BUCKETS; b++ ) {
+            INT_TYPE slot = (ptrs[b] + wc_base) & (WC_KEYS-1);
+            INT_TYPE first = ptrs[b] - slot;
+            if (slot == 0 || ptrs[b] == start[b]) continue;
+            if (first < start[b]) first = start[b];
+            for(INT_TYPE m=first; m<ptrs[b]; m++)
+                key_buff2[m] = buff[b*WC_KEYS + ((m + wc_base) & (WC_KEYS-1))];
+        }
     });
 
     /*  The bucket pointers now point to the final accumulated sizes */
@@ -654,19 +746,23 @@ void rank( int iteration )
 
 #else /*USE_BUCKETS*/
 
-    for(int myid=0; myid<num_workers; myid++){
-      /*  Clear the work array */
-      for( i=0; i<MAX_KEY; i++ )
-          key_buff1_aptr[myid][i] = 0;
-    }
-
     /*  Ranking of all keys occurs in this section:                 */
 
     /*  In this section, the keys themselves are used as their
     own indexes to determine how many of each there are: their
-    individual population                                       */
-    pf->parallel_for_thid(0, NUM_KEYS, 1, (int)(NUM_KEYS/num_workers)+1, [&](INT_TYPE i, int myid) {
-        key_buff1_aptr[myid][key_buff_ptr2[i]]++;  /* Now they have individual key   */
+    individual population.  Worker myid counts the contiguous
+    chunk of keys myid*mq .. (myid+1)*mq-1                       */
+    pf->parallel_for(0,num_workers,1,1,[&](int myid){
+        INT_TYPE *work_buff = key_buff1_aptr[myid];
+        INT_TYPE k1 = mq * myid;
+        INT_TYPE k2 = (k1 + mq < NUM_KEYS) ? k1 + mq : NUM_KEYS;
+
+        /*  Clear the work array */
+        for(INT_TYPE i=0; i<MAX_KEY; i++ )
+            work_buff[i] = 0;
+
+        for(INT_TYPE i=k1; i<k2; i++ )
+            work_buff[key_buff_ptr2[i]]++;  /* Now they have individual key   */
         /* population                     */
     });
 
@@ -24,27 +24,43 @@
 /* parameters */
 #define T_BENCH 1
 #define T_INIT  2
+/* T_LEVEL+k times level k of mg3P */
+#define T_LEVEL 3
+
+/* default tile height of resid_psinv */
+#define	FUSE_ROWS	16
 
 /* global variables */
 /* common /grid/ */
 static int is1, is2, is3, ie1, ie2, ie3;
+/* resid and psinv fused in tiles of fuse_rows rows, from MG_FUSE */
+static int mg_fuse = 0, fuse_rows = FUSE_ROWS;
+/* periodic borders written by the stencils, from MG_FOLD */
+static int mg_fold = 0;
+/* grid points per thread of a level, from MG_CUTOFF */
+static long mg_cutoff = 0;
+static boolean timer_on;
 
 /* functions prototypes */
 static void setup(int *n1, int *n2, int *n3, int lt);
-static void mg3P(double ****u, double ***v, double ****r, double a[4], double c[4], int n1, int n2, int n3, int k);
-static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4], int k);
-static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3, double a[4], int k );
-static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j, int m2j, int m3j, int k );
-static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1, int n2, int n3, int k );
-static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz);
-static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk);
-static void comm3(double ***u, int n1, int n2, int n3, int kk);
-static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k);
-static void showall(double ***z, int n1, int n2, int n3);
+static grid3 alloc_grid(int n1, int n2, int n3);
+static void mg3P(grid3 *u, grid3 v, grid3 *r, double a[4], double c[4], int n1, int n2, int n3, int k);
+static void psinv( grid3 r, grid3 u, int n1, int n2, int n3, double c[4], int k);
+static void resid( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], int k );
+static void resid_psinv( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], double c[4], int k );
+static void rprj3( grid3 r, int m1k, int m2k, int m3k, grid3 s, int m1j, int m2j, int m3j, int k );
+static void interp( grid3 z, int mm1, int mm2, int mm3, grid3 u, int n1, int n2, int n3, int k );
+static void norm2u3(grid3 r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz);
+static void rep_nrm(grid3 u, int n1, int n2, int n3, char *title, int kk);
+static void comm3(grid3 u, int n1, int n2, int n3, int kk);
+static void comm3_plane(grid3 u, int n1, int n2, int n3, int i3);
+static void zran3(grid3 z, int n1, int n2, int n3, int nx, int ny, int k);
+static void showall(grid3 z, int n1, int n2, int n3);
 static double power( double a, int n );
 static void bubble( double ten[M][2], int j1[M][2], int j2[M][2], int j3[M][2], int m, int ind );
-static void zero3(double ***z, int n1, int n2, int n3);
-/*static void nonzero(double ***z, int n1, int n2, int n3);*/
+static void zero3(grid3 z, int n1, int n2, int n3);
+static int level_threads(long points);
+/*static void nonzero(grid3 z, int n1, int n2, int n3);*/
 
 ff::ParallelFor * pf;
 int num_workers;
@@ -61,7 +77,7 @@ int main(int argc, char *argv[]) {
     c and is NOT global. it is the current iteration
     c------------------------------------------------------------------------*/
 
-    int k, it;
+    int it;
     double t, tinit, mflops;
 
     /*-------------------------------------------------------------------------
@@ -70,7 +86,7 @@ int main(int argc, char *argv[]) {
     c are always passed as subroutine args. 
     c------------------------------------------------------------------------*/
     
-    double ****u, ***v, ****r;
+    grid3 *u, v, *r;
     double a[4], c[4];
 
     double rnm2, rnmu;
@@ -79,7 +95,7 @@ int main(int argc, char *argv[]) {
     double verify_value;
     boolean verified;
 
-    int i, j, l;
+    int i, l;
     FILE *fp;
 
     timer_clear(T_BENCH);
@@ -197,33 +213,38 @@ int main(int argc, char *argv[]) {
 
     setup(&n1,&n2,&n3,lt);
       
-    u = (double ****)malloc((lt+1)*sizeof(double ***));
-    for (l = lt; l >=1; l--) {
-        u[l] = (double ***)malloc(m3[l]*sizeof(double **));
-        for (k = 0; k < m3[l]; k++) {
-            u[l][k] = (double **)malloc(m2[l]*sizeof(double *));
-            for (j = 0; j < m2[l]; j++) {
-              u[l][k][j] = (double *)malloc(m1[l]*sizeof(double));
-            }
-        }
+    if (const char *pad = std::getenv("MG_PAD")) {
+        grid_pad = max(0, atoi(pad));
+        printf(" Row padding: %3d doubles\n", grid_pad);
     }
-    v = (double ***)malloc(m3[lt]*sizeof(double **));
-    for (k = 0; k < m3[lt]; k++) {
-        v[k] = (double **)malloc(m2[lt]*sizeof(double *));
-        for (j = 0; j < m2[lt]; j++) {
-           v[k][j] = (double *)malloc(m1[lt]*sizeof(double));
-        }
+
+    if (const char *fuse = std::getenv("MG_FUSE")) {
+        mg_fuse = atoi(fuse);
     }
-    r = (double ****)malloc((lt+1)*sizeof(double ***));
-    for (l = lt; l >=1; l--) {
-        r[l] = (double ***)malloc(m3[l]*sizeof(double **));
-        for (k = 0; k < m3[l]; k++) {
-            r[l][k] = (double **)malloc(m2[l]*sizeof(double *));
-            for (j = 0; j < m2[l]; j++) {
-                r[l][k][j] = (double *)malloc(m1[l]*sizeof(double));
-            }
-        }
+    if (const char *rows = std::getenv("MG_FUSE_ROWS")) {
+        fuse_rows = max(1, atoi(rows));
+    }
+    if (const char *fold = std::getenv("MG_FOLD")) {
+        mg_fold = atoi(fold);
+    }
+    if (const char *cutoff = std::getenv("MG_CUTOFF")) {
+        mg_cutoff = max(0L, atol(cutoff));
+        printf(" Grid points per thread: %ld\n", mg_cutoff);
+    }
+    if (mg_fuse) {
+        printf(" Fused resid and psinv in tiles of %d rows\n", fuse_rows);
     }
+    if (mg_fold) {
+        printf(" Periodic borders written by the stencils\n");
+    }
+
+    u = (grid3 *)malloc((lt+1)*sizeof(grid3));
+    r = (grid3 *)malloc((lt+1)*sizeof(grid3));
+    for (l = lt; l >= 1; l--) {
+        u[l] = alloc_grid(m1[l], m2[l], m3[l]);
+        r[l] = alloc_grid(m1[l], m2[l], m3[l]);
+    }
+    v = alloc_grid(m1[lt], m2[lt], m3[lt]);
 
     zero3(u[lt],n1,n2,n3);
     zran3(v,n1,n2,n3,nx[lt],ny[lt],lt);
@@ -255,6 +276,15 @@ int main(int argc, char *argv[]) {
 
     timer_stop(T_INIT);
 
+    timer_on = FALSE;
+    if ((fp = fopen("timer.flag", "r")) != NULL) {
+        fclose(fp);
+        timer_on = TRUE;
+    }
+    for (l = lt; l >= lb; l--) {
+        timer_clear(T_LEVEL+l);
+    }
+
     timer_start(T_BENCH);
 
     resid(u[lt],v,r[lt],n1,n2,n3,a,lt);
@@ -318,6 +348,19 @@ int main(int argc, char *argv[]) {
 
     c_print_results((char*)"MG", class_npb, nx[lt], ny[lt], nz[lt], nit, t, mflops, (char*)"          floating point", 
             verified, (char*)NPBVERSION, (char*)COMPILETIME, (char*)CS1, (char*)CS2, (char*)CS3, (char*)CS4, (char*)CS5, (char*)CS6, (char*)CS7);
+
+    /*--------------------------------------------------------------------
+    c     time of each level of mg3P, with the threads it ran on
+    c-------------------------------------------------------------------*/
+    if (timer_on) {
+        printf("\nAdditional timers -\n");
+        printf(" Level  Grid           Threads       Time\n");
+        for (l = lt; l >= lb; l--) {
+            double tl = timer_read(T_LEVEL+l);
+            printf(" %5d  %4dx%4dx%4d  %7d  %9.4f (%5.2f%%)\n", l, nx[l], ny[l], nz[l],
+                   level_threads((long)m1[l]*m2[l]*m3[l]), tl, t != 0.0 ? tl*100.0/t : 0.0);
+        }
+    }
     return 0;
 }
 
@@ -361,10 +404,31 @@ static void setup(int *n1, int *n2, int *n3, int lt) {
     }
 }
 
+/*--------------------------------------------------------------------
+c     alloc_grid allocates an n3 x n2 x n1 grid as one block aligned to
+c     GRID_ALIGN bytes.  Rows are rounded up to whole cache lines, so
+c     that each of them starts on one, and then padded with grid_pad
+c     more doubles
+c-------------------------------------------------------------------*/
+
+static grid3 alloc_grid(int n1, int n2, int n3) {
+
+    grid3 z;
+    long line = GRID_ALIGN/sizeof(double);
+
+    z.ld1 = (n1 + line - 1)/line*line + grid_pad;
+    z.ld2 = z.ld1*n2;
+    if (posix_memalign((void **)&z.base, GRID_ALIGN, sizeof(double)*z.ld2*n3) != 0) {
+        perror("Memory allocation error");
+        exit(1);
+    }
+    return z;
+}
+
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void mg3P(double ****u, double ***v, double ****r, double a[4],
+static void mg3P(grid3 *u, grid3 v, grid3 *r, double a[4],
          double c[4], int n1, int n2, int n3, int k) {
 
     /*--------------------------------------------------------------------
@@ -381,21 +445,30 @@ static void mg3P(double ****u, double ***v, double ****r, double a[4],
     c     restrict the residual from the find grid to the coarse
     c-------------------------------------------------------------------*/
 
+    /*--------------------------------------------------------------------
+    c     the time of each step goes to the level of the grid it writes
+    c-------------------------------------------------------------------*/
+
     for (k = lt; k >= lb+1; k--) {
         j = k-1;
+        if (timer_on) timer_start(T_LEVEL+j);
         rprj3(r[k], m1[k], m2[k], m3[k],
           r[j], m1[j], m2[j], m3[j], k);
+        if (timer_on) timer_stop(T_LEVEL+j);
     }
 
     k = lb;
     /*--------------------------------------------------------------------
     c     compute an approximate solution on the coarsest grid
     c-------------------------------------------------------------------*/
+    if (timer_on) timer_start(T_LEVEL+k);
     zero3(u[k], m1[k], m2[k], m3[k]);
     psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+    if (timer_on) timer_stop(T_LEVEL+k);
 
     for (k = lb+1; k <= lt-1; k++) {
         j = k-1;
+        if (timer_on) timer_start(T_LEVEL+k);
         /*--------------------------------------------------------------------
         c        prolongate from level k-1  to k
         c-------------------------------------------------------------------*/
@@ -405,24 +478,126 @@ static void mg3P(double ****u, double ***v, double ****r, double a[4],
         /*--------------------------------------------------------------------
         c        compute residual for level k
         c-------------------------------------------------------------------*/
-        resid(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, k);
-        /*--------------------------------------------------------------------
-        c        apply smoother
-        c-------------------------------------------------------------------*/
-        psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+        if (mg_fuse) {
+            resid_psinv(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, c, k);
+        } else {
+            resid(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, k);
+            /*--------------------------------------------------------------------
+            c        apply smoother
+            c-------------------------------------------------------------------*/
+            psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+        }
+        if (timer_on) timer_stop(T_LEVEL+k);
     }
 
     j = lt - 1;
     k = lt;
+    if (timer_on) timer_start(T_LEVEL+k);
     interp(u[j], m1[j], m2[j], m3[j], u[lt], n1, n2, n3, k);
-    resid(u[lt], v, r[lt], n1, n2, n3, a, k);
-    psinv(r[lt], u[lt], n1, n2, n3, c, k);
+    if (mg_fuse) {
+        resid_psinv(u[lt], v, r[lt], n1, n2, n3, a, c, k);
+    } else {
+        resid(u[lt], v, r[lt], n1, n2, n3, a, k);
+        psinv(r[lt], u[lt], n1, n2, n3, c, k);
+    }
+    if (timer_on) timer_stop(T_LEVEL+k);
 }
 
 /*--------------------------------------------------------------------
+c     level_threads gives the threads of a grid of points points: one
+c     per mg_cutoff points, at least one and at most num_workers (all
+c     of them when mg_cutoff is 0)
 c-------------------------------------------------------------------*/
 
-static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4], int k) {
+static int level_threads(long points) {
+
+    if (mg_cutoff == 0) {
+        return num_workers;
+    }
+    return (int)max(1L, min((long)num_workers, points/mg_cutoff));
+}
+
+/*--------------------------------------------------------------------
+c     level_for runs body on the planes [first, last) of a grid of
+c     points points.  With mg_cutoff set, the planes are cut in one
+c     chunk per thread of level_threads, given to that many workers,
+c     and a level under mg_cutoff points runs here, without the farm
+c-------------------------------------------------------------------*/
+
+template <typename Body>
+static void level_for(long first, long last, long points, const Body &body) {
+
+    if (mg_cutoff == 0) {
+        pf->parallel_for(first, last, 1, body);
+        return;
+    }
+    int t = (int)min((long)level_threads(points), last-first);
+    if (t <= 1) {
+        for (long i = first; i < last; i++) {
+            body(i);
+        }
+        return;
+    }
+    pf->parallel_for(first, last, 1, (last-first+t-1)/t, body, t);
+}
+
+/*--------------------------------------------------------------------
+c     psinv_row and resid_row apply psinv and resid to row (i3,i2);
+c     r1/r2 and u1/u2 are the caller's scratch rows
+c-------------------------------------------------------------------*/
+
+static inline void psinv_row( grid3 r, grid3 u, int n1, int i3, int i2, double c[4], double r1[], double r2[] ) {
+
+    int i1;
+
+    for (i1 = 0; i1 < n1; i1++) {
+        r1[i1] = r(i3,i2-1,i1) + r(i3,i2+1,i1)
+            + r(i3-1,i2,i1) + r(i3+1,i2,i1);
+        r2[i1] = r(i3-1,i2-1,i1) + r(i3-1,i2+1,i1)
+            + r(i3+1,i2-1,i1) + r(i3+1,i2+1,i1);
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+        u(i3,i2,i1) = u(i3,i2,i1)
+            + c[0] * r(i3,i2,i1)
+            + c[1] * ( r(i3,i2,i1-1) + r(i3,i2,i1+1)
+                   + r1[i1] )
+            + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+        /*--------------------------------------------------------------------
+        c  Assume c(3) = 0    (Enable line below if c(3) not= 0)
+        c---------------------------------------------------------------------
+        c    >                     + c(3) * ( r2(i1-1) + r2(i1+1) )
+        c-------------------------------------------------------------------*/
+    }
+}
+
+static inline void resid_row( grid3 u, grid3 v, grid3 r, int n1, int i3, int i2, double a[4], double u1[], double u2[] ) {
+
+    int i1;
+
+    for (i1 = 0; i1 < n1; i1++) {
+        u1[i1] = u(i3,i2-1,i1) + u(i3,i2+1,i1)
+               + u(i3-1,i2,i1) + u(i3+1,i2,i1);
+        u2[i1] = u(i3-1,i2-1,i1) + u(i3-1,i2+1,i1)
+               + u(i3+1,i2-1,i1) + u(i3+1,i2+1,i1);
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+        r(i3,i2,i1) = v(i3,i2,i1)
+            - a[0] * u(i3,i2,i1)
+        /*--------------------------------------------------------------------
+        c  Assume a(1) = 0      (Enable 2 lines below if a(1) not= 0)
+        c---------------------------------------------------------------------
+        c    >                     - a(1) * ( u(i1-1,i2,i3) + u(i1+1,i2,i3)
+        c    >                              + u1(i1) )
+        c-------------------------------------------------------------------*/
+            - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+            - a[3] * ( u2[i1-1] + u2[i1+1] );
+    }
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void psinv( grid3 r, grid3 u, int n1, int n2, int n3, double c[4], int k) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -439,34 +614,18 @@ static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4]
     c     based machines.  
     c-------------------------------------------------------------------*/
 
-    pf->parallel_for(1, n3-1, 1,[&](int i3){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](int i3){
         double r1[M], r2[M];
         for (int i2 = 1; i2 < n2-1; i2++) {
-                for (int i1 = 0; i1 < n1; i1++) {
-            r1[i1] = r[i3][i2-1][i1] + r[i3][i2+1][i1]
-                + r[i3-1][i2][i1] + r[i3+1][i2][i1];
-            r2[i1] = r[i3-1][i2-1][i1] + r[i3-1][i2+1][i1]
-                + r[i3+1][i2-1][i1] + r[i3+1][i2+1][i1];
-            }
-                for (int i1 = 1; i1 < n1-1; i1++) {
-            u[i3][i2][i1] = u[i3][i2][i1]
-                + c[0] * r[i3][i2][i1]
-                + c[1] * ( r[i3][i2][i1-1] + r[i3][i2][i1+1]
-                       + r1[i1] )
-                + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
-            /*--------------------------------------------------------------------
-            c  Assume c(3) = 0    (Enable line below if c(3) not= 0)
-            c---------------------------------------------------------------------
-            c    >                     + c(3) * ( r2(i1-1) + r2(i1+1) )
-            c-------------------------------------------------------------------*/
-            }
+            psinv_row(r, u, n1, i3, i2, c, r1, r2);
         }
+        if (mg_fold) comm3_plane(u, n1, n2, n3, i3);
     });
 
     /*--------------------------------------------------------------------
     c     exchange boundary points
     c-------------------------------------------------------------------*/
-    comm3(u,n1,n2,n3,k);
+    if (!mg_fold) comm3(u,n1,n2,n3,k);
 
     if (debug_vec[0] >= 1 ) {
         rep_nrm(u,n1,n2,n3,(char*)"   psinv",k);
@@ -480,7 +639,7 @@ static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4]
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3, double a[4], int k ) {
+static void resid( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -498,35 +657,83 @@ static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3
     c     based machines.  
     c-------------------------------------------------------------------*/
 
-    pf->parallel_for(1, n3-1, 1, [&](int i3){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](int i3){
         double u1[M], u2[M];
         for (int i2 = 1; i2 < n2-1; i2++) {
-            for (int i1 = 0; i1 < n1; i1++) {
-                u1[i1] = u[i3][i2-1][i1] + u[i3][i2+1][i1]
-                       + u[i3-1][i2][i1] + u[i3+1][i2][i1];
-                u2[i1] = u[i3-1][i2-1][i1] + u[i3-1][i2+1][i1]
-                       + u[i3+1][i2-1][i1] + u[i3+1][i2+1][i1];
-                }
-                for (int i1 = 1; i1 < n1-1; i1++) {
-                r[i3][i2][i1] = v[i3][i2][i1]
-                    - a[0] * u[i3][i2][i1]
-                /*--------------------------------------------------------------------
-                c  Assume a(1) = 0      (Enable 2 lines below if a(1) not= 0)
-                c---------------------------------------------------------------------
-                c    >                     - a(1) * ( u(i1-1,i2,i3) + u(i1+1,i2,i3)
-                c    >                              + u1(i1) )
-                c-------------------------------------------------------------------*/
-                - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
-                      - a[3] * ( u2[i1-1] + u2[i1+1] );
-            }
+            resid_row(u, v, r, n1, i3, i2, a, u1, u2);
         }
+        if (mg_fold) comm3_plane(r, n1, n2, n3, i3);
     });
 
     /*--------------------------------------------------------------------
     c     exchange boundary data
     c--------------------------------------------------------------------*/
+    if (!mg_fold) comm3(r,n1,n2,n3,k);
+
+    if (debug_vec[0] >= 1 ) {
+        rep_nrm(r,n1,n2,n3,(char*)"   resid",k);
+    }
+
+    if ( debug_vec[2] >= k ) {
+        showall(r,n1,n2,n3);
+    }
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void resid_psinv( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], double c[4], int k ) {
+
+    /*--------------------------------------------------------------------
+    c-------------------------------------------------------------------*/
+
+    /*--------------------------------------------------------------------
+    c     resid_psinv does resid followed by psinv in one pass.  The rows
+    c     are split in tiles of fuse_rows, and each tile goes down the
+    c     planes computing r; once plane i3 of r is done, plane i3-1 of u
+    c     is no longer read by resid and is smoothed while r is still in
+    c     cache.  The first and last row of a tile (which the neighbouring
+    c     tiles read) and the planes 1 and n3-2 (which need the periodic
+    c     planes of r) are smoothed in a second pass, after comm3(r).
+    c     Every point is computed as by resid and psinv.  The tiles are
+    c     made shorter than fuse_rows when there would be fewer of them
+    c     than threads, down to one row each, so up to n2-2 threads work
+    c     on the first pass; short tiles leave more rows to the second.
+    c-------------------------------------------------------------------*/
+
+    int threads = level_threads((long)n1*n2*n3);
+    int rows = min(fuse_rows, (n2-2 + threads-1)/threads);
+    int ntiles = (n2-2 + rows-1)/rows;
+
+    level_for(0, ntiles, (long)n1*n2*n3, [&](int t){
+        double u1[M], u2[M], r1[M], r2[M];
+        int c0 = 1 + t*rows, c1 = min(c0+rows, n2-1);
+        for (int i3 = 1; i3 < n3-1; i3++) {
+            for (int i2 = c0; i2 < c1; i2++) {
+                resid_row(u, v, r, n1, i3, i2, a, u1, u2);
+                r(i3,i2,n1-1) = r(i3,i2,1);
+                r(i3,i2,0) = r(i3,i2,n1-2);
+            }
+            if (i3 >= 3) {
+                for (int i2 = c0+1; i2 < c1-1; i2++) {
+                    psinv_row(r, u, n1, i3-1, i2, c, r1, r2);
+                }
+            }
+        }
+    });
     comm3(r,n1,n2,n3,k);
 
+    level_for(1, n3-1, (long)n1*n2*n3, [&](int i3){
+        double r1[M], r2[M];
+        for (int i2 = 1; i2 < n2-1; i2++) {
+            if (i3 == 1 || i3 == n3-2 || (i2-1)%rows == 0 || (i2-1)%rows == rows-1 || i2 == n2-2) {
+                psinv_row(r, u, n1, i3, i2, c, r1, r2);
+            }
+        }
+        if (mg_fold) comm3_plane(u, n1, n2, n3, i3);
+    });
+    if (!mg_fold) comm3(u,n1,n2,n3,k);
+
     if (debug_vec[0] >= 1 ) {
         rep_nrm(r,n1,n2,n3,(char*)"   resid",k);
     }
@@ -534,12 +741,20 @@ static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3
     if ( debug_vec[2] >= k ) {
         showall(r,n1,n2,n3);
     }
+
+    if (debug_vec[0] >= 1 ) {
+        rep_nrm(u,n1,n2,n3,(char*)"   psinv",k);
+    }
+
+    if ( debug_vec[3] >= k ) {
+        showall(u,n1,n2,n3);
+    }
 }
 
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j, int m2j, int m3j, int k ) {
+static void rprj3( grid3 r, int m1k, int m2k, int m3k, grid3 s, int m1j, int m2j, int m3j, int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -575,7 +790,7 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
         d3 = 1;
     }
 
-    pf->parallel_for(1, m3j-1, 1, [&](int j3){
+    level_for(1, m3j-1, (long)m1j*m2j*m3j, [&](int j3){
 
         int j2, j1, i3, i2, i1;
 
@@ -590,28 +805,29 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
             for (j1 = 1; j1 < m1j; j1++) {
                 i1 = 2*j1-d1;
             /*C             i1 = 2*j1-1*/
-                x1[i1] = r[i3+1][i2][i1] + r[i3+1][i2+2][i1]
-                    + r[i3][i2+1][i1] + r[i3+2][i2+1][i1];
-                y1[i1] = r[i3][i2][i1] + r[i3+2][i2][i1]
-                    + r[i3][i2+2][i1] + r[i3+2][i2+2][i1];
+                x1[i1] = r(i3+1,i2,i1) + r(i3+1,i2+2,i1)
+                    + r(i3,i2+1,i1) + r(i3+2,i2+1,i1);
+                y1[i1] = r(i3,i2,i1) + r(i3+2,i2,i1)
+                    + r(i3,i2+2,i1) + r(i3+2,i2+2,i1);
             }
 
             for (j1 = 1; j1 < m1j-1; j1++) {
                 i1 = 2*j1-d1;
                 /*C             i1 = 2*j1-1*/
-                y2 = r[i3][i2][i1+1] + r[i3+2][i2][i1+1]
-                    + r[i3][i2+2][i1+1] + r[i3+2][i2+2][i1+1];
-                x2 = r[i3+1][i2][i1+1] + r[i3+1][i2+2][i1+1]
-                    + r[i3][i2+1][i1+1] + r[i3+2][i2+1][i1+1];
-                s[j3][j2][j1] =
-                    0.5 * r[i3+1][i2+1][i1+1]
-                    + 0.25 * ( r[i3+1][i2+1][i1] + r[i3+1][i2+1][i1+2] + x2)
+                y2 = r(i3,i2,i1+1) + r(i3+2,i2,i1+1)
+                    + r(i3,i2+2,i1+1) + r(i3+2,i2+2,i1+1);
+                x2 = r(i3+1,i2,i1+1) + r(i3+1,i2+2,i1+1)
+                    + r(i3,i2+1,i1+1) + r(i3+2,i2+1,i1+1);
+                s(j3,j2,j1) =
+                    0.5 * r(i3+1,i2+1,i1+1)
+                    + 0.25 * ( r(i3+1,i2+1,i1) + r(i3+1,i2+1,i1+2) + x2)
                     + 0.125 * ( x1[i1] + x1[i1+2] + y2)
                     + 0.0625 * ( y1[i1] + y1[i1+2] );
             }
         }
+        if (mg_fold) comm3_plane(s, m1j, m2j, m3j, j3);
     });
-    comm3(s,m1j,m2j,m3j,k-1);
+    if (!mg_fold) comm3(s,m1j,m2j,m3j,k-1);
 
     if (debug_vec[0] >= 1 ) {
         rep_nrm(s,m1j,m2j,m3j,(char*)"   rprj3",k-1);
@@ -625,7 +841,7 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1, int n2, int n3, int k ) {
+static void interp( grid3 z, int mm1, int mm2, int mm3, grid3 u, int n1, int n2, int n3, int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -652,36 +868,36 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
     double z1[M], z2[M], z3[M];
 
     if ( n1 != 3 && n2 != 3 && n3 != 3 ) {
-        pf->parallel_for(0, mm3-1, 1, [&](int i3){
+        level_for(0, mm3-1, (long)n1*n2*n3, [&](int i3){
             double z1[M], z2[M], z3[M];
             for (int i2 = 0; i2 < mm2-1; i2++) {
                 for (int i1 = 0; i1 < mm1; i1++) {
-                    z1[i1] = z[i3][i2+1][i1] + z[i3][i2][i1];
-                    z2[i1] = z[i3+1][i2][i1] + z[i3][i2][i1];
-                    z3[i1] = z[i3+1][i2+1][i1] + z[i3+1][i2][i1] + z1[i1];
+                    z1[i1] = z(i3,i2+1,i1) + z(i3,i2,i1);
+                    z2[i1] = z(i3+1,i2,i1) + z(i3,i2,i1);
+                    z3[i1] = z(i3+1,i2+1,i1) + z(i3+1,i2,i1) + z1[i1];
                 }
                 for (int i1 = 0; i1 < mm1-1; i1++) {
-                    u[2*i3][2*i2][2*i1] = u[2*i3][2*i2][2*i1]
-                    +z[i3][i2][i1];
-                    u[2*i3][2*i2][2*i1+1] = u[2*i3][2*i2][2*i1+1]
-                    +0.5*(z[i3][i2][i1+1]+z[i3][i2][i1]);
+                    u(2*i3,2*i2,2*i1) = u(2*i3,2*i2,2*i1)
+                    +z(i3,i2,i1);
+                    u(2*i3,2*i2,2*i1+1) = u(2*i3,2*i2,2*i1+1)
+                    +0.5*(z(i3,i2,i1+1)+z(i3,i2,i1));
                 }
                 for (int i1 = 0; i1 < mm1-1; i1++) {
-                    u[2*i3][2*i2+1][2*i1] = u[2*i3][2*i2+1][2*i1]
+                    u(2*i3,2*i2+1,2*i1) = u(2*i3,2*i2+1,2*i1)
                     +0.5 * z1[i1];
-                    u[2*i3][2*i2+1][2*i1+1] = u[2*i3][2*i2+1][2*i1+1]
+                    u(2*i3,2*i2+1,2*i1+1) = u(2*i3,2*i2+1,2*i1+1)
                     +0.25*( z1[i1] + z1[i1+1] );
                 }
                 for (int i1 = 0; i1 < mm1-1; i1++) {
-                    u[2*i3+1][2*i2][2*i1] = u[2*i3+1][2*i2][2*i1]
+                    u(2*i3+1,2*i2,2*i1) = u(2*i3+1,2*i2,2*i1)
                     +0.5 * z2[i1];
-                    u[2*i3+1][2*i2][2*i1+1] = u[2*i3+1][2*i2][2*i1+1]
+                    u(2*i3+1,2*i2,2*i1+1) = u(2*i3+1,2*i2,2*i1+1)
                     +0.25*( z2[i1] + z2[i1+1] );
                 }
                 for (int i1 = 0; i1 < mm1-1; i1++) {
-                    u[2*i3+1][2*i2+1][2*i1] = u[2*i3+1][2*i2+1][2*i1]
+                    u(2*i3+1,2*i2+1,2*i1) = u(2*i3+1,2*i2+1,2*i1)
                     +0.25* z3[i1];
-                    u[2*i3+1][2*i2+1][2*i1+1] = u[2*i3+1][2*i2+1][2*i1+1]
+                    u(2*i3+1,2*i2+1,2*i1+1) = u(2*i3+1,2*i2+1,2*i1+1)
                     +0.125*( z3[i1] + z3[i1+1] );
                 }
             }
@@ -709,62 +925,62 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
                 t3 = 0;
         }
 
-        pf->parallel_for(d3, mm3, 1, [&](int i3){
+        level_for(d3, mm3, (long)n1*n2*n3, [&](int i3){
             for (int i2 = d2; i2 <= mm2-1; i2++) {
                 for (int i1 = d1; i1 <= mm1-1; i1++) {
-                    u[2*i3-d3-1][2*i2-d2-1][2*i1-d1-1] =
-                    u[2*i3-d3-1][2*i2-d2-1][2*i1-d1-1]
-                    +z[i3-1][i2-1][i1-1];
+                    u(2*i3-d3-1,2*i2-d2-1,2*i1-d1-1) =
+                    u(2*i3-d3-1,2*i2-d2-1,2*i1-d1-1)
+                    +z(i3-1,i2-1,i1-1);
                 }
                 for (int i1 = 1; i1 <= mm1-1; i1++) {
-                    u[2*i3-d3-1][2*i2-d2-1][2*i1-t1-1] =
-                    u[2*i3-d3-1][2*i2-d2-1][2*i1-t1-1]
-                    +0.5*(z[i3-1][i2-1][i1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-d3-1,2*i2-d2-1,2*i1-t1-1) =
+                    u(2*i3-d3-1,2*i2-d2-1,2*i1-t1-1)
+                    +0.5*(z(i3-1,i2-1,i1)+z(i3-1,i2-1,i1-1));
                 }
             }
             for (int i2 = 1; i2 <= mm2-1; i2++) {
                 for (int i1 = d1; i1 <= mm1-1; i1++) {
-                    u[2*i3-d3-1][2*i2-t2-1][2*i1-d1-1] =
-                    u[2*i3-d3-1][2*i2-t2-1][2*i1-d1-1]
-                    +0.5*(z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-d3-1,2*i2-t2-1,2*i1-d1-1) =
+                    u(2*i3-d3-1,2*i2-t2-1,2*i1-d1-1)
+                    +0.5*(z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
                 }
                 for (int i1 = 1; i1 <= mm1-1; i1++) {
-                    u[2*i3-d3-1][2*i2-t2-1][2*i1-t1-1] =
-                    u[2*i3-d3-1][2*i2-t2-1][2*i1-t1-1]
-                    +0.25*(z[i3-1][i2][i1]+z[i3-1][i2-1][i1]
-                           +z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-d3-1,2*i2-t2-1,2*i1-t1-1) =
+                    u(2*i3-d3-1,2*i2-t2-1,2*i1-t1-1)
+                    +0.25*(z(i3-1,i2,i1)+z(i3-1,i2-1,i1)
+                           +z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
                 }
            }
         });
 
-        pf->parallel_for(1, mm3, 1, [&](int i3){
+        level_for(1, mm3, (long)n1*n2*n3, [&](int i3){
             for (int i2 = d2; i2 <= mm2-1; i2++) {
                 for (int i1 = d1; i1 <= mm1-1; i1++) {
-                    u[2*i3-t3-1][2*i2-d2-1][2*i1-d1-1] =
-                    u[2*i3-t3-1][2*i2-d2-1][2*i1-d1-1]
-                    +0.5*(z[i3][i2-1][i1-1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-t3-1,2*i2-d2-1,2*i1-d1-1) =
+                    u(2*i3-t3-1,2*i2-d2-1,2*i1-d1-1)
+                    +0.5*(z(i3,i2-1,i1-1)+z(i3-1,i2-1,i1-1));
                 }
                 for (int i1 = 1; i1 <= mm1-1; i1++) {
-                    u[2*i3-t3-1][2*i2-d2-1][2*i1-t1-1] =
-                    u[2*i3-t3-1][2*i2-d2-1][2*i1-t1-1]
-                    +0.25*(z[i3][i2-1][i1]+z[i3][i2-1][i1-1]
-                           +z[i3-1][i2-1][i1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-t3-1,2*i2-d2-1,2*i1-t1-1) =
+                    u(2*i3-t3-1,2*i2-d2-1,2*i1-t1-1)
+                    +0.25*(z(i3,i2-1,i1)+z(i3,i2-1,i1-1)
+                           +z(i3-1,i2-1,i1)+z(i3-1,i2-1,i1-1));
                 }
             }
             for (int i2 = 1; i2 <= mm2-1; i2++) {
                 for (int i1 = d1; i1 <= mm1-1; i1++) {
-                    u[2*i3-t3-1][2*i2-t2-1][2*i1-d1-1] =
-                    u[2*i3-t3-1][2*i2-t2-1][2*i1-d1-1]
-                    +0.25*(z[i3][i2][i1-1]+z[i3][i2-1][i1-1]
-                           +z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-t3-1,2*i2-t2-1,2*i1-d1-1) =
+                    u(2*i3-t3-1,2*i2-t2-1,2*i1-d1-1)
+                    +0.25*(z(i3,i2,i1-1)+z(i3,i2-1,i1-1)
+                           +z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
                 }
                 for (int i1 = 1; i1 <= mm1-1; i1++) {
-                    u[2*i3-t3-1][2*i2-t2-1][2*i1-t1-1] =
-                    u[2*i3-t3-1][2*i2-t2-1][2*i1-t1-1]
-                    +0.125*(z[i3][i2][i1]+z[i3][i2-1][i1]
-                        +z[i3][i2][i1-1]+z[i3][i2-1][i1-1]
-                        +z[i3-1][i2][i1]+z[i3-1][i2-1][i1]
-                        +z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+                    u(2*i3-t3-1,2*i2-t2-1,2*i1-t1-1) =
+                    u(2*i3-t3-1,2*i2-t2-1,2*i1-t1-1)
+                    +0.125*(z(i3,i2,i1)+z(i3,i2-1,i1)
+                        +z(i3,i2,i1-1)+z(i3,i2-1,i1-1)
+                        +z(i3-1,i2,i1)+z(i3-1,i2-1,i1)
+                        +z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
                 }
             }
         });
@@ -782,7 +998,7 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz) {
+static void norm2u3(grid3 r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -813,8 +1029,8 @@ static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *r
     pf->parallel_for_thid(1, n3-1, 1, (int)((n3-1)/num_workers)+1, [&](int i3, int id){
         for (int i2 = 1; i2 < n2-1; i2++) {
             for (int i1 = 1; i1 < n1-1; i1++) {
-                p_s_ff[id] += r[i3][i2][i1] * r[i3][i2][i1];
-                double tmp = fabs(r[i3][i2][i1]);
+                p_s_ff[id] += r(i3,i2,i1) * r(i3,i2,i1);
+                double tmp = fabs(r(i3,i2,i1));
                 if (tmp > p_a_ff[id]) p_a_ff[id] = tmp;
             }
         }
@@ -836,7 +1052,7 @@ static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *r
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk) {
+static void rep_nrm(grid3 u, int n1, int n2, int n3, char *title, int kk) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -853,7 +1069,7 @@ static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void comm3(double ***u, int n1, int n2, int n3, int kk) {
+static void comm3(grid3 u, int n1, int n2, int n3, int kk) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -864,25 +1080,25 @@ static void comm3(double ***u, int n1, int n2, int n3, int kk) {
 
     int i1, i2, i3;
     /* axis = 1 */
-    pf->parallel_for(1, n3-1, 1, [&](int i3){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](int i3){
         for (int i2 = 1; i2 < n2-1; i2++) {
-            u[i3][i2][n1-1] = u[i3][i2][1];
-            u[i3][i2][0] = u[i3][i2][n1-2];
+            u(i3,i2,n1-1) = u(i3,i2,1);
+            u(i3,i2,0) = u(i3,i2,n1-2);
         }
     });
 
     /* axis = 2 */
-    pf->parallel_for(1, n3-1, 1, [&](int i3){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](int i3){
         for (int i1 = 0; i1 < n1; i1++) {
-            u[i3][n2-1][i1] = u[i3][1][i1];
-            u[i3][0][i1] = u[i3][n2-2][i1];
+            u(i3,n2-1,i1) = u(i3,1,i1);
+            u(i3,0,i1) = u(i3,n2-2,i1);
         }
     });
     /* axis = 3 */
-    pf->parallel_for(0, n2, 1, [&](int i2){
+    level_for(0, n2, (long)n1*n2*n3, [&](int i2){
         for (int i1 = 0; i1 < n1; i1++) {
-            u[n3-1][i2][i1] = u[1][i2][i1];
-            u[0][i2][i1] = u[n3-2][i2][i1];
+            u(n3-1,i2,i1) = u(1,i2,i1);
+            u(0,i2,i1) = u(n3-2,i2,i1);
         }
     });
 }
@@ -890,7 +1106,51 @@ static void comm3(double ***u, int n1, int n2, int n3, int kk) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
+static void comm3_plane(grid3 u, int n1, int n2, int n3, int i3) {
+
+    /*--------------------------------------------------------------------
+    c-------------------------------------------------------------------*/
+
+    /*--------------------------------------------------------------------
+    c     comm3_plane does the part of comm3 that depends on plane i3,
+    c     for a stencil that has just finished it: the borders of the
+    c     plane and, for planes 1 and n3-2, the periodic plane made of
+    c     them.  Called on every plane, it leaves u as comm3 does
+    c-------------------------------------------------------------------*/
+
+    int i1, i2;
+
+    /* axis = 1 */
+    for (i2 = 1; i2 < n2-1; i2++) {
+        u(i3,i2,n1-1) = u(i3,i2,1);
+        u(i3,i2,0) = u(i3,i2,n1-2);
+    }
+    /* axis = 2 */
+    for (i1 = 0; i1 < n1; i1++) {
+        u(i3,n2-1,i1) = u(i3,1,i1);
+        u(i3,0,i1) = u(i3,n2-2,i1);
+    }
+    /* axis = 3 */
+    if (i3 == 1) {
+        for (i2 = 0; i2 < n2; i2++) {
+            for (i1 = 0; i1 < n1; i1++) {
+        	u(n3-1,i2,i1) = u(1,i2,i1);
+            }
+        }
+    }
+    if (i3 == n3-2) {
+        for (i2 = 0; i2 < n2; i2++) {
+            for (i1 = 0; i1 < n1; i1++) {
+        	u(0,i2,i1) = u(n3-2,i2,i1);
+            }
+        }
+    }
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void zran3(grid3 z, int n1, int n2, int n3, int nx, int ny, int k) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -935,7 +1195,7 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
        x1 = x0;
         for (i2 = 1; i2 < e2; i2++) {
             xx = x1;
-            vranlc( d1, &xx, A, &(z[i3][i2][0]));
+            vranlc( d1, &xx, A, &(z(i3,i2,0)));
             /*rdummy = */randlc( &x1, a1 );
         }
        /*rdummy = */randlc( &x0, a2 );
@@ -963,15 +1223,15 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     for (i3 = 1; i3 < n3-1; i3++) {
         for (i2 = 1; i2 < n2-1; i2++) {
             for (i1 = 1; i1 < n1-1; i1++) {
-                if ( z[i3][i2][i1] > ten[0][1] ) {
-                    ten[0][1] = z[i3][i2][i1];
+                if ( z(i3,i2,i1) > ten[0][1] ) {
+                    ten[0][1] = z(i3,i2,i1);
                     j1[0][1] = i1;
                     j2[0][1] = i2;
                     j3[0][1] = i3;
                     bubble( ten, j1, j2, j3, MM, 1 );
                 }
-                if ( z[i3][i2][i1] < ten[0][0] ) {
-                    ten[0][0] = z[i3][i2][i1];
+                if ( z(i3,i2,i1) < ten[0][0] ) {
+                    ten[0][0] = z(i3,i2,i1);
                     j1[0][0] = i1;
                     j2[0][0] = i2;
                     j3[0][0] = i3;
@@ -988,8 +1248,8 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     i0 = MM - 1;
     int jg[4][MM][2];
     for (i = MM - 1 ; i >= 0; i--) {
-        best = z[j3[i1][1]][j2[i1][1]][j1[i1][1]];
-        if (best == z[j3[i1][1]][j2[i1][1]][j1[i1][1]]) {
+        best = z(j3[i1][1],j2[i1][1],j1[i1][1]);
+        if (best == z(j3[i1][1],j2[i1][1],j1[i1][1])) {
             jg[0][i][1] = 0;
             jg[1][i][1] = is1 - 1 + j1[i1][1];
             jg[2][i][1] = is2 - 1 + j2[i1][1];
@@ -1002,8 +1262,8 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
             jg[3][i][1] = 0;
         }
         ten[i][1] = best;
-        best = z[j3[i0][0]][j2[i0][0]][j1[i0][0]];
-        if (best == z[j3[i0][0]][j2[i0][0]][j1[i0][0]]) {
+        best = z(j3[i0][0],j2[i0][0],j1[i0][0]);
+        if (best == z(j3[i0][0],j2[i0][0],j1[i0][0])) {
             jg[0][i][0] = 0;
             jg[1][i][0] = is1 - 1 + j1[i0][0];
             jg[2][i][0] = is2 - 1 + j2[i0][0];
@@ -1050,16 +1310,16 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     pf->parallel_for(0,n3,1,[&](int i3){
         for (int i2 = 0; i2 < n2; i2++) {
             for (int i1 = 0; i1 < n1; i1++) {
-              z[i3][i2][i1] = 0.0;
+              z(i3,i2,i1) = 0.0;
             }
         }
     });
 
     for (i = MM-1; i >= m0; i--) {
-       z[j3[i][0]][j2[i][0]][j1[i][0]] = -1.0;
+       z(j3[i][0],j2[i][0],j1[i][0]) = -1.0;
     }
     for (i = MM-1; i >= m1; i--) {
-       z[j3[i][1]][j2[i][1]][j1[i][1]] = 1.0;
+       z(j3[i][1],j2[i][1],j1[i][1]) = 1.0;
     }
     comm3(z,n1,n2,n3,k);
 
@@ -1071,7 +1331,7 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void showall(double ***z, int n1, int n2, int n3) {
+static void showall(grid3 z, int n1, int n2, int n3) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -1087,7 +1347,7 @@ static void showall(double ***z, int n1, int n2, int n3) {
     for (i3 = 0; i3 < m3; i3++) {
         for (i1 = 0; i1 < m1; i1++) {
             for (i2 = 0; i2 < m2; i2++) {
-              printf("%6.3f", z[i3][i2][i1]);
+              printf("%6.3f", z(i3,i2,i1));
             }
             printf("\n");
         }
@@ -1190,17 +1450,17 @@ static void bubble( double ten[M][2], int j1[M][2], int j2[M][2], int j3[M][2],
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void zero3(double ***z, int n1, int n2, int n3) {
+static void zero3(grid3 z, int n1, int n2, int n3) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
 
     int i1, i2, i3;
     
-    pf->parallel_for(0,n3,1,[&](int i3){
+    level_for(0, n3, (long)n1*n2*n3, [&](int i3){
         for (int i2 = 0; i2 < n2; i2++) {
             for (int i1 = 0; i1 < n1; i1++) {
-              z[i3][i2][i1] = 0.0;
+              z(i3,i2,i1) = 0.0;
             }
         }
     });
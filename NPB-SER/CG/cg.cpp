@@ -60,6 +60,9 @@ static double q[NA+2+1];	/* q[1:NA+2] */
 static double r[NA+2+1];	/* r[1:NA+2] */
 static double w[NA+2+1];	/* w[1:NA+2] */
 
+/* common /kernel_mode/ */
+static boolean fused_kernels;
+
 /* common /urando/ */
 static double amult;
 static double tran;
@@ -125,6 +128,15 @@ int main(int argc, char **argv)
   	printf(" Size: %10d\n", NA);
 	printf(" Iterations: %5d\n", NITER);
 
+	if(const char * fk = std::getenv("CG_FUSED")) {
+		fused_kernels = atoi(fk);
+	} else {
+		fused_kernels = FALSE;
+	}
+	if (fused_kernels) {
+		printf(" Fused SpMV/dot/axpy kernels enabled\n");
+	}
+
 	naa = NA;
 	nzz = NZ;
 
@@ -376,13 +388,28 @@ c---------------------------------------------------------------------*/
 		C        on the Cray t3d - overall speed of code is 1.5 times faster.
 		*/
 
-		/* rolled version */      
-		for (j = 1; j <= lastrow-firstrow+1; j++) {
-			sum = 0.0;
-			for (k = rowstr[j]; k < rowstr[j+1]; k++) {
-				sum = sum + a[k]*p[colidx[k]];
-		    }
-			w[j] = sum;
+		if (fused_kernels) {
+			/*--------------------------------------------------------------------
+			c  Fused: q = A.p is written directly and p.q is accumulated
+			c  in the same sweep, so w, its copy and its clear are skipped
+			c-------------------------------------------------------------------*/
+			for (j = 1; j <= lastrow-firstrow+1; j++) {
+				sum = 0.0;
+				for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+					sum = sum + a[k]*p[colidx[k]];
+				}
+				q[j] = sum;
+				d = d + p[j]*sum;
+			}
+		} else {
+			/* rolled version */      
+			for (j = 1; j <= lastrow-firstrow+1; j++) {
+				sum = 0.0;
+				for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+					sum = sum + a[k]*p[colidx[k]];
+			    }
+				w[j] = sum;
+			}
 		}
 		
 		/* unrolled-by-two version
@@ -426,22 +453,24 @@ c---------------------------------------------------------------------*/
 		}
 		*/
 		
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			q[j] = w[j];
-		}
+		if (!fused_kernels) {
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				q[j] = w[j];
+			}
 
-		/*--------------------------------------------------------------------
-		c  Clear w for reuse...
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			w[j] = 0.0;
-		}
+			/*--------------------------------------------------------------------
+			c  Clear w for reuse...
+			c-------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				w[j] = 0.0;
+			}
 
-		/*--------------------------------------------------------------------
-		c  Obtain p.q
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			d = d + p[j]*q[j];
+			/*--------------------------------------------------------------------
+			c  Obtain p.q
+			c-------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				d = d + p[j]*q[j];
+			}
 		}
 
 		/*--------------------------------------------------------------------
@@ -458,17 +487,28 @@ c---------------------------------------------------------------------*/
 		c  Obtain z = z + alpha*p
 		c  and    r = r - alpha*q
 		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			z[j] = z[j] + alpha*p[j];
-			r[j] = r[j] - alpha*q[j];
-		}
+		if (fused_kernels) {
+			/*---------------------------------------------------------------------
+			c  Fused: rho = r.r is accumulated while r is updated
+			c---------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				z[j] = z[j] + alpha*p[j];
+				r[j] = r[j] - alpha*q[j];
+				rho = rho + r[j]*r[j];
+			}
+		} else {
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				z[j] = z[j] + alpha*p[j];
+				r[j] = r[j] - alpha*q[j];
+			}
             
-		/*---------------------------------------------------------------------
-		c  rho = r.r
-		c  Now, obtain the norm of r: First, sum squares of r elements locally...
-		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			rho = rho + r[j]*r[j];
+			/*---------------------------------------------------------------------
+			c  rho = r.r
+			c  Now, obtain the norm of r: First, sum squares of r elements locally...
+			c---------------------------------------------------------------------*/
+			for (j = 1; j <= lastcol-firstcol+1; j++) {
+				rho = rho + r[j]*r[j];
+			}
 		}
 
 		/*--------------------------------------------------------------------
@@ -490,25 +530,40 @@ c---------------------------------------------------------------------*/
 	c  The partition submatrix-vector multiply
 	c---------------------------------------------------------------------*/
 	sum = 0.0;
-    
-	for (j = 1; j <= lastrow-firstrow+1; j++) {
-		d = 0.0;
-		for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
-			d = d + a[k]*z[colidx[k]];
+
+	if (fused_kernels) {
+		/*--------------------------------------------------------------------
+		c  Fused: r = A.z and ||x - r||^2 in a single sweep
+		c-------------------------------------------------------------------*/
+		for (j = 1; j <= lastrow-firstrow+1; j++) {
+			d = 0.0;
+			for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			r[j] = d;
+			d = x[j] - d;
+			sum = sum + d*d;
+		}
+	} else {
+		for (j = 1; j <= lastrow-firstrow+1; j++) {
+			d = 0.0;
+			for (k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+				d = d + a[k]*z[colidx[k]];
+			}
+			w[j] = d;
 		}
-		w[j] = d;
-	}
 
-	for (j = 1; j <= lastcol-firstcol+1; j++) {
-		r[j] = w[j];
-	}
+		for (j = 1; j <= lastcol-firstcol+1; j++) {
+			r[j] = w[j];
+		}
 
-	/*--------------------------------------------------------------------
-	c  At this point, r contains A.z
-	c-------------------------------------------------------------------*/
-	for (j = 1; j <= lastcol-firstcol+1; j++) {
-		d = x[j] - r[j];
-		sum = sum + d*d;
+		/*--------------------------------------------------------------------
+		c  At this point, r contains A.z
+		c-------------------------------------------------------------------*/
+		for (j = 1; j <= lastcol-firstcol+1; j++) {
+			d = x[j] - r[j];
+			sum = sum + d*d;
+		}
 	}
 	
 	(*rnorm) = sqrt(sum);
@@ -41,3 +41,22 @@ c---------------------------------------------------------------------*/
 
 /* common /buffer/ */
 /*static double buff[4][NM2];*/
+
+/*---------------------------------------------------------------------
+c  Each grid is one block aligned to GRID_ALIGN bytes, seen through a
+c  grid3: z(i3,i2,i1) is element i1 of row i2 of plane i3, and rows
+c  are ld1 doubles apart, padded past n1 (see alloc_grid)
+c---------------------------------------------------------------------*/
+#define	GRID_ALIGN	64
+
+struct grid3 {
+	double *base;
+	long ld1, ld2;	/* doubles per row and per plane */
+
+	inline double& operator()(int i3, int i2, int i1) const {
+		return base[i3*ld2 + i2*ld1 + i1];
+	}
+};
+
+/* extra doubles at the end of each row, from MG_PAD */
+static int grid_pad = 0;
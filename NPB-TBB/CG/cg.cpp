@@ -27,61 +27,251 @@ c---------------------------------------------------------------------
 */
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
+#include <tbb/parallel_scan.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
 #include <tbb/blocked_range.h>
 #include <tbb/task_scheduler_init.h>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sched.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "npb-CPP.hpp"
 #include "npbparams.hpp"
 
-#define	NZ	NA*(NONZER+1)*(NONZER+1)+NA*(NONZER+2)
+#define	NZ	((long)NA*(NONZER+1)*(NONZER+1)+(long)NA*(NONZER+2))
+
+/*--------------------------------------------------------------------
+c  SELL-C-sigma: rows are sorted by decreasing length inside windows
+c  of SELL_SIGMA rows and packed column-major in chunks of SELL_C rows,
+c  so one chunk column is a single SIMD gather over p
+c-------------------------------------------------------------------*/
+#define SELL_C		8
+#ifndef SELL_SIGMA
+#define SELL_SIGMA	256
+#endif
+
+/*--------------------------------------------------------------------
+c  delta storage: the columns of each row are sorted and stored as
+c  16-bit differences to the previous column (the first one to 0).
+c  A difference that does not fit is written as DELTA_ESCAPE followed
+c  by the absolute column in two 16-bit codes, low half first
+c-------------------------------------------------------------------*/
+#define DELTA_ESCAPE	INT16_MIN
+
+#define SPMV_CSR	0
+#define SPMV_SELL	1
+#define SPMV_DELTA	2
+#define SPMV_DELTA_FLOAT	3
+#define SPMV_SYM	4
+
+#define CG_BLOCK_MAX	8
+
+#define MATRIX_CACHE_MAGIC	"NPBCGMAT"
+#define MATRIX_CACHE_VERSION	2
+
+typedef struct {
+	char magic[8];
+	int32_t version;
+	int32_t na;
+	int32_t nonzer;
+	int32_t nrows;
+	int64_t nnz;
+	double rcond;
+	double shift;
+	uint64_t checksum;
+} matrix_cache_header_t;
 
 /* global variables */
 
 /* common /partit_size/ */
 static int naa;
-static int nzz;
+static long nzz;
 static int firstrow;
 static int lastrow;
 static int firstcol;
 static int lastcol;
 
+/*--------------------------------------------------------------------
+c  The arrays are allocated at run time: from class E on NZ does not
+c  fit in an int, so positions in the matrix (rowstr and the loops
+c  over nonzeros) are long, while row and column indices stay int
+c-------------------------------------------------------------------*/
+
 /* common /main_int_mem/ */
-static int colidx[NZ+1];	/* colidx[1:NZ] */
-static int rowstr[NA+1+1];	/* rowstr[1:NA+1] */
-static int iv[2*NA+1+1];	/* iv[1:2*NA+1] */
-static int arow[NZ+1];		/* arow[1:NZ] */
-static int acol[NZ+1];		/* acol[1:NZ] */
+static int *colidx;		/* colidx[1:NZ] */
+static long *rowstr;	/* rowstr[1:NA+1] */
+static int *iv;			/* iv[1:2*NA+1] */
+static int *arow;		/* arow[1:NZ] */
+static int *acol;		/* acol[1:NZ] */
 
 /* common /main_flt_mem/ */
-static double v[NA+1+1];	/* v[1:NA+1] */
-static double aelt[NZ+1];	/* aelt[1:NZ] */
-static double a[NZ+1];		/* a[1:NZ] */
-static double x[NA+2+1];	/* x[1:NA+2] */
-static double z[NA+2+1];	/* z[1:NA+2] */
-static double p[NA+2+1];	/* p[1:NA+2] */
-static double q[NA+2+1];	/* q[1:NA+2] */
-static double r[NA+2+1];	/* r[1:NA+2] */
-static double w[NA+2+1];	/* w[1:NA+2] */
+static double *v;		/* v[1:NA+1] */
+static double *aelt;	/* aelt[1:NZ] */
+static double *a;		/* a[1:NZ] */
+static double *x;		/* x[1:NA+2] */
+static double *z;		/* z[1:NA+2] */
+static double *p;		/* p[1:NA+2] */
+static double *q;		/* q[1:NA+2] */
+static double *r;		/* r[1:NA+2] */
+static double *w;		/* w[1:NA+2] */
+
+/* common /kernel_mode/ */
+static boolean fused_kernels;
+static int spmv_format;
+static boolean rcm_reordering;
+static int num_workers;
+static boolean partition_rows;
+
+/* common /part_mem/ */
+static int part_count;
+static int *part_first;		/* part_first[0:part_count]: first row of each part, NULL if off */
+
+/* common /block_mem/ */
+static int block_k;		/* number of chains in block mode, 0 if off */
+static double *xb;		/* xb[j*block_k+c]: x[j] of chain c, j in 1:NA+2 */
+static double *zb;
+static double *pb;
+static double *qb;
+static double *rb;
+
+/* common /matrix_cache/ */
+static char matrix_cache_path[4096];	/* empty if the cache is disabled */
+
+/* common /rcm_mem/ */
+static int *rcm_perm;		/* rcm_perm[1:NA]: original index of each reordered row */
+static int *rcm_iperm;		/* rcm_iperm[1:NA]: reordered index of each original row */
+
+/* common /sell_mem/ */
+static int sell_nchunks;
+static long *sell_cs;		/* sell_cs[0:nchunks]: first slot of each chunk */
+static int *sell_cl;		/* sell_cl[0:nchunks-1]: width of each chunk */
+static int *sell_perm;		/* sell_perm[0:nchunks*SELL_C-1]: row held by each lane, 0 if padding */
+static int *sell_col;		/* sell_col[0:sell_cs[nchunks]-1] */
+static double *sell_val;	/* sell_val[0:sell_cs[nchunks]-1] */
+static void (*sell_chunk)(int c, const double src[], double acc[]);
+static const char *sell_isa;
+
+/* common /delta_mem/ */
+static long *delta_ptr;		/* delta_ptr[1:NA+1]: first code of each row */
+static int16_t *delta_code;	/* delta_code[0:delta_ptr[NA+1]-1] */
+static double *delta_val;	/* delta_val[1:NZ]: values in sorted column order */
+static float *delta_valf;	/* delta_valf[1:NZ]: same, single precision */
+static double *refine_x;	/* refine_x[1:NA+2]: right side of the correction solve */
+static double *refine_z;	/* refine_z[1:NA+2]: its solution */
+static int delta_escapes;
+
+/* common /sym_mem/ */
+static int sym_nblocks;
+static int *sym_first;		/* sym_first[0:nblocks]: first row of each block */
+static long *sym_rowstr;	/* sym_rowstr[1:NA+1]: first upper entry of each row */
+static long *sym_mid;		/* sym_mid[1:NA]: first upper entry past the block of the row */
+static int *sym_col;		/* sym_col[0:sym_rowstr[NA+1]-1] */
+static double *sym_val;		/* sym_val[0:sym_rowstr[NA+1]-1] */
+static double *sym_diag;	/* sym_diag[1:NA] */
+static double *sym_buf;		/* sym_buf[b*(NA+1)+j]: part of row j added by block b */
+
+/* partial sums of x.z and z.z for the reductions in main */
+typedef struct { double norm_temp11 = 0.0; double norm_temp12 = 0.0; } norm_temps_t;
+
+/* per-chain partial sums of up to two dot products in block mode */
+typedef struct { double v1[CG_BLOCK_MAX] = {}; double v2[CG_BLOCK_MAX] = {}; } block_sums_t;
 
 /* common /urando/ */
 static double amult;
 static double tran;
 
 /* function declarations */
-static void conj_grad (int colidx[], int rowstr[], double x[], 
+static void conj_grad (int colidx[], long rowstr[], double x[], 
+	double z[], double a[], double p[], double q[], double r[], 
+	double w[], double *rnorm);
+static void conj_grad_refined (int colidx[], long rowstr[], double x[], 
 	double z[], double a[], double p[], double q[], double r[], 
 	double w[], double *rnorm);
-static void makea(int n, int nz, double a[], int colidx[], int rowstr[],
+static double csr_residual(int colidx[], long rowstr[], double a[],
+	const double x[], const double z[], double res[]);
+static void makea(int n, long nz, double a[], int colidx[], long rowstr[],
 	int nonzer, int firstrow, int lastrow, int firstcol,
 	int lastcol, double rcond, int arow[], int acol[],
 	double aelt[], double v[], int iv[], double shift );
-static void sparse(double a[], int colidx[], int rowstr[], int n,
+static void sparse(double a[], int colidx[], long rowstr[], int n,
 	int arow[], int acol[], double aelt[],
-	int firstrow, int lastrow,
-	double x[], boolean mark[], int nzloc[], int nnza);
+	int firstrow, int lastrow, long nnza);
 static void sprnvc(int n, int nz, double v[], int iv[], int nzloc[], int mark[]);
 static int icnvrt(double x, int ipwr2);
 static void vecset(int n, double v[], int iv[], int *nzv, int i, double val);
+static void sell_build(int colidx[], long rowstr[], double a[], int nrows);
+static double sell_spmv(const double src[], double dst[], const double dot[]);
+static long max_row_length(long rowstr[], int nrows);
+static void delta_build(int colidx[], long rowstr[], double a[], int nrows, boolean single);
+static void sym_build(int colidx[], long rowstr[], double a[], int nrows);
+static double sym_spmv(const double src[], double dst[], const double dot[]);
+static double spmv(const double src[], double dst[], const double dot[]);
+static double spmv_matrix_bytes(int format);
+static double solve_matrix_bytes();
+static void rcm_reorder(int colidx[], long rowstr[], double a[], int n,
+	int acol[], double aelt[]);
+static int bandwidth(int colidx[], long rowstr[], int n);
+static void partition_build(int *&colidx, long *&rowstr, double *&a, int nrows, boolean copy_matrix);
+static int block_benchmark(char class_npb, double zeta_verify_value);
+
+/*--------------------------------------------------------------------
+c  Loops over rows and vector entries.  Without a partition they are
+c  plain TBB loops; with CG_PARTITION=nnz part p is always run by
+c  thread p (static_partitioner), on the part of [lo, hi) it owns, so
+c  every thread touches the same slice of the matrix and the vectors
+c  in every loop, and reductions are added in part order
+c-------------------------------------------------------------------*/
+template <class Body>
+static void partitioned_for(size_t lo, size_t hi, const Body& body)
+{
+	if (part_first == NULL) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(lo, hi), body);
+		return;
+	}
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, part_count, 1), [&](const tbb::blocked_range<size_t>& p_tbb){
+		for (size_t p = p_tbb.begin(); p != p_tbb.end(); p++) {
+			size_t beg = max(lo, (size_t)part_first[p]), end = min(hi, (size_t)part_first[p+1]);
+			if (beg < end) {
+				body(tbb::blocked_range<size_t>(beg, end));
+			}
+		}
+	}, tbb::static_partitioner());
+}
+
+template <class T, class Body, class Combine>
+static T partitioned_reduce(size_t lo, size_t hi, T identity, const Body& body, const Combine& combine)
+{
+	if (part_first == NULL) {
+		return tbb::parallel_reduce(tbb::blocked_range<size_t>(lo, hi), identity, body, combine);
+	}
+	std::vector<T> partial(part_count, identity);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, part_count, 1), [&](const tbb::blocked_range<size_t>& p_tbb){
+		for (size_t p = p_tbb.begin(); p != p_tbb.end(); p++) {
+			size_t beg = max(lo, (size_t)part_first[p]), end = min(hi, (size_t)part_first[p+1]);
+			if (beg < end) {
+				partial[p] = body(tbb::blocked_range<size_t>(beg, end), identity);
+			}
+		}
+	}, tbb::static_partitioner());
+	T result = identity;
+	for (int p = 0; p < part_count; p++) {
+		result = combine(result, partial[p]);
+	}
+	return result;
+}
+static boolean matrix_cache_load(const char *path, double a[], int colidx[], long rowstr[], int nrows);
+static void matrix_cache_store(const char *path, const double a[], const int colidx[], const long rowstr[], int nrows);
 
 /*--------------------------------------------------------------------
       program cg
@@ -89,11 +279,13 @@ static void vecset(int n, double v[], int iv[], int *nzv, int i, double val);
 
 int main(int argc, char **argv)
 {
-	int	i, j, k, it;
+	int	i, j, it;
+	long k;
 	double zeta;
 	double rnorm;
 	double norm_temp11;
 	double norm_temp12;
+	norm_temps_t norm_temps;
 	double t, mflops;
 	char class_npb;
 	boolean verified;
@@ -119,6 +311,15 @@ int main(int argc, char **argv)
 	} else if (NA == 150000 && NONZER == 15 && NITER == 75 && SHIFT == 110.0) {
 		class_npb = 'C';
 		zeta_verify_value = 28.973605592845;
+	} else if (NA == 1500000 && NONZER == 21 && NITER == 100 && SHIFT == 500.0) {
+		class_npb = 'D';
+		zeta_verify_value = 52.514532105794;
+	} else if (NA == 9000000 && NONZER == 26 && NITER == 100 && SHIFT == 1.5e3) {
+		class_npb = 'E';
+		zeta_verify_value = 77.522164599383;
+	} else if (NA == 54000000 && NONZER == 31 && NITER == 100 && SHIFT == 5.0e3) {
+		class_npb = 'F';
+		zeta_verify_value = 107.3070826433;
 	} else {
 		class_npb = 'U';
 	}
@@ -131,6 +332,26 @@ int main(int argc, char **argv)
 	naa = NA;
 	nzz = NZ;
 
+	/*--------------------------------------------------------------------
+	c  The vectors are left untouched here so that their pages are first
+	c  touched by the loops that use them
+	c-------------------------------------------------------------------*/
+	colidx = new int[NZ+1];
+	rowstr = new long[NA+1+1];
+	iv = new int[2*NA+1+1];
+	arow = new int[NZ+1];
+	acol = new int[NZ+1];
+
+	v = new double[NA+1+1];
+	aelt = new double[NZ+1];
+	a = new double[NZ+1];
+	x = new double[NA+2+1];
+	z = new double[NA+2+1];
+	p = new double[NA+2+1];
+	q = new double[NA+2+1];
+	r = new double[NA+2+1];
+	w = new double[NA+2+1];
+
 	/*--------------------------------------------------------------------
 	c  Initialize random number generator
 	c-------------------------------------------------------------------*/
@@ -139,7 +360,6 @@ int main(int argc, char **argv)
 	zeta    = randlc( &tran, amult );
 
 
-    int num_workers;
     if(const char * nw = std::getenv("TBB_NUM_THREADS")) {
         num_workers = atoi(nw);
     } else {
@@ -148,12 +368,81 @@ int main(int argc, char **argv)
     
     tbb::task_scheduler_init init(num_workers);
 
+	if(const char * fk = std::getenv("CG_FUSED")) {
+		fused_kernels = atoi(fk);
+	} else {
+		fused_kernels = FALSE;
+	}
+	if (fused_kernels) {
+		printf(" Fused SpMV/dot/axpy kernels enabled\n");
+	}
+
+	spmv_format = SPMV_CSR;
+	if(const char * sf = std::getenv("CG_SPMV")) {
+		if (strcmp(sf, "sell") == 0) {
+			spmv_format = SPMV_SELL;
+		} else if (strcmp(sf, "delta") == 0) {
+			spmv_format = SPMV_DELTA;
+		} else if (strcmp(sf, "delta-float") == 0) {
+			spmv_format = SPMV_DELTA_FLOAT;
+		} else if (strcmp(sf, "sym") == 0) {
+			spmv_format = SPMV_SYM;
+		} else if (strcmp(sf, "csr") != 0) {
+			printf(" Unknown CG_SPMV format %s, using csr\n", sf);
+		}
+	}
+
+	if(const char * ro = std::getenv("CG_REORDER")) {
+		rcm_reordering = (strcmp(ro, "rcm") == 0);
+		if (!rcm_reordering && strcmp(ro, "none") != 0) {
+			printf(" Unknown CG_REORDER ordering %s, using none\n", ro);
+		}
+	} else {
+		rcm_reordering = FALSE;
+	}
+
+	if(const char * bk = std::getenv("CG_BLOCK")) {
+		block_k = max(0, min(atoi(bk), CG_BLOCK_MAX));
+		if (block_k != atoi(bk)) {
+			printf(" CG_BLOCK must be 0 to %d, using %d\n", CG_BLOCK_MAX, block_k);
+		}
+	} else {
+		block_k = 0;
+	}
+	if (block_k > 0) {
+		printf(" Block CG: %d chains\n", block_k);
+		if (spmv_format != SPMV_CSR) {
+			printf(" Block CG multiplies the CSR matrix, CG_SPMV is ignored\n");
+			spmv_format = SPMV_CSR;
+		}
+	}
+
+	if(const char * cp = std::getenv("CG_PARTITION")) {
+		partition_rows = (strcmp(cp, "nnz") == 0);
+		if (!partition_rows && strcmp(cp, "rows") != 0) {
+			printf(" Unknown CG_PARTITION %s, using rows\n", cp);
+		}
+	} else {
+		partition_rows = FALSE;
+	}
+
+	if(const char * mc = std::getenv("CG_MATRIX_CACHE")) {
+		snprintf(matrix_cache_path, sizeof(matrix_cache_path), "%s/cg.%d.%d.%g.%g.mat",
+			mc, NA, NONZER, RCOND, SHIFT);
+	}
+
 	/*--------------------------------------------------------------------
 	c  
 	c-------------------------------------------------------------------*/
-	makea(naa, nzz, a, colidx, rowstr, NONZER,
-	firstrow, lastrow, firstcol, lastcol, 
-	RCOND, arow, acol, aelt, v, iv, SHIFT);
+	if (matrix_cache_path[0] == '\0'
+		|| !matrix_cache_load(matrix_cache_path, a, colidx, rowstr, lastrow-firstrow+1)) {
+		makea(naa, nzz, a, colidx, rowstr, NONZER,
+		firstrow, lastrow, firstcol, lastcol, 
+		RCOND, arow, acol, aelt, v, iv, SHIFT);
+		if (matrix_cache_path[0] != '\0') {
+			matrix_cache_store(matrix_cache_path, a, colidx, rowstr, lastrow-firstrow+1);
+		}
+	}
 
 	/*---------------------------------------------------------------------
 	c  Note: as a result of the above call to makea:
@@ -171,6 +460,47 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/*---------------------------------------------------------------------
+	c  Optionally renumber rows and columns with reverse Cuthill-McKee.
+	c  x starts as (1, ..., 1) and zeta only depends on dot products, so
+	c  the iteration runs entirely in the new numbering
+	c---------------------------------------------------------------------*/
+	if (rcm_reordering) {
+		int bw = bandwidth(colidx, rowstr, lastrow-firstrow+1);
+		rcm_reorder(colidx, rowstr, a, lastrow-firstrow+1, acol, aelt);
+		printf(" RCM reordering: bandwidth %d -> %d\n", bw, bandwidth(colidx, rowstr, lastrow-firstrow+1));
+	}
+
+	/* the triples and the generator workspace are not needed any more */
+	delete[] arow;
+	delete[] acol;
+	delete[] aelt;
+	delete[] iv;
+	delete[] v;
+
+	if (spmv_format == SPMV_SELL) {
+		sell_build(colidx, rowstr, a, lastrow-firstrow+1);
+		printf(" SpMV format: SELL-%d-%d (%s), %d chunks, %.1f%% padding\n",
+			SELL_C, SELL_SIGMA, sell_isa, sell_nchunks,
+			100.0 * (sell_cs[sell_nchunks] - (rowstr[lastrow-firstrow+2] - rowstr[1])) / sell_cs[sell_nchunks]);
+	} else if (spmv_format == SPMV_DELTA || spmv_format == SPMV_DELTA_FLOAT) {
+		delta_build(colidx, rowstr, a, lastrow-firstrow+1, spmv_format == SPMV_DELTA_FLOAT);
+		printf(" SpMV format: 16-bit delta columns, %s values, %d escapes\n",
+			(spmv_format == SPMV_DELTA_FLOAT) ? "float" : "double", delta_escapes);
+	} else if (spmv_format == SPMV_SYM) {
+		sym_build(colidx, rowstr, a, lastrow-firstrow+1);
+		printf(" SpMV format: symmetric, %ld upper entries, %d row blocks\n",
+			sym_rowstr[lastrow-firstrow+2], sym_nblocks);
+	}
+
+	if (partition_rows) {
+		partition_build(colidx, rowstr, a, lastrow-firstrow+1, spmv_format == SPMV_CSR && block_k == 0);
+	}
+
+	if (block_k > 0) {
+		return block_benchmark(class_npb, zeta_verify_value);
+	}
+
 	/*--------------------------------------------------------------------
 	c  set starting vector to (1, 1, .... 1)
 	c-------------------------------------------------------------------*/
@@ -192,7 +522,11 @@ int main(int argc, char **argv)
 		/*--------------------------------------------------------------------
 		c  The call to the conjugate gradient routine:
 		c-------------------------------------------------------------------*/
-		conj_grad (colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		if (spmv_format == SPMV_DELTA_FLOAT) {
+			conj_grad_refined(colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		} else {
+			conj_grad (colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		}
 
 		/*--------------------------------------------------------------------
 		c  zeta = shift + 1/(x.z)
@@ -201,13 +535,22 @@ int main(int argc, char **argv)
 		c  So, first: (z.z)
 		c-------------------------------------------------------------------*/
 		
-		norm_temp11 = 0.0;
-		norm_temp12 = 0.0;
+		norm_temps = partitioned_reduce(1, lastcol-firstcol+2, norm_temps_t(), 
+			[&](const tbb::blocked_range<size_t>& r_tbb, norm_temps_t norm_tbb) -> norm_temps_t{
 
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			norm_temp11 = norm_temp11 + x[j]*z[j];
-			norm_temp12 = norm_temp12 + z[j]*z[j];
-		}
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				norm_tbb.norm_temp11 += x[j]*z[j];
+				norm_tbb.norm_temp12 += z[j]*z[j];
+			}
+			return norm_tbb;
+
+		}, [](norm_temps_t total_norm, norm_temps_t temp_norm) -> norm_temps_t{
+			total_norm.norm_temp11 += temp_norm.norm_temp11;
+			total_norm.norm_temp12 += temp_norm.norm_temp12;
+			return total_norm;
+		});
+		norm_temp11 = norm_temps.norm_temp11;
+		norm_temp12 = norm_temps.norm_temp12;
 		
 		norm_temp12 = 1.0 / sqrt( norm_temp12 );
 
@@ -215,9 +558,11 @@ int main(int argc, char **argv)
 		c  Normalize z to obtain x
 		c-------------------------------------------------------------------*/
 	
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			x[j] = norm_temp12*z[j];
-		}
+		partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				x[j] = norm_temp12*z[j];
+			}
+		});
 
 	} /* end of do one iteration untimed */
 
@@ -246,7 +591,11 @@ int main(int argc, char **argv)
 		/*--------------------------------------------------------------------
 		c  The call to the conjugate gradient routine:
 		c-------------------------------------------------------------------*/
-		conj_grad(colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		if (spmv_format == SPMV_DELTA_FLOAT) {
+			conj_grad_refined(colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		} else {
+			conj_grad(colidx, rowstr, x, z, a, p, q, r, w, &rnorm);
+		}
 
 		/*--------------------------------------------------------------------
 		c  zeta = shift + 1/(x.z)
@@ -255,13 +604,22 @@ int main(int argc, char **argv)
 		c  So, first: (z.z)
 		c-------------------------------------------------------------------*/
 	
-		norm_temp11 = 0.0;
-		norm_temp12 = 0.0;
+		norm_temps = partitioned_reduce(1, lastcol-firstcol+2, norm_temps_t(), 
+			[&](const tbb::blocked_range<size_t>& r_tbb, norm_temps_t norm_tbb) -> norm_temps_t{
 
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			norm_temp11 = norm_temp11 + x[j]*z[j];
-			norm_temp12 = norm_temp12 + z[j]*z[j];
-		}
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				norm_tbb.norm_temp11 += x[j]*z[j];
+				norm_tbb.norm_temp12 += z[j]*z[j];
+			}
+			return norm_tbb;
+
+		}, [](norm_temps_t total_norm, norm_temps_t temp_norm) -> norm_temps_t{
+			total_norm.norm_temp11 += temp_norm.norm_temp11;
+			total_norm.norm_temp12 += temp_norm.norm_temp12;
+			return total_norm;
+		});
+		norm_temp11 = norm_temps.norm_temp11;
+		norm_temp12 = norm_temps.norm_temp12;
 
 		norm_temp12 = 1.0 / sqrt( norm_temp12 );
 		zeta = SHIFT + 1.0 / norm_temp11;
@@ -276,9 +634,11 @@ int main(int argc, char **argv)
 		c  Normalize z to obtain x
 		c-------------------------------------------------------------------*/
 	
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			x[j] = norm_temp12*z[j];
-		}
+		partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				x[j] = norm_temp12*z[j];
+			}
+		});
 	} /* end of main iter inv pow meth */
 
 
@@ -290,8 +650,29 @@ int main(int argc, char **argv)
 
 	t = timer_read( 1 );
 
+	/*--------------------------------------------------------------------
+	c  Bring the eigenvector estimate back to the original numbering
+	c-------------------------------------------------------------------*/
+	if (rcm_reordering) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				w[rcm_perm[j]] = x[j];
+			}
+		});
+		tbb::parallel_for(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				x[j] = w[j];
+			}
+		});
+	}
+
 	printf(" Benchmark completed\n");
 
+	if ( t != 0.0 ) {
+		printf(" SpMV matrix traffic: %.1f MB per product, %.2f GB/s\n",
+			spmv_matrix_bytes(spmv_format) / 1.0e6, solve_matrix_bytes() * NITER / t / 1.0e9);
+	}
+
 	epsilon = 1.0e-10;
 	if (class_npb != 'U') {
 		if (fabs(zeta - zeta_verify_value) <= epsilon) {
@@ -325,7 +706,7 @@ int main(int argc, char **argv)
 c-------------------------------------------------------------------*/
 static void conj_grad (
 	int colidx[],	/* colidx[1:nzz] */
-	int rowstr[],	/* rowstr[1:naa+1] */
+	long rowstr[],	/* rowstr[1:naa+1] */
 	double x[],		/* x[*] */
 	double z[],		/* z[*] */
 	double a[],		/* a[1:nzz] */
@@ -343,7 +724,6 @@ c  CG algorithm
 c---------------------------------------------------------------------*/
 {
 	static double d, sum, rho, rho0, alpha, beta;
-	int j, k;
 	int cgit, cgitmax = 25;
 
 	rho = 0.0;
@@ -351,21 +731,26 @@ c---------------------------------------------------------------------*/
 	/*--------------------------------------------------------------------
 	c  Initialize the CG algorithm:
 	c-------------------------------------------------------------------*/
-    for (j = 1; j <= naa+1; j++) {
-		q[j] = 0.0;
-		z[j] = 0.0;
-		r[j] = x[j];
-		p[j] = r[j];
-		w[j] = 0.0;
-    }
+	partitioned_for(1, naa+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			q[j] = 0.0;
+			z[j] = 0.0;
+			r[j] = x[j];
+			p[j] = r[j];
+			w[j] = 0.0;
+		}
+	});
 
 	/*--------------------------------------------------------------------
 	c  rho = r.r
 	c  Now, obtain the norm of r: First, sum squares of r elements locally...
 	c-------------------------------------------------------------------*/
-	for (j = 1; j <= lastcol-firstcol+1; j++) {
-		rho = rho + x[j]*x[j];
-	}
+	rho = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double rho_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			rho_tbb += x[j]*x[j];
+		}
+		return rho_tbb;
+	}, std::plus<double>() );
 
 	/*--------------------------------------------------------------------
 	c---->
@@ -390,17 +775,41 @@ c---------------------------------------------------------------------*/
 		C        on the Cray t3d - overall speed of code is 1.5 times faster.
 		*/
 
-		/* rolled version */      
-		tbb::parallel_for(tbb::blocked_range<size_t>(1, lastrow-firstrow+2), [&](const tbb::blocked_range<size_t>& r){
-			for (int j = r.begin(); j != r.end(); j++) {
-
-				double sum = 0.0;
-				for (int k = rowstr[j]; k < rowstr[j+1]; k++) {
-					sum = sum + a[k]*p[colidx[k]];
-			    }
-				w[j] = sum;
+		if (spmv_format != SPMV_CSR) {
+			if (fused_kernels) {
+				d = spmv(p, q, p);
+			} else {
+				spmv(p, w, NULL);
 			}
-		});
+		} else if (fused_kernels) {
+			/*--------------------------------------------------------------------
+			c  Fused: q = A.p is written directly and p.q is accumulated
+			c  in the same sweep, so w, its copy and its clear are skipped
+			c-------------------------------------------------------------------*/
+			d = partitioned_reduce(1, lastrow-firstrow+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double d_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					double sum = 0.0;
+					for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+						sum = sum + a[k]*p[colidx[k]];
+					}
+					q[j] = sum;
+					d_tbb += p[j]*sum;
+				}
+				return d_tbb;
+			}, std::plus<double>() );
+		} else {
+			/* rolled version */      
+			partitioned_for(1, lastrow-firstrow+2, [&](const tbb::blocked_range<size_t>& r){
+				for (int j = r.begin(); j != r.end(); j++) {
+
+					double sum = 0.0;
+					for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+						sum = sum + a[k]*p[colidx[k]];
+				    }
+					w[j] = sum;
+				}
+			});
+		}
 		
 		/* unrolled-by-two version
 		for (j = 1; j <= lastrow-firstrow+1; j++) {
@@ -443,22 +852,31 @@ c---------------------------------------------------------------------*/
 		}
 		*/
 		
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			q[j] = w[j];
-		}
-
-		/*--------------------------------------------------------------------
-		c  Clear w for reuse...
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			w[j] = 0.0;
-		}
-
-		/*--------------------------------------------------------------------
-		c  Obtain p.q
-		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			d = d + p[j]*q[j];
+		if (!fused_kernels) {
+			partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					q[j] = w[j];
+				}
+			});
+
+			/*--------------------------------------------------------------------
+			c  Clear w for reuse...
+			c-------------------------------------------------------------------*/
+			partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					w[j] = 0.0;
+				}
+			});
+
+			/*--------------------------------------------------------------------
+			c  Obtain p.q
+			c-------------------------------------------------------------------*/
+			d = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double d_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					d_tbb += p[j]*q[j];
+				}
+				return d_tbb;
+			}, std::plus<double>() );
 		}
 
 		/*--------------------------------------------------------------------
@@ -475,17 +893,36 @@ c---------------------------------------------------------------------*/
 		c  Obtain z = z + alpha*p
 		c  and    r = r - alpha*q
 		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			z[j] = z[j] + alpha*p[j];
-			r[j] = r[j] - alpha*q[j];
-		}
+		if (fused_kernels) {
+			/*---------------------------------------------------------------------
+			c  Fused: rho = r.r is accumulated while r is updated
+			c---------------------------------------------------------------------*/
+			rho = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double rho_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					z[j] = z[j] + alpha*p[j];
+					r[j] = r[j] - alpha*q[j];
+					rho_tbb += r[j]*r[j];
+				}
+				return rho_tbb;
+			}, std::plus<double>() );
+		} else {
+			partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					z[j] = z[j] + alpha*p[j];
+					r[j] = r[j] - alpha*q[j];
+				}
+			});
             
-		/*---------------------------------------------------------------------
-		c  rho = r.r
-		c  Now, obtain the norm of r: First, sum squares of r elements locally...
-		c---------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			rho = rho + r[j]*r[j];
+			/*---------------------------------------------------------------------
+			c  rho = r.r
+			c  Now, obtain the norm of r: First, sum squares of r elements locally...
+			c---------------------------------------------------------------------*/
+			rho = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double rho_tbb){
+				for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+					rho_tbb += r[j]*r[j];
+				}
+				return rho_tbb;
+			}, std::plus<double>() );
 		}
 
 		/*--------------------------------------------------------------------
@@ -496,9 +933,11 @@ c---------------------------------------------------------------------*/
 		/*--------------------------------------------------------------------
 		c  p = r + beta*p
 		c-------------------------------------------------------------------*/
-		for (j = 1; j <= lastcol-firstcol+1; j++) {
-			p[j] = r[j] + beta*p[j];
-		}
+		partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				p[j] = r[j] + beta*p[j];
+			}
+		});
 	} /* end of do cgit=1,cgitmax */
 
 	/*---------------------------------------------------------------------
@@ -508,203 +947,1534 @@ c---------------------------------------------------------------------*/
 	c---------------------------------------------------------------------*/
 	sum = 0.0;
     
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, lastrow-firstrow+2), [&](const tbb::blocked_range<size_t>& r){
-		for (int j = r.begin(); j != r.end(); j++) {
-			double d = 0.0;
-			for (int k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
-				d = d + a[k]*z[colidx[k]];
+	if (spmv_format != SPMV_CSR) {
+		/*--------------------------------------------------------------------
+		c  r = A.z over the alternate copy of A, then ||x - r||^2
+		c-------------------------------------------------------------------*/
+		spmv(z, r, NULL);
+
+		sum = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double sum_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				double d = x[j] - r[j];
+				sum_tbb += (d*d);
 			}
-			w[j] = d;
-		}
-	});
+			return sum_tbb;
+		}, std::plus<double>() );
+	} else if (fused_kernels) {
+		/*--------------------------------------------------------------------
+		c  Fused: r = A.z and ||x - r||^2 in a single sweep
+		c-------------------------------------------------------------------*/
+		sum = partitioned_reduce(1, lastrow-firstrow+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double sum_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				double d = 0.0;
+				for (long k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+					d = d + a[k]*z[colidx[k]];
+				}
+				r[j] = d;
+				d = x[j] - d;
+				sum_tbb += (d*d);
+			}
+			return sum_tbb;
+		}, std::plus<double>() );
+	} else {
+		partitioned_for(1, lastrow-firstrow+2, [&](const tbb::blocked_range<size_t>& r){
+			for (int j = r.begin(); j != r.end(); j++) {
+				double d = 0.0;
+				for (long k = rowstr[j]; k <= rowstr[j+1]-1; k++) {
+					d = d + a[k]*z[colidx[k]];
+				}
+				w[j] = d;
+			}
+		});
    
-	for (j = 1; j <= lastcol-firstcol+1; j++) {
-		r[j] = w[j];
-	}
+		partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				r[j] = w[j];
+			}
+		});
 
-	/*--------------------------------------------------------------------
-	c  At this point, r contains A.z
-	c-------------------------------------------------------------------*/
-	sum = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double sum_tbb){
+		/*--------------------------------------------------------------------
+		c  At this point, r contains A.z
+		c-------------------------------------------------------------------*/
+		sum = partitioned_reduce(1, lastcol-firstcol+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double sum_tbb){
 		
-		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
-			double d = x[j] - r[j];
-			sum_tbb += (d*d);
-		}
-		return sum_tbb;
-	}, std::plus<double>() );
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				double d = x[j] - r[j];
+				sum_tbb += (d*d);
+			}
+			return sum_tbb;
+		}, std::plus<double>() );
+	}
 
 	(*rnorm) = sqrt(sum);
 }
 
-/*---------------------------------------------------------------------
-c       generate the test problem for benchmark 6
-c       makea generates a sparse matrix with a
-c       prescribed sparsity distribution
-c
-c       parameter    type        usage
-c
-c       input
-c
-c       n            i           number of cols/rows of matrix
-c       nz           i           nonzeros as declared array size
-c       rcond        r*8         condition number
-c       shift        r*8         main diagonal shift
-c
-c       output
-c
-c       a            r*8         array for nonzeros
-c       colidx       i           col indices
-c       rowstr       i           row pointers
-c
-c       workspace
-c
-c       iv, arow, acol i
-c       v, aelt        r*8
-c---------------------------------------------------------------------*/
-static void makea(
-	int n,
-	int nz,
-	double a[],		/* a[1:nz] */
-	int colidx[],	/* colidx[1:nz] */
-	int rowstr[],	/* rowstr[1:n+1] */
-	int nonzer,
-	int firstrow,
-	int lastrow,
-	int firstcol,
-	int lastcol,
-	double rcond,
-	int arow[],		/* arow[1:nz] */
-	int acol[],		/* acol[1:nz] */
-	double aelt[],	/* aelt[1:nz] */
-	double v[],		/* v[1:n+1] */
-	int iv[],		/* iv[1:2*n+1] */
-	double shift )
+/*--------------------------------------------------------------------
+c  conj_grad over the float copy of A (CG_SPMV=delta-float), then one
+c  step of iterative refinement in double: the residual x - A.z is
+c  taken with the CSR matrix, and a second solve with the float copy
+c  gives the correction of z.  The rounding of A to float (relative
+c  1e-8) is left in z only squared, far under the zeta tolerance.
+c  ||r|| is that of the corrected z, against the CSR matrix
+c-------------------------------------------------------------------*/
+static void conj_grad_refined (
+	int colidx[],	/* colidx[1:nzz] */
+	long rowstr[],	/* rowstr[1:naa+1] */
+	double x[],		/* x[*] */
+	double z[],		/* z[*] */
+	double a[],		/* a[1:nzz] */
+	double p[],		/* p[*] */
+	double q[],		/* q[*] */
+	double r[],		/* r[*] */
+	double w[],		/* w[*] */
+	double *rnorm )
 {
-	int i, nnza, iouter, ivelt, ivelt1, irow, nzv;
+	double rnorm_float;
 
-	/*--------------------------------------------------------------------
-	c      nonzer is approximately  (int(sqrt(nnza /n)));
-	c-------------------------------------------------------------------*/
+	conj_grad(colidx, rowstr, x, z, a, p, q, r, w, &rnorm_float);
+	csr_residual(colidx, rowstr, a, x, z, refine_x);
+	conj_grad(colidx, rowstr, refine_x, refine_z, a, p, q, r, w, &rnorm_float);
 
-	double size, ratio, scale;
-	int jcol;
+	partitioned_for(1, lastcol-firstcol+2, [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			z[j] = z[j] + refine_z[j];
+		}
+	});
 
-	size = 1.0;
-	ratio = pow(rcond, (1.0 / (double)n));
-	nnza = 0;
+	(*rnorm) = sqrt(csr_residual(colidx, rowstr, a, x, z, refine_x));
+}
 
-	/*---------------------------------------------------------------------
-	c  Initialize colidx(n+1 .. 2n) to zero.
-	c  Used by sprnvc to mark nonzero positions
-	c---------------------------------------------------------------------*/
-	for (i = 1; i <= n; i++) {
-		colidx[n+i] = 0;
-	}
-	for (iouter = 1; iouter <= n; iouter++) {
-		nzv = nonzer;
-		sprnvc(n, nzv, v, iv, &(colidx[0]), &(colidx[n]));
-		vecset(n, v, iv, &nzv, iouter, 0.5);
-		for (ivelt = 1; ivelt <= nzv; ivelt++){
-			jcol = iv[ivelt];
-			if (jcol >= firstcol && jcol <= lastcol) {
-				scale = size * v[ivelt];
-				for (ivelt1 = 1; ivelt1 <= nzv; ivelt1++) {
-					irow = iv[ivelt1];
-					if (irow >= firstrow && irow <= lastrow) {
-						nnza = nnza + 1;
-						if (nnza > nz) {
-							printf("Space for matrix elements exceeded in" " makea\n");
-							printf("nnza, nzmax = %d, %d\n", nnza, nz);
-							printf("iouter = %d\n", iouter);
-							exit(1);
-						}
-						acol[nnza] = jcol;
-						arow[nnza] = irow;
-						aelt[nnza] = v[ivelt1] * scale;
-					}
-				}
+/*--------------------------------------------------------------------
+c  res = x - A.z with the CSR matrix; returns ||res||^2
+c-------------------------------------------------------------------*/
+static double csr_residual(int colidx[], long rowstr[], double a[],
+	const double x[], const double z[], double res[])
+{
+	return partitioned_reduce(1, lastrow-firstrow+2, 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double sum_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			double d = 0.0;
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				d = d + a[k]*z[colidx[k]];
 			}
+			res[j] = x[j] - d;
+			sum_tbb += res[j]*res[j];
 		}
-		size = size * ratio;
-	}
+		return sum_tbb;
+	}, std::plus<double>() );
+}
 
-	/*---------------------------------------------------------------------
-	c       ... add the identity * rcond to the generated matrix to bound
-	c           the smallest eigenvalue from below by rcond
-	c---------------------------------------------------------------------*/
-	for (i = firstrow; i <= lastrow; i++) {
-		if (i >= firstcol && i <= lastcol) {
-			iouter = n + i;
-			nnza = nnza + 1;
-			if (nnza > nz) {
-				printf("Space for matrix elements exceeded in makea\n");
-				printf("nnza, nzmax = %d, %d\n", nnza, nz);
-				printf("iouter = %d\n", iouter);
-				exit(1);
-			}
-			acol[nnza] = i;
-			arow[nnza] = i;
-			aelt[nnza] = rcond - shift;
-		}
+/*--------------------------------------------------------------------
+c  Block CG: K chains of the benchmark run in lockstep over K-wide
+c  vectors, vec[j*K+c] holding row j of chain c.  Every product reads
+c  a row of the matrix once and applies it to the K vectors.  Dot
+c  products are fused into the sweeps that produce their operands,
+c  as with CG_FUSED
+c-------------------------------------------------------------------*/
+static block_sums_t block_sums_plus(block_sums_t s1, const block_sums_t& s2)
+{
+	for (int c = 0; c < CG_BLOCK_MAX; c++) {
+		s1.v1[c] += s2.v1[c];
+		s1.v2[c] += s2.v2[c];
 	}
-
-	/*---------------------------------------------------------------------
-	c       ... make the sparse matrix from list of elements with duplicates
-	c           (v and iv are used as  workspace)
-	c---------------------------------------------------------------------*/
-	sparse(a, colidx, rowstr, n, arow, acol, aelt, firstrow, lastrow, v, &(iv[0]), &(iv[n]), nnza);
+	return s1;
 }
 
-/*---------------------------------------------------
+/*--------------------------------------------------------------------
+c  dst = A.src for the K chains; returns dot.dst per chain in v1
+c-------------------------------------------------------------------*/
+template <int K>
+static block_sums_t block_spmm(const double src[], double dst[], const double dot[])
+{
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastrow-firstrow+2), block_sums_t(),
+		[&](const tbb::blocked_range<size_t>& r_tbb, block_sums_t sums_tbb) -> block_sums_t{
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			double sum[K];
+			for (int c = 0; c < K; c++) {
+				sum[c] = 0.0;
+			}
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				const double *s = &src[(size_t)colidx[k]*K];
+				for (int c = 0; c < K; c++) {
+					sum[c] = sum[c] + a[k]*s[c];
+				}
+			}
+			for (int c = 0; c < K; c++) {
+				dst[(size_t)j*K+c] = sum[c];
+				sums_tbb.v1[c] += dot[(size_t)j*K+c]*sum[c];
+			}
+		}
+		return sums_tbb;
+	}, block_sums_plus);
+}
+
+template <int K>
+static void block_conj_grad(double rnorm[])
+{
+	double rho[K], rho0[K], alpha[K], beta[K];
+	block_sums_t sums;
+	int cgit, cgitmax = 25;
+
+	/*--------------------------------------------------------------------
+	c  Initialize the CG algorithm and rho = r.r
+	c-------------------------------------------------------------------*/
+	sums = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, naa+2), block_sums_t(),
+		[&](const tbb::blocked_range<size_t>& r_tbb, block_sums_t sums_tbb) -> block_sums_t{
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (int c = 0; c < K; c++) {
+				size_t jc = (size_t)j*K+c;
+				zb[jc] = 0.0;
+				rb[jc] = xb[jc];
+				pb[jc] = rb[jc];
+				if (j <= lastcol-firstcol+1) {
+					sums_tbb.v1[c] += xb[jc]*xb[jc];
+				}
+			}
+		}
+		return sums_tbb;
+	}, block_sums_plus);
+	for (int c = 0; c < K; c++) {
+		rho[c] = sums.v1[c];
+	}
+
+	for (cgit = 1; cgit <= cgitmax; cgit++) {
+		/*--------------------------------------------------------------------
+		c  q = A.p and p.q
+		c-------------------------------------------------------------------*/
+		sums = block_spmm<K>(pb, qb, pb);
+		for (int c = 0; c < K; c++) {
+			rho0[c] = rho[c];
+			alpha[c] = rho0[c] / sums.v1[c];
+		}
+
+		/*--------------------------------------------------------------------
+		c  z = z + alpha*p, r = r - alpha*q and rho = r.r
+		c-------------------------------------------------------------------*/
+		sums = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), block_sums_t(),
+			[&](const tbb::blocked_range<size_t>& r_tbb, block_sums_t sums_tbb) -> block_sums_t{
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				for (int c = 0; c < K; c++) {
+					size_t jc = (size_t)j*K+c;
+					zb[jc] = zb[jc] + alpha[c]*pb[jc];
+					rb[jc] = rb[jc] - alpha[c]*qb[jc];
+					sums_tbb.v1[c] += rb[jc]*rb[jc];
+				}
+			}
+			return sums_tbb;
+		}, block_sums_plus);
+		for (int c = 0; c < K; c++) {
+			rho[c] = sums.v1[c];
+			beta[c] = rho[c] / rho0[c];
+		}
+
+		/*--------------------------------------------------------------------
+		c  p = r + beta*p
+		c-------------------------------------------------------------------*/
+		tbb::parallel_for(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				for (int c = 0; c < K; c++) {
+					size_t jc = (size_t)j*K+c;
+					pb[jc] = rb[jc] + beta[c]*pb[jc];
+				}
+			}
+		});
+	} /* end of do cgit=1,cgitmax */
+
+	/*---------------------------------------------------------------------
+	c  Compute residual norm explicitly:  ||r|| = ||x - A.z||
+	c---------------------------------------------------------------------*/
+	block_spmm<K>(zb, rb, zb);
+	sums = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), block_sums_t(),
+		[&](const tbb::blocked_range<size_t>& r_tbb, block_sums_t sums_tbb) -> block_sums_t{
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (int c = 0; c < K; c++) {
+				double d = xb[(size_t)j*K+c] - rb[(size_t)j*K+c];
+				sums_tbb.v1[c] += d*d;
+			}
+		}
+		return sums_tbb;
+	}, block_sums_plus);
+	for (int c = 0; c < K; c++) {
+		rnorm[c] = sqrt(sums.v1[c]);
+	}
+}
+
+/*--------------------------------------------------------------------
+c  One inverse power iteration of the K chains: block CG, then
+c  zeta = shift + 1/(x.z) and x = z/||z|| per chain
+c-------------------------------------------------------------------*/
+template <int K>
+static void block_power_step(double zeta[], double rnorm[])
+{
+	block_sums_t norms;
+	double norm_temp12[K];
+
+	block_conj_grad<K>(rnorm);
+
+	norms = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), block_sums_t(),
+		[&](const tbb::blocked_range<size_t>& r_tbb, block_sums_t sums_tbb) -> block_sums_t{
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (int c = 0; c < K; c++) {
+				size_t jc = (size_t)j*K+c;
+				sums_tbb.v1[c] += xb[jc]*zb[jc];
+				sums_tbb.v2[c] += zb[jc]*zb[jc];
+			}
+		}
+		return sums_tbb;
+	}, block_sums_plus);
+	for (int c = 0; c < K; c++) {
+		zeta[c] = SHIFT + 1.0 / norms.v1[c];
+		norm_temp12[c] = 1.0 / sqrt(norms.v2[c]);
+	}
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, lastcol-firstcol+2), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (int c = 0; c < K; c++) {
+				xb[(size_t)j*K+c] = norm_temp12[c]*zb[(size_t)j*K+c];
+			}
+		}
+	});
+}
+
+static void block_step(double zeta[], double rnorm[])
+{
+	switch (block_k) {
+	case 1: block_power_step<1>(zeta, rnorm); break;
+	case 2: block_power_step<2>(zeta, rnorm); break;
+	case 3: block_power_step<3>(zeta, rnorm); break;
+	case 4: block_power_step<4>(zeta, rnorm); break;
+	case 5: block_power_step<5>(zeta, rnorm); break;
+	case 6: block_power_step<6>(zeta, rnorm); break;
+	case 7: block_power_step<7>(zeta, rnorm); break;
+	case 8: block_power_step<8>(zeta, rnorm); break;
+	}
+}
+
+/*--------------------------------------------------------------------
+c  The benchmark with CG_BLOCK chains.  Chain c starts from
+c  (c+1)*(1, ..., 1); after the first normalization the chains only
+c  differ by rounding, so each one is checked against the class zeta
+c-------------------------------------------------------------------*/
+static int block_benchmark(char class_npb, double zeta_verify_value)
+{
+	double zeta[CG_BLOCK_MAX], rnorm[CG_BLOCK_MAX];
+	double t, mflops, epsilon = 1.0e-10;
+	boolean verified = (class_npb != 'U');
+	int it, c;
+
+	xb = new double[(size_t)(NA+3)*block_k];
+	zb = new double[(size_t)(NA+3)*block_k];
+	pb = new double[(size_t)(NA+3)*block_k];
+	qb = new double[(size_t)(NA+3)*block_k];
+	rb = new double[(size_t)(NA+3)*block_k];
+
+	/*--------------------------------------------------------------------
+	c  One untimed iteration, then reinit, start timing, to niter its
+	c-------------------------------------------------------------------*/
+	for (it = 0; it <= NITER; it++) {
+		if (it <= 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, (size_t)(NA+3)*block_k), [&](const tbb::blocked_range<size_t>& r_tbb){
+				for (size_t jc = r_tbb.begin(); jc != r_tbb.end(); jc++) {
+					xb[jc] = (double)(jc % block_k + 1);
+				}
+			});
+		}
+		if (it == 1) {
+			timer_clear( 1 );
+			timer_start( 1 );
+		}
+
+		block_step(zeta, rnorm);
+
+		if( it == 1 ) {
+			printf("   iteration           ||r||                 zeta (chain 1 of %d)\n", block_k);
+		}
+		if (it >= 1) {
+			printf("    %5d       %20.14e%20.13e\n", it, rnorm[0], zeta[0]);
+		}
+	}
+
+	timer_stop( 1 );
+	t = timer_read( 1 );
+
+	printf(" Benchmark completed\n");
+
+	if ( t != 0.0 ) {
+		/* NITER solves of cgitmax+1 = 26 products each */
+		printf(" SpMM matrix traffic: %.1f MB per product of %d vectors, %.2f GB/s\n",
+			spmv_matrix_bytes(SPMV_CSR) / 1.0e6, block_k, spmv_matrix_bytes(SPMV_CSR) * 26.0 * NITER / t / 1.0e9);
+	}
+
+	printf("   chain                 zeta               error\n");
+	for (c = 0; c < block_k; c++) {
+		printf("    %4d %20.12e%20.12e\n", c+1, zeta[c], zeta[c] - zeta_verify_value);
+		if (fabs(zeta[c] - zeta_verify_value) > epsilon) {
+			verified = FALSE;
+		}
+	}
+	if (class_npb != 'U') {
+		if (verified) {
+			printf(" VERIFICATION SUCCESSFUL\n");
+		} else {
+			printf(" VERIFICATION FAILED\n");
+			printf(" The correct zeta is %20.12e\n", zeta_verify_value);
+		}
+	} else {
+		printf(" Problem size unknown\n");
+		printf(" NO VERIFICATION PERFORMED\n");
+	}
+	if ( t != 0.0 ) {
+		mflops = (2.0*NITER*NA) * block_k
+		* (3.0+(NONZER*(NONZER+1)) + 25.0*(5.0+(NONZER*(NONZER+1))) + 3.0 )
+		/ t / 1000000.0;
+	} else {
+		mflops = 0.0;
+	}
+	c_print_results((char*)"CG", class_npb, NA, 0, 0, NITER, t, mflops, (char*)"          floating point",	verified, (char*)NPBVERSION, (char*)COMPILETIME, (char*)CS1, (char*)CS2, (char*)CS3, (char*)CS4, (char*)CS5, (char*)CS6, (char*)CS7);
+
+	delete[] xb;
+	delete[] zb;
+	delete[] pb;
+	delete[] qb;
+	delete[] rb;
+	return 0;
+}
+
+/*---------------------------------------------------------------------
+c       one chunk of the SELL-C-sigma product: acc[0:SELL_C-1] receives
+c       the SELL_C row sums of the chunk, in lane order
+c---------------------------------------------------------------------*/
+static void sell_chunk_generic(int c, const double src[], double acc[])
+{
+	const int *col = &sell_col[sell_cs[c]];
+	const double *val = &sell_val[sell_cs[c]];
+	int i, k;
+
+	for (i = 0; i < SELL_C; i++) {
+		acc[i] = 0.0;
+	}
+	for (k = 0; k < sell_cl[c]; k++) {
+		for (i = 0; i < SELL_C; i++) {
+			acc[i] = acc[i] + val[k*SELL_C+i]*src[col[k*SELL_C+i]];
+		}
+	}
+}
+
+/*---------------------------------------------------------------------
+c       the vector kernels multiply and add separately (no contraction
+c       into fma), so every row sum is rounded as in the CSR loop.  The
+c       gathers take an all-ones mask and a zeroed source
+c---------------------------------------------------------------------*/
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void sell_chunk_avx2(int c, const double src[], double acc[])
+{
+	const int *col = &sell_col[sell_cs[c]];
+	const double *val = &sell_val[sell_cs[c]];
+	const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+	__m256d lo = _mm256_setzero_pd();
+	__m256d hi = _mm256_setzero_pd();
+	int k;
+
+	for (k = 0; k < sell_cl[c]; k++) {
+		__m128i ilo = _mm_loadu_si128((const __m128i*)&col[k*SELL_C]);
+		__m128i ihi = _mm_loadu_si128((const __m128i*)&col[k*SELL_C+4]);
+		__m256d xlo = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), src, ilo, all, 8);
+		__m256d xhi = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), src, ihi, all, 8);
+		lo = _mm256_add_pd(lo, _mm256_mul_pd(_mm256_loadu_pd(&val[k*SELL_C]), xlo));
+		hi = _mm256_add_pd(hi, _mm256_mul_pd(_mm256_loadu_pd(&val[k*SELL_C+4]), xhi));
+	}
+	_mm256_storeu_pd(&acc[0], lo);
+	_mm256_storeu_pd(&acc[4], hi);
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void sell_chunk_avx512(int c, const double src[], double acc[])
+{
+	const int *col = &sell_col[sell_cs[c]];
+	const double *val = &sell_val[sell_cs[c]];
+	__m512d sum = _mm512_setzero_pd();
+	int k;
+
+	for (k = 0; k < sell_cl[c]; k++) {
+		__m256i idx = _mm256_loadu_si256((const __m256i*)&col[k*SELL_C]);
+		__m512d x = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xff, idx, src, 8);
+		sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(&val[k*SELL_C]), x));
+	}
+	_mm512_storeu_pd(acc, sum);
+}
+#endif
+
+/*---------------------------------------------------------------------
+c       dst = A.src over the SELL-C-sigma copy of A.  When dot is not
+c       NULL the product dot.dst is accumulated in the same sweep and
+c       returned, as the fused CSR kernel does for p.q
+c---------------------------------------------------------------------*/
+static double sell_spmv(const double src[], double dst[], const double dot[])
+{
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, sell_nchunks), 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double dot_tbb){
+		double acc[SELL_C];
+		for (int c = r_tbb.begin(); c != r_tbb.end(); c++) {
+			sell_chunk(c, src, acc);
+			for (int i = 0; i < SELL_C; i++) {
+				int row = sell_perm[c*SELL_C+i];
+				if (row != 0) {
+					dst[row] = acc[i];
+					if (dot != NULL) {
+						dot_tbb += dot[row]*acc[i];
+					}
+				}
+			}
+		}
+		return dot_tbb;
+	}, std::plus<double>() );
+}
+
+/*---------------------------------------------------------------------
+c       build the SELL-C-sigma copy of the CSR matrix (rowstr, colidx,
+c       a) and pick the widest chunk kernel the cpu supports.
+c       Padding slots repeat the last column of their row with a zero
+c       value, so every gather stays inside p and near the real ones
+c---------------------------------------------------------------------*/
+static void sell_build(int colidx[], long rowstr[], double a[], int nrows)
+{
+	int nslots, c;
+
+	sell_nchunks = (nrows + SELL_C - 1) / SELL_C;
+	nslots = sell_nchunks * SELL_C;
+
+	sell_perm = new int[nslots];
+	sell_cs = new long[sell_nchunks+1];
+	sell_cl = new int[sell_nchunks];
+
+	for (int i = 0; i < nslots; i++) {
+		sell_perm[i] = (i < nrows) ? i+1 : 0;
+	}
+
+	/*--------------------------------------------------------------------
+	c  sort rows by decreasing length inside each sigma window
+	c-------------------------------------------------------------------*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, (nrows + SELL_SIGMA - 1) / SELL_SIGMA), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int s = r_tbb.begin(); s != r_tbb.end(); s++) {
+			int beg = s * SELL_SIGMA;
+			int end = min(beg + SELL_SIGMA, nrows);
+			std::stable_sort(&sell_perm[beg], &sell_perm[end], [&](int r1, int r2){
+				return rowstr[r1+1]-rowstr[r1] > rowstr[r2+1]-rowstr[r2];
+			});
+		}
+	});
+
+	sell_cs[0] = 0;
+	for (c = 0; c < sell_nchunks; c++) {
+		int width = 0;
+		for (int i = 0; i < SELL_C; i++) {
+			int row = sell_perm[c*SELL_C+i];
+			if (row != 0) {
+				width = max(width, rowstr[row+1]-rowstr[row]);
+			}
+		}
+		sell_cl[c] = width;
+		sell_cs[c+1] = sell_cs[c] + width*SELL_C;
+	}
+
+	sell_col = new int[sell_cs[sell_nchunks]];
+	sell_val = new double[sell_cs[sell_nchunks]];
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, sell_nchunks), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int c = r_tbb.begin(); c != r_tbb.end(); c++) {
+			for (int i = 0; i < SELL_C; i++) {
+				int row = sell_perm[c*SELL_C+i];
+				int len = (row != 0) ? rowstr[row+1]-rowstr[row] : 0;
+				for (int k = 0; k < sell_cl[c]; k++) {
+					long slot = sell_cs[c] + k*SELL_C + i;
+					if (k < len) {
+						sell_col[slot] = colidx[rowstr[row]+k];
+						sell_val[slot] = a[rowstr[row]+k];
+					} else {
+						sell_col[slot] = (len > 0) ? colidx[rowstr[row]+len-1] : 1;
+						sell_val[slot] = 0.0;
+					}
+				}
+			}
+		}
+	});
+
+	sell_chunk = sell_chunk_generic;
+	sell_isa = "generic";
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		sell_chunk = sell_chunk_avx512;
+		sell_isa = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		sell_chunk = sell_chunk_avx2;
+		sell_isa = "avx2";
+	}
+#endif
+}
+
+/*---------------------------------------------------------------------
+c       largest distance of a nonzero from the diagonal
+c---------------------------------------------------------------------*/
+static int bandwidth(int colidx[], long rowstr[], int n)
+{
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(1, n+1), 0, [&](const tbb::blocked_range<size_t>& r_tbb, int bw_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				bw_tbb = max(bw_tbb, abs(colidx[k] - j));
+			}
+		}
+		return bw_tbb;
+	}, [](int bw1, int bw2){ return max(bw1, bw2); });
+}
+
+/*---------------------------------------------------------------------
+c       breadth-first search from root over the rows not yet in
+c       order[0:*count-1], appending the visited rows to order.  The
+c       neighbours of each row are appended by increasing degree.
+c       Returns the first row of the last level
+c---------------------------------------------------------------------*/
+static int rcm_bfs(int colidx[], long rowstr[], int root, boolean mark[],
+	int order[], int *count, int *nlevels)
+{
+	int head = *count;
+	int level_end, last_level;
+
+	mark[root] = TRUE;
+	order[(*count)++] = root;
+	level_end = *count;
+	last_level = head;
+	*nlevels = 1;
+
+	while (head < *count) {
+		int j = order[head++];
+		int first = *count;
+		for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+			int i = colidx[k];
+			if (mark[i] == FALSE) {
+				mark[i] = TRUE;
+				order[(*count)++] = i;
+			}
+		}
+		std::sort(&order[first], &order[*count], [&](int i1, int i2){
+			int d1 = rowstr[i1+1]-rowstr[i1];
+			int d2 = rowstr[i2+1]-rowstr[i2];
+			return (d1 != d2) ? d1 < d2 : i1 < i2;
+		});
+		if (head == level_end && head < *count) {
+			last_level = head;
+			level_end = *count;
+			(*nlevels)++;
+		}
+	}
+	return order[last_level];
+}
+
+/*---------------------------------------------------------------------
+c       renumber the rows and columns of the CSR matrix with reverse
+c       Cuthill-McKee.  Each connected component is started from a
+c       pseudo-peripheral row found by repeated searches from a row of
+c       minimum degree.  acol and aelt are used as workspace; the
+c       permutation is kept in rcm_perm / rcm_iperm
+c---------------------------------------------------------------------*/
+static void rcm_reorder(int colidx[], long rowstr[], double a[], int n,
+	int acol[], double aelt[])
+{
+	boolean *mark = new boolean[n+1];
+	int *order = new int[n];
+	long *newstr = new long[n+2];
+	int *bydeg = new int[n];
+	int count, next, i, j;
+
+	rcm_perm = new int[n+1];
+	rcm_iperm = new int[n+1];
+
+	for (i = 1; i <= n; i++) {
+		mark[i] = FALSE;
+		bydeg[i-1] = i;
+	}
+	std::stable_sort(bydeg, bydeg+n, [&](int i1, int i2){
+		return rowstr[i1+1]-rowstr[i1] < rowstr[i2+1]-rowstr[i2];
+	});
+
+	count = 0;
+	next = 0;
+	while (count < n) {
+		int root, nlevels, prev_levels, start;
+
+		while (mark[bydeg[next]] == TRUE) {
+			next++;
+		}
+		root = bydeg[next];
+
+		/*--------------------------------------------------------------------
+		c  move the root to the far end of the component while that
+		c  deepens the level structure
+		c-------------------------------------------------------------------*/
+		start = count;
+		prev_levels = 0;
+		for (;;) {
+			int far = rcm_bfs(colidx, rowstr, root, mark, order, &count, &nlevels);
+			for (i = start; i < count; i++) {
+				mark[order[i]] = FALSE;
+			}
+			count = start;
+			if (nlevels <= prev_levels) {
+				break;
+			}
+			prev_levels = nlevels;
+			root = far;
+		}
+		rcm_bfs(colidx, rowstr, root, mark, order, &count, &nlevels);
+	}
+
+	for (i = 0; i < n; i++) {
+		rcm_perm[n-i] = order[i];
+		rcm_iperm[order[i]] = n-i;
+	}
+
+	/*--------------------------------------------------------------------
+	c  gather the rows in the new order into acol / aelt and copy back
+	c-------------------------------------------------------------------*/
+	newstr[1] = rowstr[1];
+	for (j = 1; j <= n; j++) {
+		newstr[j+1] = newstr[j] + rowstr[rcm_perm[j]+1] - rowstr[rcm_perm[j]];
+	}
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, n+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			long kk = newstr[j];
+			for (long k = rowstr[rcm_perm[j]]; k < rowstr[rcm_perm[j]+1]; k++) {
+				acol[kk] = rcm_iperm[colidx[k]];
+				aelt[kk] = a[k];
+				kk++;
+			}
+		}
+	});
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, n+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			rowstr[j] = newstr[j];
+			for (long k = newstr[j]; k < newstr[j+1]; k++) {
+				colidx[k] = acol[k];
+				a[k] = aelt[k];
+			}
+		}
+	});
+	rowstr[n+1] = newstr[n+1];
+
+	delete[] mark;
+	delete[] order;
+	delete[] newstr;
+	delete[] bydeg;
+}
+
+/*---------------------------------------------------------------------
+c       dst = A.src over the delta-encoded copy of A, accumulating in
+c       double whatever the stored value type.  Returns dot.dst when
+c       dot is not NULL
+c---------------------------------------------------------------------*/
+template <class T>
+static double delta_spmv(const T val[], const double src[], double dst[], const double dot[])
+{
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(1, lastrow-firstrow+2), 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double dot_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			const int16_t *code = &delta_code[delta_ptr[j]];
+			int col = 0;
+			double sum = 0.0;
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				int dlt = *code++;
+				if (dlt == DELTA_ESCAPE) {
+					col = (uint16_t)code[0] | ((int)(uint16_t)code[1] << 16);
+					code += 2;
+				} else {
+					col += dlt;
+				}
+				sum = sum + val[k]*src[col];
+			}
+			dst[j] = sum;
+			if (dot != NULL) {
+				dot_tbb += dot[j]*sum;
+			}
+		}
+		return dot_tbb;
+	}, std::plus<double>() );
+}
+
+/*---------------------------------------------------------------------
+c       entries of the longest row, the size of the scratch used to
+c       sort one row
+c---------------------------------------------------------------------*/
+static long max_row_length(long rowstr[], int nrows)
+{
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(1, nrows+1), 0L, [&](const tbb::blocked_range<size_t>& r_tbb, long len_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			len_tbb = max(len_tbb, rowstr[j+1]-rowstr[j]);
+		}
+		return len_tbb;
+	}, [](long l1, long l2){ return max(l1, l2); } );
+}
+
+/*---------------------------------------------------------------------
+c       build the delta-encoded copy of the CSR matrix.  Values keep
+c       the CSR row ranges of rowstr, reordered with their columns;
+c       with single set they are stored as float, and the vectors of
+c       the refinement of conj_grad_refined are allocated
+c---------------------------------------------------------------------*/
+static void delta_build(int colidx[], long rowstr[], double a[], int nrows, boolean single)
+{
+	int *scol = new int[rowstr[nrows+1]];
+	long maxlen = max_row_length(rowstr, nrows);
+	int j;
+
+	delta_ptr = new long[nrows+2];
+	if (single) {
+		delta_valf = new float[rowstr[nrows+1]];
+		refine_x = new double[NA+2+1]();
+		refine_z = new double[NA+2+1]();
+	} else {
+		delta_val = new double[rowstr[nrows+1]];
+	}
+
+	/*--------------------------------------------------------------------
+	c  sort each row by column and count its codes
+	c-------------------------------------------------------------------*/
+	delta_escapes = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, nrows+1), 0, [&](const tbb::blocked_range<size_t>& r_tbb, int esc_tbb){
+		long *order = new long[maxlen];
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			int len = rowstr[j+1]-rowstr[j];
+			int prev = 0;
+			for (int k = 0; k < len; k++) {
+				order[k] = rowstr[j]+k;
+			}
+			std::sort(order, order+len, [&](long k1, long k2){
+				return colidx[k1] < colidx[k2];
+			});
+			delta_ptr[j+1] = len;
+			for (int k = 0; k < len; k++) {
+				long kk = rowstr[j]+k;
+				scol[kk] = colidx[order[k]];
+				if (single) {
+					delta_valf[kk] = (float)a[order[k]];
+				} else {
+					delta_val[kk] = a[order[k]];
+				}
+				if (scol[kk] - prev > INT16_MAX) {
+					delta_ptr[j+1] += 2;
+					esc_tbb++;
+				}
+				prev = scol[kk];
+			}
+		}
+		delete[] order;
+		return esc_tbb;
+	}, std::plus<int>() );
+
+	delta_ptr[1] = 0;
+	for (j = 1; j <= nrows; j++) {
+		delta_ptr[j+1] += delta_ptr[j];
+	}
+	delta_code = new int16_t[delta_ptr[nrows+1]];
+
+	/*--------------------------------------------------------------------
+	c  emit the codes
+	c-------------------------------------------------------------------*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, nrows+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			int16_t *code = &delta_code[delta_ptr[j]];
+			int prev = 0;
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				if (scol[k] - prev > INT16_MAX) {
+					*code++ = DELTA_ESCAPE;
+					*code++ = (int16_t)(scol[k] & 0xffff);
+					*code++ = (int16_t)(scol[k] >> 16);
+				} else {
+					*code++ = (int16_t)(scol[k] - prev);
+				}
+				prev = scol[k];
+			}
+		}
+	});
+
+	delete[] scol;
+}
+
+/*---------------------------------------------------------------------
+c       dst = A.src over the upper triangle of A.  Each block of rows
+c       multiplies its rows and adds their transposed part to the rows
+c       below the diagonal; rows of its own block are updated in dst,
+c       later rows in the block's own sym_buf.  The buffers are then
+c       added in block order and cleared, so the result does not depend
+c       on the scheduling.  Returns dot.dst when dot is not NULL
+c---------------------------------------------------------------------*/
+static double sym_spmv(const double src[], double dst[], const double dot[])
+{
+	int nrows = lastrow-firstrow+1;
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, sym_nblocks, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			double *buf = &sym_buf[(size_t)b*(nrows+1)];
+			for (int j = sym_first[b]; j < sym_first[b+1]; j++) {
+				dst[j] = 0.0;
+			}
+			for (int j = sym_first[b]; j < sym_first[b+1]; j++) {
+				double pj = src[j];
+				double sum = dst[j] + sym_diag[j]*pj;
+				long k;
+				for (k = sym_rowstr[j]; k < sym_mid[j]; k++) {
+					int col = sym_col[k];
+					sum = sum + sym_val[k]*src[col];
+					dst[col] = dst[col] + sym_val[k]*pj;
+				}
+				for (; k < sym_rowstr[j+1]; k++) {
+					int col = sym_col[k];
+					sum = sum + sym_val[k]*src[col];
+					buf[col] = buf[col] + sym_val[k]*pj;
+				}
+				dst[j] = sum;
+			}
+		}
+	});
+
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, sym_nblocks, 1), 0.0, [&](const tbb::blocked_range<size_t>& r_tbb, double dot_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			for (int j = sym_first[b]; j < sym_first[b+1]; j++) {
+				double sum = dst[j];
+				for (int bb = 0; bb < b; bb++) {
+					sum = sum + sym_buf[(size_t)bb*(nrows+1)+j];
+					sym_buf[(size_t)bb*(nrows+1)+j] = 0.0;
+				}
+				dst[j] = sum;
+				if (dot != NULL) {
+					dot_tbb += dot[j]*sum;
+				}
+			}
+		}
+		return dot_tbb;
+	}, std::plus<double>() );
+}
+
+/*---------------------------------------------------------------------
+c       build the symmetric copy of the CSR matrix: the diagonal and
+c       the entries above it, sorted by column.  Rows are split in
+c       num_workers blocks with about the same number of entries
+c---------------------------------------------------------------------*/
+static void sym_build(int colidx[], long rowstr[], double a[], int nrows)
+{
+	int j, b;
+	long nlower, maxlen = max_row_length(rowstr, nrows);
+
+	sym_rowstr = new long[nrows+2];
+	sym_mid = new long[nrows+1];
+	sym_diag = new double[nrows+1];
+
+	/*--------------------------------------------------------------------
+	c  count the entries above the diagonal of each row
+	c-------------------------------------------------------------------*/
+	nlower = tbb::parallel_reduce(tbb::blocked_range<size_t>(1, nrows+1), 0L, [&](const tbb::blocked_range<size_t>& r_tbb, long low_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			int len = 0;
+			sym_diag[j] = 0.0;
+			for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+				if (colidx[k] > j) {
+					len++;
+				} else if (colidx[k] == j) {
+					sym_diag[j] = a[k];
+				} else {
+					low_tbb++;
+				}
+			}
+			sym_rowstr[j+1] = len;
+		}
+		return low_tbb;
+	}, std::plus<long>() );
+
+	sym_rowstr[1] = 0;
+	for (j = 1; j <= nrows; j++) {
+		sym_rowstr[j+1] += sym_rowstr[j];
+	}
+	if (nlower != sym_rowstr[nrows+1]) {
+		printf(" Warning: %ld entries below and %ld above the diagonal, the matrix is not symmetric\n",
+			nlower, sym_rowstr[nrows+1]);
+	}
+	sym_col = new int[sym_rowstr[nrows+1]];
+	sym_val = new double[sym_rowstr[nrows+1]];
+
+	/*--------------------------------------------------------------------
+	c  split the rows, counting the diagonal as one entry
+	c-------------------------------------------------------------------*/
+	sym_nblocks = max(1, min(num_workers, nrows));
+	sym_first = new int[sym_nblocks+1];
+	sym_first[0] = 1;
+	j = 1;
+	for (b = 1; b < sym_nblocks; b++) {
+		double target = (double)b * (sym_rowstr[nrows+1] + nrows) / sym_nblocks;
+		while (j <= nrows && sym_rowstr[j] + j - 1 < target) {
+			j++;
+		}
+		sym_first[b] = max(j, sym_first[b-1]);
+	}
+	sym_first[sym_nblocks] = nrows+1;
+	sym_buf = new double[(size_t)sym_nblocks*(nrows+1)];
+
+	/*--------------------------------------------------------------------
+	c  copy and sort the upper entries; sym_mid[j] is the first one
+	c  whose column lies past the block of row j
+	c-------------------------------------------------------------------*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, sym_nblocks, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			long *order = new long[maxlen];
+			for (int j = 0; j <= nrows; j++) {
+				sym_buf[(size_t)b*(nrows+1)+j] = 0.0;
+			}
+			for (int j = sym_first[b]; j < sym_first[b+1]; j++) {
+				int len = 0;
+				for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+					if (colidx[k] > j) {
+						order[len++] = k;
+					}
+				}
+				std::sort(order, order+len, [&](long k1, long k2){
+					return colidx[k1] < colidx[k2];
+				});
+				sym_mid[j] = sym_rowstr[j];
+				for (int k = 0; k < len; k++) {
+					long kk = sym_rowstr[j]+k;
+					sym_col[kk] = colidx[order[k]];
+					sym_val[kk] = a[order[k]];
+					if (sym_col[kk] < sym_first[b+1]) {
+						sym_mid[j] = kk+1;
+					}
+				}
+			}
+			delete[] order;
+		}
+	});
+}
+
+/*---------------------------------------------------------------------
+c       dst = A.src over the storage selected with CG_SPMV other than
+c       the plain CSR one, which conj_grad runs inline
+c---------------------------------------------------------------------*/
+static double spmv(const double src[], double dst[], const double dot[])
+{
+	switch (spmv_format) {
+	case SPMV_SELL:
+		return sell_spmv(src, dst, dot);
+	case SPMV_DELTA:
+		return delta_spmv(delta_val, src, dst, dot);
+	case SPMV_DELTA_FLOAT:
+		return delta_spmv(delta_valf, src, dst, dot);
+	case SPMV_SYM:
+		return sym_spmv(src, dst, dot);
+	}
+	return 0.0;
+}
+
+/*---------------------------------------------------------------------
+c       bytes of matrix data (values, indices and row pointers) read
+c       by one product in the storage format
+c---------------------------------------------------------------------*/
+static double spmv_matrix_bytes(int format)
+{
+	double nrows = lastrow-firstrow+1;
+	double nnz = rowstr[lastrow-firstrow+2] - rowstr[1];
+
+	switch (format) {
+	case SPMV_SELL:
+		return (double)sell_cs[sell_nchunks] * (sizeof(double)+sizeof(int))
+			+ sell_nchunks * (sizeof(long) + (1.0+SELL_C) * sizeof(int));
+	case SPMV_DELTA:
+		return (double)delta_ptr[lastrow-firstrow+2] * sizeof(int16_t)
+			+ nnz * sizeof(double) + (nrows+1) * 2*sizeof(long);
+	case SPMV_DELTA_FLOAT:
+		return (double)delta_ptr[lastrow-firstrow+2] * sizeof(int16_t)
+			+ nnz * sizeof(float) + (nrows+1) * 2*sizeof(long);
+	case SPMV_SYM:
+		return (double)sym_rowstr[lastrow-firstrow+2] * (sizeof(double)+sizeof(int))
+			+ nrows * (sizeof(double)+2*sizeof(long));
+	}
+	return nnz * (sizeof(double)+sizeof(int)) + (nrows+1) * sizeof(long);
+}
+
+/*---------------------------------------------------------------------
+c       bytes of matrix data read by one solve: cgitmax+1 = 26
+c       products, or with delta-float 26 per solve of the float copy
+c       and the two CSR residuals of the refinement
+c---------------------------------------------------------------------*/
+static double solve_matrix_bytes()
+{
+	if (spmv_format == SPMV_DELTA_FLOAT) {
+		return 2 * 26.0 * spmv_matrix_bytes(SPMV_DELTA_FLOAT) + 2 * spmv_matrix_bytes(SPMV_CSR);
+	}
+	return 26.0 * spmv_matrix_bytes(spmv_format);
+}
+
+/*---------------------------------------------------------------------
+c       matrix cache: the CSR matrix made by makea is written once per
+c       NA/NONZER/RCOND/SHIFT and memory-mapped by later runs.
+c       The file is a matrix_cache_header_t followed by a[1:nnz],
+c       rowstr[1:nrows+1] and colidx[1:nnz]; the checksum covers the
+c       three arrays.  A file with another version, other parameters
+c       or a wrong checksum is stale and is regenerated
+c---------------------------------------------------------------------*/
+static uint64_t cache_checksum(const void *buf, size_t bytes, uint64_t h)
+{
+	const unsigned char *c = (const unsigned char *)buf;
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + 8 <= bytes; i += 8) {
+		memcpy(&word, c + i, 8);
+		h = (h ^ word) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	if (i < bytes) {
+		word = 0;
+		memcpy(&word, c + i, bytes - i);
+		h = (h ^ word) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+static uint64_t matrix_checksum(const double a[], const int colidx[], const long rowstr[], int nrows, long nnz)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = cache_checksum(&a[1], (size_t)nnz * sizeof(double), h);
+	h = cache_checksum(&rowstr[1], (size_t)(nrows+1) * sizeof(long), h);
+	h = cache_checksum(&colidx[1], (size_t)nnz * sizeof(int), h);
+	return h;
+}
+
+static void matrix_cache_fill(matrix_cache_header_t *hdr, int nrows, long nnz)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, MATRIX_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = MATRIX_CACHE_VERSION;
+	hdr->na = NA;
+	hdr->nonzer = NONZER;
+	hdr->nrows = nrows;
+	hdr->nnz = nnz;
+	hdr->rcond = RCOND;
+	hdr->shift = SHIFT;
+}
+
+static boolean matrix_cache_load(const char *path, double a[], int colidx[], long rowstr[], int nrows)
+{
+	matrix_cache_header_t hdr, want;
+	struct stat st;
+	const char *map;
+	size_t bytes;
+	int fd;
+	boolean ok;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return FALSE;
+	}
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr)) {
+		close(fd);
+		printf(" Matrix cache: %s is stale, regenerating\n", path);
+		return FALSE;
+	}
+	bytes = st.st_size;
+	map = (const char *)mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf(" Matrix cache: cannot map %s, regenerating\n", path);
+		return FALSE;
+	}
+	madvise((void *)map, bytes, MADV_SEQUENTIAL);
+
+	memcpy(&hdr, map, sizeof(hdr));
+	ok = (hdr.nnz >= 0 && hdr.nnz <= NZ);
+	if (ok) {
+		matrix_cache_fill(&want, nrows, hdr.nnz);
+		want.checksum = hdr.checksum;
+		ok = (memcmp(&hdr, &want, sizeof(hdr)) == 0
+			&& bytes == sizeof(hdr) + (size_t)hdr.nnz * (sizeof(double)+sizeof(int))
+				+ (size_t)(nrows+1) * sizeof(long));
+	}
+	if (ok) {
+		const char *src = map + sizeof(hdr);
+		memcpy(&a[1], src, (size_t)hdr.nnz * sizeof(double));
+		src += (size_t)hdr.nnz * sizeof(double);
+		memcpy(&rowstr[1], src, (size_t)(nrows+1) * sizeof(long));
+		src += (size_t)(nrows+1) * sizeof(long);
+		memcpy(&colidx[1], src, (size_t)hdr.nnz * sizeof(int));
+		ok = (matrix_checksum(a, colidx, rowstr, nrows, hdr.nnz) == hdr.checksum);
+	}
+	munmap((void *)map, bytes);
+
+	if (ok) {
+		printf(" Matrix cache: loaded %s\n", path);
+	} else {
+		printf(" Matrix cache: %s is stale, regenerating\n", path);
+	}
+	return ok;
+}
+
+static void matrix_cache_store(const char *path, const double a[], const int colidx[], const long rowstr[], int nrows)
+{
+	matrix_cache_header_t hdr;
+	char tmp[sizeof(matrix_cache_path)+16];
+	long nnz = rowstr[nrows+1] - rowstr[1];
+	FILE *fp;
+	boolean ok;
+
+	matrix_cache_fill(&hdr, nrows, nnz);
+	hdr.checksum = matrix_checksum(a, colidx, rowstr, nrows, nnz);
+
+	/* write a private file and rename it, so readers never see half of it */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		printf(" Matrix cache: cannot write %s\n", tmp);
+		return;
+	}
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(&a[1], sizeof(double), nnz, fp) == (size_t)nnz
+		&& fwrite(&rowstr[1], sizeof(long), nrows+1, fp) == (size_t)(nrows+1)
+		&& fwrite(&colidx[1], sizeof(int), nnz, fp) == (size_t)nnz;
+	ok = (fclose(fp) == 0) && ok;
+	if (ok && rename(tmp, path) == 0) {
+		printf(" Matrix cache: wrote %s\n", path);
+	} else {
+		remove(tmp);
+		printf(" Matrix cache: cannot write %s\n", path);
+	}
+}
+
+/*---------------------------------------------------------------------
+c       pin each TBB thread to the cpu of its index, so a part and the
+c       pages it first touched stay on the same NUMA node
+c---------------------------------------------------------------------*/
+class pinning_observer : public tbb::task_scheduler_observer {
+public:
+	pinning_observer() { observe(true); }
+	void on_scheduler_entry(bool) override {
+		cpu_set_t allowed, cpu;
+		int index = tbb::this_task_arena::current_thread_index(), n = 0;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || index < 0) {
+			return;
+		}
+		for (int c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &allowed) && n++ == index % CPU_COUNT(&allowed)) {
+				CPU_ZERO(&cpu);
+				CPU_SET(c, &cpu);
+				sched_setaffinity(0, sizeof(cpu), &cpu);
+				return;
+			}
+		}
+	}
+};
+
+/*---------------------------------------------------------------------
+c       split the rows in num_workers parts of about the same number
+c       of nonzeros (plus one per row, for the vector work), then copy
+c       the matrix and clear the vectors part by part, so that each
+c       page is first touched by the thread that will use it.  The
+c       copy replaces colidx, rowstr and a, which are freed.
+c       The last part also owns the padding entries up to NA+2
+c---------------------------------------------------------------------*/
+static void partition_build(int *&colidx, long *&rowstr, double *&a, int nrows, boolean copy_matrix)
+{
+	int part, j;
+	long nnz = rowstr[nrows+1] - rowstr[1];
+	int minrows = nrows, maxrows = 0;
+	long minnz = nnz, maxnz = 0;
+
+	static pinning_observer pinning;
+
+	part_count = max(1, min(num_workers, nrows));
+	part_first = new int[part_count+1];
+	part_first[0] = 1;
+	j = 1;
+	for (part = 1; part < part_count; part++) {
+		double target = (double)part * (nnz + nrows) / part_count;
+		while (j <= nrows && (rowstr[j] - rowstr[1]) + (j - 1) < target) {
+			j++;
+		}
+		part_first[part] = max(j, part_first[part-1]);
+	}
+	part_first[part_count] = NA+3;
+
+	for (part = 0; part < part_count; part++) {
+		int rows = min(part_first[part+1], nrows+1) - part_first[part];
+		long pnz = rowstr[min(part_first[part+1], nrows+1)] - rowstr[part_first[part]];
+		minrows = min(minrows, rows);
+		maxrows = max(maxrows, rows);
+		minnz = min(minnz, pnz);
+		maxnz = max(maxnz, pnz);
+	}
+	printf(" Row partition: %d nnz-balanced parts, %d..%d rows, %ld..%ld nonzeros each\n",
+		part_count, minrows, maxrows, minnz, maxnz);
+
+	partitioned_for(1, NA+3, [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			x[j] = 0.0;
+			z[j] = 0.0;
+			p[j] = 0.0;
+			q[j] = 0.0;
+			r[j] = 0.0;
+			w[j] = 0.0;
+		}
+	});
+
+	if (copy_matrix) {
+		long *part_rowstr = new long[nrows+2];
+		int *part_colidx = new int[nnz+1];
+		double *part_a = new double[nnz+1];
+		part_rowstr[nrows+1] = rowstr[nrows+1];
+		partitioned_for(1, nrows+1, [&](const tbb::blocked_range<size_t>& r_tbb){
+			for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+				part_rowstr[j] = rowstr[j];
+				for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+					part_colidx[k] = colidx[k];
+					part_a[k] = a[k];
+				}
+			}
+		});
+		delete[] colidx;
+		delete[] rowstr;
+		delete[] a;
+		colidx = part_colidx;
+		rowstr = part_rowstr;
+		a = part_a;
+	}
+}
+
+/*---------------------------------------------------------------------
+c       generate the test problem for benchmark 6
+c       makea generates a sparse matrix with a
+c       prescribed sparsity distribution
+c
+c       parameter    type        usage
+c
+c       input
+c
+c       n            i           number of cols/rows of matrix
+c       nz           i           nonzeros as declared array size
+c       rcond        r*8         condition number
+c       shift        r*8         main diagonal shift
+c
+c       output
+c
+c       a            r*8         array for nonzeros
+c       colidx       i           col indices
+c       rowstr       i           row pointers
+c
+c       workspace
+c
+c       iv, arow, acol i
+c       v, aelt        r*8
+c---------------------------------------------------------------------*/
+static void makea(
+	int n,
+	long nz,
+	double a[],		/* a[1:nz] */
+	int colidx[],	/* colidx[1:nz] */
+	long rowstr[],	/* rowstr[1:n+1] */
+	int nonzer,
+	int firstrow,
+	int lastrow,
+	int firstcol,
+	int lastcol,
+	double rcond,
+	int arow[],		/* arow[1:nz] */
+	int acol[],		/* acol[1:nz] */
+	double aelt[],	/* aelt[1:nz] */
+	double v[],		/* v[1:n+1] */
+	int iv[],		/* iv[1:2*n+1] */
+	double shift )
+{
+	int i, iouter, ndiag;
+	long nnza;
+
+	/*--------------------------------------------------------------------
+	c      nonzer is approximately  (int(sqrt(nnza /n)));
+	c-------------------------------------------------------------------*/
+
+	double size, ratio;
+	int stride = nonzer+2;
+	int *nzv = new int[n+1];					/* nzv[1:n]: nonzeros of each outer vector */
+	long *offset = new long[n+2];				/* offset[1:n+1]: first triple of each outer product, less one */
+	double *vecv = new double[(size_t)n*stride];	/* values of the n outer vectors */
+	int *veci = new int[(size_t)n*stride];		/* positions of the n outer vectors */
+
+	size = 1.0;
+	ratio = pow(rcond, (1.0 / (double)n));
+
+	/*---------------------------------------------------------------------
+	c  Draw the n sparse vectors.  The number of draws a vector takes
+	c  depends on the rejections in sprnvc, so the random stream cannot
+	c  be split ahead of time; this pass is cheap next to the products.
+	c  v keeps the scale of each product and iv is the sprnvc workspace
+	c---------------------------------------------------------------------*/
+	for (i = 1; i <= n; i++) {
+		iv[n+i] = 0;
+	}
+	for (iouter = 1; iouter <= n; iouter++) {
+		double *vo = &vecv[(size_t)(iouter-1)*stride];
+		int *io = &veci[(size_t)(iouter-1)*stride];
+		nzv[iouter] = nonzer;
+		sprnvc(n, nzv[iouter], vo, io, &(iv[0]), &(iv[n]));
+		vecset(n, vo, io, &nzv[iouter], iouter, 0.5);
+		v[iouter] = size;
+		size = size * ratio;
+	}
+
+	/*---------------------------------------------------------------------
+	c  Count the triples of each outer product and place them
+	c---------------------------------------------------------------------*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, n+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int iouter = r_tbb.begin(); iouter != r_tbb.end(); iouter++) {
+			int *io = &veci[(size_t)(iouter-1)*stride];
+			int ncol = 0, nrow = 0;
+			for (int ivelt = 1; ivelt <= nzv[iouter]; ivelt++) {
+				if (io[ivelt] >= firstcol && io[ivelt] <= lastcol) ncol++;
+				if (io[ivelt] >= firstrow && io[ivelt] <= lastrow) nrow++;
+			}
+			offset[iouter+1] = (long)ncol*nrow;
+		}
+	});
+	offset[1] = 0;
+	tbb::parallel_scan(tbb::blocked_range<size_t>(2, n+2), 0L,
+		[&](const tbb::blocked_range<size_t>& r_tbb, long sum, bool is_final) -> long {
+		for (int i = r_tbb.begin(); i != r_tbb.end(); i++) {
+			sum += offset[i];
+			if (is_final) offset[i] = sum;
+		}
+		return sum;
+	}, std::plus<long>() );
+
+	ndiag = max(0, min(lastrow, lastcol) - max(firstrow, firstcol) + 1);
+	nnza = offset[n+1] + ndiag;
+	if (nnza > nz) {
+		for (iouter = 1; iouter <= n && offset[iouter+1] <= nz; iouter++);
+		if (iouter > n) iouter = (int)(n + max(firstrow, firstcol) + nz - offset[n+1]);
+		printf("Space for matrix elements exceeded in" " makea\n");
+		printf("nnza, nzmax = %ld, %ld\n", nnza, nz);
+		printf("iouter = %d\n", iouter);
+		exit(1);
+	}
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, n+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int iouter = r_tbb.begin(); iouter != r_tbb.end(); iouter++) {
+			double *vo = &vecv[(size_t)(iouter-1)*stride];
+			int *io = &veci[(size_t)(iouter-1)*stride];
+			long nza = offset[iouter];
+			for (int ivelt = 1; ivelt <= nzv[iouter]; ivelt++) {
+				int jcol = io[ivelt];
+				if (jcol >= firstcol && jcol <= lastcol) {
+					double scale = v[iouter] * vo[ivelt];
+					for (int ivelt1 = 1; ivelt1 <= nzv[iouter]; ivelt1++) {
+						int irow = io[ivelt1];
+						if (irow >= firstrow && irow <= lastrow) {
+							nza = nza + 1;
+							acol[nza] = jcol;
+							arow[nza] = irow;
+							aelt[nza] = vo[ivelt1] * scale;
+						}
+					}
+				}
+			}
+		}
+	});
+
+	/*---------------------------------------------------------------------
+	c       ... add the identity * rcond to the generated matrix to bound
+	c           the smallest eigenvalue from below by rcond
+	c---------------------------------------------------------------------*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, ndiag+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int i = r_tbb.begin(); i != r_tbb.end(); i++) {
+			long nza = offset[n+1] + i;
+			acol[nza] = max(firstrow, firstcol) + i - 1;
+			arow[nza] = max(firstrow, firstcol) + i - 1;
+			aelt[nza] = rcond - shift;
+		}
+	});
+
+	delete[] nzv;
+	delete[] offset;
+	delete[] vecv;
+	delete[] veci;
+
+	/*---------------------------------------------------------------------
+	c       ... make the sparse matrix from list of elements with duplicates
+	c---------------------------------------------------------------------*/
+	sparse(a, colidx, rowstr, n, arow, acol, aelt, firstrow, lastrow, nnza);
+}
+
+/*---------------------------------------------------
 c       generate a sparse matrix from a list of
 c       [col, row, element] tri
 c---------------------------------------------------*/
 static void sparse(
 	double a[],		/* a[1:*] */
 	int colidx[],	/* colidx[1:*] */
-	int rowstr[],	/* rowstr[1:*] */
+	long rowstr[],	/* rowstr[1:*] */
 	int n,
 	int arow[],		/* arow[1:*] */
 	int acol[],		/* acol[1:*] */
 	double aelt[],	/* aelt[1:*] */
 	int firstrow,
 	int lastrow,
-	double x[],		/* x[1:n] */
-	boolean mark[],	/* mark[1:n] */
-	int nzloc[],	/* nzloc[1:n] */
-	int nnza)
+	long nnza)
 /*---------------------------------------------------------------------
 c       rows range from firstrow to lastrow
 c       the rowstr pointers are defined for nrows = lastrow-firstrow+1 values
+c
+c       The triples are split in nblocks contiguous blocks.  Each block
+c       counts its own row lengths, so that after the scan every block
+c       knows where its part of every row starts and the bucket sort
+c       keeps the order of the serial one.  The result is identical to
+c       the serial sparse
 c---------------------------------------------------------------------*/
 {
-	int nrows;
-	int i, j, jajp1, nza, k, nzrow;
-	double xi;
+	int nrows = lastrow - firstrow + 1;
+	int nblocks = (int)max(1L, min((long)num_workers, nnza));
+	long bsize = (nnza + nblocks - 1) / nblocks;
+	int *count = new int[(size_t)nblocks*(nrows+1)];	/* count[b*(nrows+1)+j] */
+	long *nzrow = new long[nrows+2];
 
 	/*--------------------------------------------------------------------
-	c    how many rows of result
+	c     ...count the number of triples in each row, per block
 	c-------------------------------------------------------------------*/
-	nrows = lastrow - firstrow + 1;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, nblocks), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			int *cnt = &count[(size_t)b*(nrows+1)];
+			for (int j = 1; j <= nrows; j++) {
+				cnt[j] = 0;
+			}
+			for (long nza = b*bsize+1; nza <= min((b+1)*bsize, nnza); nza++) {
+				cnt[arow[nza] - firstrow + 1]++;
+			}
+		}
+	});
 
-	/*--------------------------------------------------------------------
-	c     ...count the number of triples in each row
-	c-------------------------------------------------------------------*/
-	for (j = 1; j <= n; j++) {
-		rowstr[j] = 0;
-		mark[j] = FALSE;
-	}
-	rowstr[n+1] = 0;
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, nrows+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			int len = 0;
+			for (int b = 0; b < nblocks; b++) {
+				int c = count[(size_t)b*(nrows+1)+j];
+				count[(size_t)b*(nrows+1)+j] = len;
+				len += c;
+			}
+			nzrow[j+1] = len;
+		}
+	});
 
-	for (nza = 1; nza <= nnza; nza++) {
-		j = (arow[nza] - firstrow + 1) + 1;
-		rowstr[j] = rowstr[j] + 1;
-	}
 	rowstr[1] = 1;
-	for (j = 2; j <= nrows+1; j++) {
-		rowstr[j] = rowstr[j] + rowstr[j-1];
-	}
+	tbb::parallel_scan(tbb::blocked_range<size_t>(2, nrows+2), 0L,
+		[&](const tbb::blocked_range<size_t>& r_tbb, long sum, bool is_final) -> long {
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			sum += nzrow[j];
+			if (is_final) rowstr[j] = sum + 1;
+		}
+		return sum;
+	}, std::plus<long>() );
 
 	/*---------------------------------------------------------------------
 	c     ... rowstr(j) now is the location of the first nonzero
@@ -714,65 +2484,111 @@ c---------------------------------------------------------------------*/
 	/*--------------------------------------------------------------------
 	c     ... do a bucket sort of the triples on the row index
 	c-------------------------------------------------------------------*/
-	for (nza = 1; nza <= nnza; nza++) {
-		j = arow[nza] - firstrow + 1;
-		k = rowstr[j];
-		a[k] = aelt[nza];
-		colidx[k] = acol[nza];
-		rowstr[j] = rowstr[j] + 1;
-	}
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, nblocks), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			int *cnt = &count[(size_t)b*(nrows+1)];
+			for (long nza = b*bsize+1; nza <= min((b+1)*bsize, nnza); nza++) {
+				int j = arow[nza] - firstrow + 1;
+				long k = rowstr[j] + cnt[j]++;
+				a[k] = aelt[nza];
+				colidx[k] = acol[nza];
+			}
+		}
+	});
+
+	delete[] count;
 
 	/*--------------------------------------------------------------------
-	c       ... rowstr(j) now points to the first element of row j+1
+	c       ... generate the actual output rows by adding elements.
+	c       Each block of rows has its own x, mark and nzloc, and
+	c       merges its rows into the front of their own range;
+	c       nzrow[j+1] gets the new length of row j
 	c-------------------------------------------------------------------*/
-	for (j = nrows; j >= 1; j--) {
-		rowstr[j+1] = rowstr[j];
-	}
-	rowstr[1] = 1;
+	int rblock = (nrows + nblocks - 1) / nblocks;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, nblocks), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int b = r_tbb.begin(); b != r_tbb.end(); b++) {
+			double *x = new double[n+1];
+			boolean *mark = new boolean[n+1];
+			int *nzloc = new int[n+1];
+			for (int i = 1; i <= n; i++) {
+				x[i] = 0.0;
+				mark[i] = FALSE;
+			}
+			for (int j = b*rblock+1; j <= min((b+1)*rblock, nrows); j++) {
+				int nzr = 0;
+				long nza = rowstr[j] - 1;
+
+				/*--------------------------------------------------------------------
+				c          ...loop over the jth row of a
+				c-------------------------------------------------------------------*/
+				for (long k = rowstr[j]; k < rowstr[j+1]; k++) {
+					int i = colidx[k];
+					x[i] = x[i] + a[k];
+					if ( mark[i] == FALSE && x[i] != 0.0) {
+						mark[i] = TRUE;
+						nzr = nzr + 1;
+						nzloc[nzr] = i;
+					}
+				}
+
+				/*--------------------------------------------------------------------
+				c          ... extract the nonzeros of this row
+				c-------------------------------------------------------------------*/
+				for (int k = 1; k <= nzr; k++) {
+					int i = nzloc[k];
+					double xi = x[i];
+					mark[i] = FALSE;
+					x[i] = 0.0;
+					if (xi != 0.0) {
+						nza = nza + 1;
+						a[nza] = xi;
+						colidx[nza] = i;
+					}
+				}
+				nzrow[j+1] = nza - rowstr[j] + 1;
+			}
+			delete[] x;
+			delete[] mark;
+			delete[] nzloc;
+		}
+	});
 
 	/*--------------------------------------------------------------------
-	c       ... generate the actual output rows by adding elements
+	c       ... compact the merged rows through acol and aelt
 	c-------------------------------------------------------------------*/
-	nza = 0;
-	for (i = 1; i <= n; i++) {
-		x[i] = 0.0;
-		mark[i] = FALSE;
-	}
-
-	jajp1 = rowstr[1];
-	for (j = 1; j <= nrows; j++) {
-		nzrow = 0;
+	tbb::parallel_scan(tbb::blocked_range<size_t>(2, nrows+2), 0L,
+		[&](const tbb::blocked_range<size_t>& r_tbb, long sum, bool is_final) -> long {
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			sum += nzrow[j];
+			if (is_final) nzrow[j] = sum + 1;
+		}
+		return sum;
+	}, std::plus<long>() );
+	nzrow[1] = 1;
 
-		/*--------------------------------------------------------------------
-		c          ...loop over the jth row of a
-		c-------------------------------------------------------------------*/
-		for (k = jajp1; k < rowstr[j+1]; k++) {
-			i = colidx[k];
-			x[i] = x[i] + a[k];
-			if ( mark[i] == FALSE && x[i] != 0.0) {
-				mark[i] = TRUE;
-				nzrow = nzrow + 1;
-				nzloc[nzrow] = i;
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, nrows+1), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			for (int m = 0; m < nzrow[j+1] - nzrow[j]; m++) {
+				acol[nzrow[j]+m] = colidx[rowstr[j]+m];
+				aelt[nzrow[j]+m] = a[rowstr[j]+m];
 			}
 		}
+	});
 
-		/*--------------------------------------------------------------------
-		c          ... extract the nonzeros of this row
-		c-------------------------------------------------------------------*/
-		for (k = 1; k <= nzrow; k++) {
-			i = nzloc[k];
-			mark[i] = FALSE;
-			xi = x[i];
-			x[i] = 0.0;
-			if (xi != 0.0) {
-				nza = nza + 1;
-				a[nza] = xi;
-				colidx[nza] = i;
-			}
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, nzrow[nrows+1]), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (long k = r_tbb.begin(); k != r_tbb.end(); k++) {
+			colidx[k] = acol[k];
+			a[k] = aelt[k];
 		}
-		jajp1 = rowstr[j+1];
-		rowstr[j+1] = nza + rowstr[1];
-	}
+	});
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(1, nrows+2), [&](const tbb::blocked_range<size_t>& r_tbb){
+		for (int j = r_tbb.begin(); j != r_tbb.end(); j++) {
+			rowstr[j] = nzrow[j];
+		}
+	});
+
+	delete[] nzrow;
 }
 
 /*---------------------------------------------------------------------
@@ -14,9 +14,26 @@
 --------------------------------------------------------------------*/
 
 #include "npbparams.hpp"
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_scan.h>
+#include <tbb/blocked_range.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_init.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
 #include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 /*****************************************************************/
@@ -116,6 +133,7 @@
 
 #define  MAX_ITERATIONS      10
 #define  TEST_ARRAY_SIZE     5
+#define  VERIFY_BLOCK        (1 << 16)
 
 
 /*************************************/
@@ -149,11 +167,67 @@ INT_TYPE key_array[SIZE_OF_BUFFERS],
          partial_verify_vals[TEST_ARRAY_SIZE],
          **key_buff1_aptr = NULL;
 
+/*  The keys being ranked: key_array, or the mapped key file of the  */
+/*  streaming mode                                                   */
+INT_TYPE *keys = key_array;
+
 #ifdef USE_BUCKETS
-INT_TYPE **bucket_size,
-         bucket_ptrs[NUM_BUCKETS];
+INT_TYPE **bucket_size, **bucket_ptrs2,
+         *bucket_ptrs;
+
+/*  The bucket count is chosen at run time (IS_BUCKETS); the     */
+/*  NUM_BUCKETS_LOG_2 of the class is the default                */
+int      num_buckets_log_2;
+INT_TYPE num_buckets;
 #endif
 
+/*  The keys are split in num_workers contiguous blocks; block myid  */
+/*  plays the part of processor myid of the original code            */
+int num_workers;
+
+/*  Optional LSD radix sort engine (IS_RANK=radix): the keys are      */
+/*  sorted digit by digit, radix_bits bits per pass, and the ranks    */
+/*  are read off the sorted array.  radix_bits is 0 when it is off    */
+#define  WC_LINE_BYTES       64
+#define  WC_KEYS             (WC_LINE_BYTES/(int)sizeof(INT_TYPE))
+int      radix_bits;
+INT_TYPE *radix_buff,                  /* second buffer of the passes */
+         *radix_sorted,                /* sorted keys of the last rank */
+         **radix_count,                /* radix_count[myid][digit] */
+         **radix_start,                /* first slot of block myid in each digit */
+         **radix_wc,                   /* a cache line of keys per digit and block */
+         *radix_total;
+
+/*  Key distributions (IS_KEYS): the NPB keys, the only ones the      */
+/*  partial verification knows, or a skewed set that is checked by    */
+/*  full_verify alone.  IS_KEYS=all runs rank() over each in turn     */
+#define  KEYS_NPB            0
+#define  KEYS_ALL            (-1)
+#define  NUM_KEY_DISTS       7
+const char *key_dist_name[NUM_KEY_DISTS] =
+    {"npb", "uniform", "zipf", "sorted", "reverse", "few", "equal"};
+int      key_dist;
+
+/*  Streaming mode (IS_STREAM=dir): the keys live in a file of dir,   */
+/*  mapped at keys, and rank() reads them STREAM_CHUNK at a time.     */
+/*  Every chunk is sorted by bucket and written out as one run of a   */
+/*  second file, stream_ends[c*num_buckets+i] being the end of bucket */
+/*  i in run c; then each bucket is ranked in memory from its part of */
+/*  every run, read STREAM_BUFF keys at a time.  Only key_buff1 and   */
+/*  the buffers stay in memory; key_buff2 is not used                 */
+#define  STREAM_CHUNK        (1 << 22)
+#define  STREAM_BUFF         (1 << 16)
+const char *stream_dir;
+int      stream_fd;                    /* the run file */
+INT_TYPE *stream_chunk,                /* a chunk sorted by bucket */
+         *stream_ends,
+         **stream_buff;                /* stream_buff[thread] */
+
+/*  Time each thread spends in the parallel loops of rank(), a cache  */
+/*  line apart; only kept by the skew benchmark (thread_busy != NULL) */
+#define  BUSY_STRIDE         8
+double   *thread_busy;
+
 
 /**********************/
 /* Partial verif info */
@@ -198,6 +272,9 @@ D_test_rank_array[TEST_ARRAY_SIZE] =
 double  randlc( double *X, double *A );
 
 void full_verify( void );
+void skew_benchmark( void );
+int  buckets_log_2( const char *setting );
+INT_TYPE *radix_sort( INT_TYPE *src );
 
 /*void c_print_results( char   *name,
                       char   class,
@@ -221,6 +298,7 @@ void c_print_results( char   *name, char   class_npb, int    n1, int n2, int n3,
                       double mops, char   *optype, int    passed_verification, char   *npbversion, char   *compiletime, char   *cc,
                       char   *clink, char   *c_lib, char   *c_inc, char   *cflags, char   *clinkflags, char   *rand);
 
+double  elapsed_time( void );
 void    timer_clear( int n );
 void    timer_start( int n );
 void    timer_stop( int n );
@@ -383,38 +461,199 @@ double   find_my_seed( int kn,        /* my processor rank, 0<=kn<=num procs */
 /*************      C  R  E  A  T  E  _  S  E  Q      ************/
 /*****************************************************************/
 
-void    create_seq( double seed, double a )
+/*
+ * The key generators fill keys[k1:k2) from the random number
+ * seed s of that block.  gen_npb is the NPB sum of four uniforms, a
+ * near-Gaussian around MAX_KEY/2; the others are the test sets of
+ * IS_KEYS.  Zipf keys are drawn by inverting the continuous 1/x
+ * density over [1, MAX_KEY+1), so key r has a share close to
+ * 1/((r+1.5) ln(MAX_KEY+1)) and key 0 alone gets about 1/(1.5 ln MAX_KEY)
+ */
+typedef void (*key_gen_t)( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double s, double a );
+
+void    gen_npb( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double s, double a )
 {
-    double x, s;
+    double x;
+    INT_TYPE i, k = MAX_KEY/4;
+
+    for (i=k1; i<k2; i++) {
+        x = randlc(&s, &a);
+        x += randlc(&s, &a);
+        x += randlc(&s, &a);
+        x += randlc(&s, &a);
+
+        keys[i] = k*x;
+    }
+}
+
+void    gen_uniform( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double s, double a )
+{
+    INT_TYPE i;
+
+    for (i=k1; i<k2; i++)
+        keys[i] = MAX_KEY*randlc(&s, &a);
+}
+
+void    gen_zipf( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double s, double a )
+{
+    double l = log(MAX_KEY + 1.0);
     INT_TYPE i, k;
 
-    INT_TYPE k1, k2;
-    double an = a;
+    for (i=k1; i<k2; i++) {
+        k = (INT_TYPE)exp(l*randlc(&s, &a)) - 1;
+        keys[i] = (k < MAX_KEY)? k : MAX_KEY-1;
+    }
+}
+
+void    gen_sorted( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double, double )
+{
+    INT_TYPE i;
+
+    for (i=k1; i<k2; i++)
+        keys[i] = (INT_TYPE)((double)i * MAX_KEY / NUM_KEYS);
+}
+
+void    gen_reverse( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double, double )
+{
+    INT_TYPE i;
+
+    for (i=k1; i<k2; i++)
+        keys[i] = MAX_KEY - 1 - (INT_TYPE)((double)i * MAX_KEY / NUM_KEYS);
+}
+
+/*  16 distinct keys, spread over the range */
+void    gen_few( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double s, double a )
+{
+    INT_TYPE i;
+
+    for (i=k1; i<k2; i++)
+        keys[i] = (INT_TYPE)(16*randlc(&s, &a)) * (MAX_KEY/16) + MAX_KEY/32;
+}
+
+void    gen_equal( INT_TYPE *keys, INT_TYPE k1, INT_TYPE k2, double, double )
+{
+    INT_TYPE i;
+
+    for (i=k1; i<k2; i++)
+        keys[i] = MAX_KEY/2;
+}
+
+key_gen_t key_gen[NUM_KEY_DISTS] =
+    {gen_npb, gen_uniform, gen_zipf, gen_sorted, gen_reverse, gen_few, gen_equal};
+
+void    create_seq( double seed, double a )
+{
     int myid, num_procs;
     INT_TYPE mq;
+    double *seeds;
 
-    myid = 0;
-    num_procs = 1;
-
+    num_procs = num_workers;
     mq = (NUM_KEYS + num_procs - 1) / num_procs;
-    k1 = mq * myid;
-    k2 = k1 + mq;
-    if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
 
+    /*  The seeds are found one after the other, so that randlc sets up  */
+    /*  its constants before the blocks run                              */
+    seeds = new double[num_procs];
     KS = 0;
-    s = find_my_seed( myid, num_procs, (long)4*NUM_KEYS, seed, an );
+    for (myid = 0; myid < num_procs; myid++)
+        seeds[myid] = find_my_seed( myid, num_procs, (long)4*NUM_KEYS, seed, a );
 
-    k = MAX_KEY/4;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+        for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+            INT_TYPE k1, k2;
 
-    for (i=k1; i<k2; i++) {
-        x = randlc(&s, &an);
-        x += randlc(&s, &an);
-        x += randlc(&s, &an);
-        x += randlc(&s, &an);
+            k1 = mq * myid;
+            k2 = k1 + mq;
+            if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
 
-        key_array[i] = k*x;
+            key_gen[key_dist]( keys, k1, k2, seeds[myid], a );
+        }
+    });
+
+    delete[] seeds;
+}
+
+
+
+#ifdef USE_BUCKETS
+/*****************************************************************/
+/*************     B  U  C  K  E  T     C  O  U  N  T     ********/
+/*****************************************************************/
+
+/*
+ * Returns the size in bytes of the data or unified cache of the given
+ * level of cpu0, as sysfs reports it, or 0 if it is not found.
+ */
+long cache_size( int level )
+{
+    char path[128], type[32], unit;
+    int  index, lvl;
+    long size;
+    FILE *fp;
+
+    for (index = 0; index < 16; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if ((fp = fopen(path, "r")) == NULL) break;
+        lvl = 0;
+        if (fscanf(fp, "%d", &lvl) != 1) lvl = 0;
+        fclose(fp);
+        if (lvl != level) continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if ((fp = fopen(path, "r")) == NULL) continue;
+        if (fscanf(fp, "%31s", type) != 1) type[0] = '\0';
+        fclose(fp);
+        if (strcmp(type, "Instruction") == 0) continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if ((fp = fopen(path, "r")) == NULL) continue;
+        unit = ' ';
+        if (fscanf(fp, "%ld%c", &size, &unit) < 1) size = 0;
+        fclose(fp);
+        if (unit == 'K') size <<= 10;
+        if (unit == 'M') size <<= 20;
+        if (unit == 'G') size <<= 30;
+        return size;
+    }
+    return 0;
+}
+
+/*
+ * Returns log2 of the bucket count asked for by IS_BUCKETS: a power of
+ * two from 1 to MAX_KEY, or "auto".  In auto mode the count is the
+ * smallest one whose slice of key_buff1 (MAX_KEY/count keys) takes at
+ * most half of the L2 cache, leaving the other half to the keys of the
+ * bucket streaming through; it is kept at 8 buckets per thread or more
+ * so the dynamic ranking loop still has work to balance.
+ */
+int buckets_log_2( const char *setting )
+{
+    int  log2;
+    long count, l2;
+
+    if (strcmp(setting, "auto") == 0) {
+        l2 = cache_size(2);
+        if (l2 <= 0) {
+            printf( " IS_BUCKETS=auto: no L2 size in sysfs, using %d buckets\n", NUM_BUCKETS );
+            return NUM_BUCKETS_LOG_2;
+        }
+        log2 = 0;
+        while (log2 < MAX_KEY_LOG_2 && ((long)MAX_KEY >> log2) * (long)sizeof(INT_TYPE) > l2/2)
+            log2++;
+        while (log2 < MAX_KEY_LOG_2 && (1L << log2) < 8L*num_workers)
+            log2++;
+        printf( " IS_BUCKETS=auto: L2 of %ld KB, %ld bytes of key_buff1 per bucket\n",
+                l2 >> 10, ((long)MAX_KEY >> log2) * (long)sizeof(INT_TYPE) );
+        return log2;
     }
+
+    count = atol(setting);
+    for (log2 = 0; log2 <= MAX_KEY_LOG_2; log2++)
+        if ((1L << log2) == count)
+            return log2;
+    printf( " IS_BUCKETS must be auto or a power of two from 1 to %d, using %d\n", MAX_KEY, NUM_BUCKETS );
+    return NUM_BUCKETS_LOG_2;
 }
+#endif /*USE_BUCKETS*/
 
 
 
@@ -439,17 +678,24 @@ void alloc_key_buff( void )
     int      num_procs;
 
 
-    num_procs = 1;
+    num_procs = num_workers;
 
 #ifdef USE_BUCKETS
     bucket_size = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+    bucket_ptrs2 = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+    bucket_ptrs = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_buckets);
 
     for (i = 0; i < num_procs; i++) {
-        bucket_size[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * NUM_BUCKETS);
+        bucket_size[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_buckets);
+        bucket_ptrs2[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_buckets);
     }
 
-    for( i=0; i<NUM_KEYS; i++ )
-        key_buff2[i] = 0;
+    /*  The streaming mode leaves key_buff2 alone */
+    if (!stream_dir)
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_KEYS), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++)
+                key_buff2[i] = 0;
+        });
 
 #else /*USE_BUCKETS*/
 
@@ -461,72 +707,544 @@ void alloc_key_buff( void )
     }
 
 #endif /*USE_BUCKETS*/
+
+    if (radix_bits > 0) {
+        INT_TYPE num_digits = (INT_TYPE)1 << radix_bits;
+
+        radix_buff = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * SIZE_OF_BUFFERS);
+        radix_count = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+        radix_start = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+        radix_wc = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_procs);
+        radix_total = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_digits);
+        for (i = 0; i < num_procs; i++) {
+            radix_count[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_digits);
+            radix_start[i] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_digits);
+            if (posix_memalign((void **)&radix_wc[i], WC_LINE_BYTES, sizeof(INT_TYPE) * num_digits * WC_KEYS) != 0) {
+                perror("Memory allocation error");
+                exit(1);
+            }
+        }
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, SIZE_OF_BUFFERS), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+                key_buff2[i] = 0;
+                radix_buff[i] = 0;
+            }
+        });
+    }
 }
 
 
 
 /*****************************************************************/
-/*************    F  U  L  L  _  V  E  R  I  F  Y     ************/
+/*************      T  H  R  E  A  D     B  U  S  Y     **********/
 /*****************************************************************/
 
+inline double busy_start( void )
+{
+    return thread_busy ? elapsed_time() : 0.0;
+}
 
-void full_verify( void )
+inline void busy_stop( double t0 )
 {
-    INT_TYPE   i, j;
-    INT_TYPE   k, k1;
+    if (thread_busy) {
+        int t = tbb::this_task_arena::current_thread_index();
+        if (t >= 0 && t < num_workers)
+            thread_busy[BUSY_STRIDE*t] += elapsed_time() - t0;
+    }
+}
 
 
-    /*  Now, finally, sort the keys:  */
 
-    /*  Copy keys into work array; keys in key_array will be reassigned. */
+/*****************************************************************/
+/*************      R  A  D  I  X  _  S  O  R  T      ************/
+/*****************************************************************/
+
+/*
+ * Sorts the NUM_KEYS keys of src by least significant digit first,
+ * ping-ponging between key_buff2 and radix_buff, and returns the one
+ * that holds the sorted keys; src is left as it is.
+ *
+ * Every pass is the bucket sort of rank() with the digit as bucket:
+ * the blocks count their keys per digit, the counts are accumulated
+ * across the blocks digit by digit, and the blocks scatter their keys
+ * in order, which keeps the sort stable.  The scatter gathers the
+ * keys of a digit in a cache line of radix_wc, at the slot they will
+ * have in their line of dst, and writes a line out once its last slot
+ * is filled; the first and the last line of a block's part of a digit
+ * are shared, so only the block's own slots of those are written.
+ * With 8 or 11 bit digits the counts and the lines being filled stay
+ * in L1/L2, where the MAX_KEY counting of rank() does not.
+ */
+INT_TYPE *radix_sort( INT_TYPE *src )
+{
+    int num_procs = num_workers;
+    INT_TYPE mq = (NUM_KEYS + num_procs - 1) / num_procs;
+    INT_TYPE num_digits = (INT_TYPE)1 << radix_bits;
+    INT_TYPE mask = num_digits - 1;
+    INT_TYPE *dst = key_buff2;
+    int shift;
+
+    for (shift = 0; shift < MAX_KEY_LOG_2; shift += radix_bits) {
+        INT_TYPE wc_base = ((uintptr_t)dst / sizeof(INT_TYPE)) & (WC_KEYS-1);
+        INT_TYPE d, sum;
+
+        /*  Count the keys of each block per digit */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+                INT_TYPE *cnt = radix_count[myid];
+                INT_TYPE i, k1, k2;
+
+                k1 = mq * myid;
+                k2 = k1 + mq;
+                if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
+
+                for( i=0; i<num_digits; i++ )
+                    cnt[i] = 0;
+                for( i=k1; i<k2; i++ )
+                    cnt[(src[i] >> shift) & mask]++;
+            }
+        });
+
+        /*  Accumulate the counts across the blocks, digit by digit */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_digits), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE d = r_tbb.begin(); d != r_tbb.end(); d++) {
+                INT_TYPE sum = 0;
+                for( int k=0; k< num_procs; k++ ) {
+                    INT_TYPE c = radix_count[k][d];
+                    radix_count[k][d] = sum;
+                    sum += c;
+                }
+                radix_total[d] = sum;
+            }
+        });
+        sum = 0;
+        for( d=0; d< num_digits; d++ ) {
+            INT_TYPE c = radix_total[d];
+            radix_total[d] = sum;
+            sum += c;
+        }
+
+        /*  Scatter the keys of each block through its lines */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+                INT_TYPE *ptrs = radix_count[myid];
+                INT_TYPE *start = radix_start[myid];
+                INT_TYPE *buff = radix_wc[myid];
+                INT_TYPE i, d, k1, k2;
+
+                k1 = mq * myid;
+                k2 = k1 + mq;
+                if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
+
+                for( d=0; d< num_digits; d++ ) {
+                    ptrs[d] += radix_total[d];
+                    start[d] = ptrs[d];
+                }
+
+                for( i=k1; i<k2; i++ ) {
+                    INT_TYPE k = src[i];
+                    INT_TYPE *line;
+                    INT_TYPE p, slot;
+
+                    d = (k >> shift) & mask;
+                    p = ptrs[d]++;
+                    slot = (p + wc_base) & (WC_KEYS-1);
+                    line = &buff[d*WC_KEYS];
+                    line[slot] = k;
+                    if (slot == WC_KEYS-1) {
+                        INT_TYPE first = p - slot;
+                        if (first >= start[d]) {
+#if defined(__SSE2__)
+                            /*  a whole line, stored around the caches */
+                            __m128i *to = (__m128i *)&dst[first];
+                            const __m128i *from = (const __m128i *)line;
+                            for( int m=0; m<WC_LINE_BYTES/16; m++ )
+                                _mm_stream_si128(&to[m], _mm_load_si128(&from[m]));
+#else
+                            memcpy(&dst[first], line, WC_LINE_BYTES);
+#endif
+                        } else {
+                            for( INT_TYPE m=start[d]; m<=p; m++ )
+                                dst[m] = line[m-first];
+                        }
+                    }
+                }
+
+                /*  Write out the lines that are not full */
+                for( d=0; d< num_digits; d++ ) {
+                    INT_TYPE slot = (ptrs[d] + wc_base) & (WC_KEYS-1);
+                    INT_TYPE first = ptrs[d] - slot;
+                    if (slot == 0 || ptrs[d] == start[d]) continue;
+                    if (first < start[d]) first = start[d];
+                    for( INT_TYPE m=first; m<ptrs[d]; m++ )
+                        dst[m] = buff[d*WC_KEYS + ((m + wc_base) & (WC_KEYS-1))];
+                }
+            }
+        });
+
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+        src = dst;
+        dst = (dst == key_buff2) ? radix_buff : key_buff2;
+    }
+
+    return src;
+}
+
+
 
 #ifdef USE_BUCKETS
+/*****************************************************************/
+/*************      B  U  C  K  E  T  _  S  O  R  T      *********/
+/*****************************************************************/
 
-    /* Buckets are already sorted.  Sorting keys within each bucket */
+/*
+ * Sorts the n keys of src into dst by bucket, the bucket of a key
+ * being its top num_buckets_log_2 bits, and leaves in end[i] the end
+ * of bucket i in dst.  The keys are split in num_workers blocks, so
+ * bucket_size and bucket_ptrs2 are the work arrays
+ */
+void bucket_sort( const INT_TYPE *src, INT_TYPE n, INT_TYPE *dst, INT_TYPE *end, int shift )
+{
+    int num_procs = num_workers;
+    INT_TYPE i, mq = (n + num_procs - 1) / num_procs;
+
+    /*  Determine the number of keys of each block in each bucket */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+        double t0 = busy_start();
+        for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+            INT_TYPE *work_buff = bucket_size[myid];
+            INT_TYPE i, k1, k2;
+
+            k1 = mq * myid;
+            k2 = k1 + mq;
+            if ( k2 > n ) k2 = n;
+
+            /*  Initialize */
+            for( i=0; i<num_buckets; i++ )
+                work_buff[i] = 0;
+
+            for( i=k1; i<k2; i++ )
+                work_buff[src[i] >> shift]++;
+        }
+        busy_stop( t0 );
+    });
+
+    /*  Accumulative bucket sizes are the bucket pointers.
+    For each bucket, the sizes of the blocks are accumulated across the
+    blocks; bucket_ptrs2[myid][i] is where block myid starts writing
+    inside bucket i and end[i] gets the size of the bucket     */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets), [&](const tbb::blocked_range<size_t>& r_tbb){
+        double t0 = busy_start();
+        for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+            INT_TYPE sum = 0;
+            for( int k=0; k< num_procs; k++ ) {
+                bucket_ptrs2[k][i] = sum;
+                sum += bucket_size[k][i];
+            }
+            end[i] = sum;
+        }
+        busy_stop( t0 );
+    });
 
-    for( j=0; j< NUM_BUCKETS; j++ ) {
+    /*  These are global sizes accumulated upon to each bucket */
+    for( i=1; i< num_buckets; i++ )
+        end[i] += end[i-1];
 
-        k1 = (j > 0)? bucket_ptrs[j-1] : 0;
-        for ( i = k1; i < bucket_ptrs[j]; i++ ) {
-            k = --key_buff_ptr_global[key_buff2[i]];
-            key_array[k] = key_buff2[i];
+
+    /*  Sort into appropriate bucket */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+        double t0 = busy_start();
+        for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+            INT_TYPE *ptrs = bucket_ptrs2[myid];
+            INT_TYPE i, k, k1, k2;
+
+            k1 = mq * myid;
+            k2 = k1 + mq;
+            if ( k2 > n ) k2 = n;
+
+            for( i=1; i< num_buckets; i++ )
+                ptrs[i] += end[i-1];
+
+            for( i=k1; i<k2; i++ ) {
+                k = src[i];
+                dst[ptrs[k >> shift]++] = k;
+            }
         }
-    }
+        busy_stop( t0 );
+    });
+}
 
-#else
 
-    for( i=0; i<NUM_KEYS; i++ )
-        key_buff2[i] = key_array[i];
-
-    /* This is actual sorting. Each thread is responsible for
-    a subset of key values */
-    j = 1;
-    j = (MAX_KEY + j - 1) / j;
-    k1 = j * 0;
-    INT_TYPE k2 = k1 + j;
-    if (k2 > MAX_KEY) k2 = MAX_KEY;
-
-    for( i=0; i<NUM_KEYS; i++ ) {
-        if (key_buff2[i] >= k1 && key_buff2[i] < k2) {
-            k = --key_buff_ptr_global[key_buff2[i]];
-            key_array[k] = key_buff2[i];
+
+/*****************************************************************/
+/*************     R  A  N  K  _  S  T  R  E  A  M     **********/
+/*****************************************************************/
+
+void stream_read( INT_TYPE *buff, INT_TYPE n, INT_TYPE at )
+{
+    char   *p = (char *)buff;
+    size_t left = n * sizeof(INT_TYPE);
+    off_t  off = (off_t)at * sizeof(INT_TYPE);
+    ssize_t r;
+
+    while (left > 0) {
+        if ((r = pread(stream_fd, p, left, off)) <= 0) {
+            perror("IS_STREAM: cannot read the runs");
+            exit(1);
         }
+        p += r; off += r; left -= r;
+    }
+}
+
+void stream_write( const INT_TYPE *buff, INT_TYPE n, INT_TYPE at )
+{
+    const char *p = (const char *)buff;
+    size_t left = n * sizeof(INT_TYPE);
+    off_t  off = (off_t)at * sizeof(INT_TYPE);
+    ssize_t r;
+
+    while (left > 0) {
+        if ((r = pwrite(stream_fd, p, left, off)) <= 0) {
+            perror("IS_STREAM: cannot write the runs");
+            exit(1);
+        }
+        p += r; off += r; left -= r;
+    }
+}
+
+/*
+ * Opens a file of NUM_KEYS keys in stream_dir and unlinks it at once,
+ * so that it goes away with the process
+ */
+int stream_file( const char *name )
+{
+    char path[4096];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/is.%c.%s.XXXXXX", stream_dir, CLASS, name);
+    if ((fd = mkstemp(path)) < 0) {
+        perror("IS_STREAM: cannot create a file");
+        exit(1);
+    }
+    unlink(path);
+    if (ftruncate(fd, (off_t)NUM_KEYS * sizeof(INT_TYPE)) != 0) {
+        perror("IS_STREAM: cannot size a file");
+        exit(1);
     }
+    return fd;
+}
+
+void stream_open( void )
+{
+    int t, key_fd, num_threads;
+    INT_TYPE num_chunks = (NUM_KEYS + STREAM_CHUNK - 1) / STREAM_CHUNK;
+
+    key_fd = stream_file( "keys" );
+    keys = (INT_TYPE *)mmap(NULL, (size_t)NUM_KEYS * sizeof(INT_TYPE),
+                            PROT_READ | PROT_WRITE, MAP_SHARED, key_fd, 0);
+    if (keys == MAP_FAILED) {
+        perror("IS_STREAM: cannot map the keys");
+        exit(1);
+    }
+    close(key_fd);
+    stream_fd = stream_file( "runs" );
+
+    num_threads = std::max(num_workers, tbb::this_task_arena::max_concurrency());
+    stream_chunk = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * STREAM_CHUNK);
+    stream_ends = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * num_chunks * num_buckets);
+    stream_buff = (INT_TYPE **)alloc_mem(sizeof(INT_TYPE *) * num_threads);
+    for (t = 0; t < num_threads; t++)
+        stream_buff[t] = (INT_TYPE *)alloc_mem(sizeof(INT_TYPE) * STREAM_BUFF);
+}
+
+/*
+ * The bucketed ranking of rank() with the keys out of core: every
+ * chunk of the key file is sorted by bucket and appended to the runs
+ * in a single write, then every bucket counts its keys from its part
+ * of each run.  bucket_ptrs and key_buff1 end up as in rank()
+ */
+void rank_stream( int shift )
+{
+    INT_TYPE num_bucket_keys = (1L << shift);
+    INT_TYPE c, c0, len, num_chunks = (NUM_KEYS + STREAM_CHUNK - 1) / STREAM_CHUNK;
+
+    for( c=0; c<num_chunks; c++ ) {
+        c0 = c*STREAM_CHUNK;
+        len = std::min((INT_TYPE)STREAM_CHUNK, NUM_KEYS - c0);
+        bucket_sort( &keys[c0], len, stream_chunk, &stream_ends[c*num_buckets], shift );
+        stream_write( stream_chunk, len, c0 );
+    }
+
+    /*  The ends of the buckets over all the runs */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets), [&](const tbb::blocked_range<size_t>& r_tbb){
+        double t0 = busy_start();
+        for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+            INT_TYPE sum = 0;
+            for( INT_TYPE c=0; c<num_chunks; c++ )
+                sum += stream_ends[c*num_buckets+i];
+            bucket_ptrs[i] = sum;
+        }
+        busy_stop( t0 );
+    });
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+        double t0 = busy_start();
+        for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+            INT_TYPE *buff = stream_buff[tbb::this_task_arena::current_thread_index()];
+            INT_TYPE c, k, m, n, k1, k2;
+
+            /*  Clear the work array section associated with each bucket */
+            k1 = i * num_bucket_keys;
+            k2 = k1 + num_bucket_keys;
+            for ( k = k1; k < k2; k++ )
+                key_buff1[k] = 0;
+
+            /*  Count the keys of the bucket, run by run */
+            for( c=0; c<num_chunks; c++ ) {
+                INT_TYPE lo = (i > 0)? stream_ends[c*num_buckets+i-1] : 0;
+                INT_TYPE hi = stream_ends[c*num_buckets+i];
+                for( ; lo<hi; lo+=n ) {
+                    n = std::min((INT_TYPE)STREAM_BUFF, hi-lo);
+                    stream_read( buff, n, c*STREAM_CHUNK + lo );
+                    for( m=0; m<n; m++ )
+                        key_buff1[buff[m]]++;
+                }
+            }
+
+            /*  Add m, the total of lesser keys, and accumulate */
+            m = (i > 0)? bucket_ptrs[i-1] : 0;
+            key_buff1[k1] += m;
+            for ( k = k1+1; k < k2; k++ )
+                key_buff1[k] += key_buff1[k-1];
+        }
+        busy_stop( t0 );
+    }, tbb::simple_partitioner());
+}
+#endif /*USE_BUCKETS*/
+
+
+
+/*****************************************************************/
+/*************    F  U  L  L  _  V  E  R  I  F  Y     ************/
+/*****************************************************************/
+
+
+void full_verify( void )
+{
+
+    /*  Now, finally, sort the keys:  */
+
+    /*  Copy keys into work array; keys in key_array will be reassigned. */
 
+    if (radix_bits > 0) {
+        /*  The radix sort engine has left the keys sorted already */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_KEYS), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++)
+                key_array[i] = radix_sorted[i];
+        });
+#ifdef USE_BUCKETS
+    } else if (stream_dir) {
+        /*  Every bucket puts its keys in place in the key file, reading */
+        /*  them from the runs as rank_stream did                        */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+                INT_TYPE *buff = stream_buff[tbb::this_task_arena::current_thread_index()];
+                INT_TYPE c, m, n, k1, k2;
+
+                for( c=0; c*STREAM_CHUNK<NUM_KEYS; c++ ) {
+                    k1 = (i > 0)? stream_ends[c*num_buckets+i-1] : 0;
+                    k2 = stream_ends[c*num_buckets+i];
+                    for( ; k1<k2; k1+=n ) {
+                        n = std::min((INT_TYPE)STREAM_BUFF, k2-k1);
+                        stream_read( buff, n, c*STREAM_CHUNK + k1 );
+                        for( m=0; m<n; m++ )
+                            keys[--key_buff_ptr_global[buff[m]]] = buff[m];
+                    }
+                }
+            }
+        }, tbb::simple_partitioner());
 #endif
+    } else {
+#ifdef USE_BUCKETS
 
+        /* Buckets are already sorted.  Sorting keys within each bucket;
+        the buckets hold disjoint key ranges, so they go in parallel    */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE j = r_tbb.begin(); j != r_tbb.end(); j++) {
+                INT_TYPE k1 = (j > 0)? bucket_ptrs[j-1] : 0;
+                for ( INT_TYPE i = k1; i < bucket_ptrs[j]; i++ ) {
+                    INT_TYPE k = --key_buff_ptr_global[key_buff2[i]];
+                    key_array[k] = key_buff2[i];
+                }
+            }
+        }, tbb::simple_partitioner());
 
-    /*  Confirm keys correctly sorted: count incorrectly sorted keys, if any */
+#else
 
-    j = 0;
+        int num_procs = num_workers;
+        INT_TYPE mq = (NUM_KEYS + num_procs - 1) / num_procs;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, NUM_KEYS), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++)
+                key_buff2[i] = key_array[i];
+        });
+
+        /* This is actual sorting.  key_buff1_aptr[myid] still holds the
+        key population of block myid (but for block 0, whose counts went
+        into the ranks): walking the blocks down from the end of each key
+        gives every block its own end, so the blocks scatter in parallel */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, MAX_KEY), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+                INT_TYPE end = key_buff_ptr_global[i];
+                for( int k=num_procs-1; k>0; k-- ) {
+                    INT_TYPE c = key_buff1_aptr[k][i];
+                    key_buff1_aptr[k][i] = end;
+                    end -= c;
+                }
+                key_buff_ptr_global[i] = end;
+            }
+        });
 
-    for( i=1; i<NUM_KEYS; i++ ) {
-        if( key_array[i-1] > key_array[i] )
-            j++;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+                INT_TYPE *ptrs = (myid > 0)? key_buff1_aptr[myid] : key_buff_ptr_global;
+                INT_TYPE i, k, k1, k2;
+
+                k1 = mq * myid;
+                k2 = k1 + mq;
+                if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
+
+                for( i=k1; i<k2; i++ ) {
+                    k = --ptrs[key_buff2[i]];
+                    key_array[k] = key_buff2[i];
+                }
+            }
+        });
+
+#endif
     }
 
-    if( j != 0 )
-        printf( "Full_verify: number of keys out of sort: %ld\n", (long)j );
+
+    /*  Confirm keys correctly sorted: the blocks of VERIFY_BLOCK keys are
+    checked in parallel, and all stop once one finds a key out of sort */
+    std::atomic<INT_TYPE> first_out(NUM_KEYS);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(1, NUM_KEYS, VERIFY_BLOCK), [&](const tbb::blocked_range<size_t>& r_tbb){
+        if (first_out.load(std::memory_order_relaxed) < NUM_KEYS) return;
+        for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+            if( keys[i-1] > keys[i] ) {
+                INT_TYPE seen = first_out.load();
+                while (i < seen && !first_out.compare_exchange_weak(seen, i));
+                return;
+            }
+        }
+    });
+
+    if( first_out < NUM_KEYS )
+        printf( "Full_verify: keys out of sort, first found at %ld\n", (long)first_out.load() );
     else
         passed_verification++;
 
@@ -547,19 +1265,19 @@ void rank( int iteration )
     INT_TYPE    *key_buff_ptr, *key_buff_ptr2;
 
 #ifdef USE_BUCKETS
-    int shift = MAX_KEY_LOG_2 - NUM_BUCKETS_LOG_2;
+    int shift = MAX_KEY_LOG_2 - num_buckets_log_2;
     INT_TYPE num_bucket_keys = (1L << shift);
 #endif
 
 
-    key_array[iteration] = iteration;
-    key_array[iteration+MAX_ITERATIONS] = MAX_KEY - iteration;
+    keys[iteration] = iteration;
+    keys[iteration+MAX_ITERATIONS] = MAX_KEY - iteration;
 
 
     /*  Determine where the partial verify test keys are, load into  */
     /*  top of array bucket_size                                     */
     for( i=0; i<TEST_ARRAY_SIZE; i++ )
-        partial_verify_vals[i] = key_array[test_index_array[i]];
+        partial_verify_vals[i] = keys[test_index_array[i]];
 
 
     /*  Setup pointers to key buffers  */
@@ -571,133 +1289,131 @@ void rank( int iteration )
     key_buff_ptr = key_buff1;
 
 
-        INT_TYPE *work_buff, m, k1, k2;
-        int myid = 0, num_procs = 1;
-
+    if (radix_bits > 0) {
+        /*  The ranks are looked up in the sorted keys below */
+        radix_sorted = radix_sort( key_array );
+#ifdef USE_BUCKETS
+    } else if (stream_dir) {
+        /*  The keys are read from their file */
+        rank_stream( shift );
+#endif
+    } else {
 
         /*  Bucket sort is known to improve cache performance on some   */
         /*  cache based systems.  But the actual performance may depend */
         /*  on cache size, problem size. */
 #ifdef USE_BUCKETS
 
-    work_buff = bucket_size[myid];
-
-    /*  Initialize */
-    for( i=0; i<NUM_BUCKETS; i++ )
-        work_buff[i] = 0;
-
-    /*  Determine the number of keys in each bucket */
-    for( i=0; i<NUM_KEYS; i++ )
-        work_buff[key_array[i] >> shift]++;
-
-    /*  Accumulative bucket sizes are the bucket pointers.
-    These are global sizes accumulated upon to each bucket */
-    bucket_ptrs[0] = 0;
-    for( k=0; k< myid; k++ )  {
-        bucket_ptrs[0] += bucket_size[k][0];
-    }
-
-    for( i=1; i< NUM_BUCKETS; i++ ) {
-        bucket_ptrs[i] = bucket_ptrs[i-1];
-        for( k=0; k< myid; k++ )
-            bucket_ptrs[i] += bucket_size[k][i];
-        for( k=myid; k< num_procs; k++ )
-            bucket_ptrs[i] += bucket_size[k][i-1];
-    }
-
-
-    /*  Sort into appropriate bucket */
-    for( i=0; i<NUM_KEYS; i++ ) {
-        k = key_array[i];
-        key_buff2[bucket_ptrs[k >> shift]++] = k;
-
-    }
-    /*  The bucket pointers now point to the final accumulated sizes */
-    if (myid < num_procs-1) {
-        for( i=0; i< NUM_BUCKETS; i++ )
-            for( k=myid+1; k< num_procs; k++ )
-                bucket_ptrs[i] += bucket_size[k][i];
-    }
-
-
-    /*  Now, buckets are sorted.  We only need to sort keys inside
-    each bucket, which can be done in parallel.  Because the distribution
-    of the number of keys in the buckets is Gaussian, the use of
-    a dynamic schedule should improve load balance, thus, performance     */
+        bucket_sort( key_array, NUM_KEYS, key_buff2, bucket_ptrs, shift );
+
+
+        /*  Now, buckets are sorted.  We only need to sort keys inside
+        each bucket, which can be done in parallel.  Because the distribution
+        of the number of keys in the buckets is Gaussian, the use of
+        a dynamic schedule should improve load balance, thus, performance;
+        here every bucket is a task of its own, balanced by work stealing   */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_buckets, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            double t0 = busy_start();
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+                INT_TYPE k, m, k1, k2;
+
+                /*  Clear the work array section associated with each bucket */
+                k1 = i * num_bucket_keys;
+                k2 = k1 + num_bucket_keys;
+                for ( k = k1; k < k2; k++ )
+                    key_buff_ptr[k] = 0;
+
+                /*  Ranking of all keys occurs in this section:                 */
+
+                /*  In this section, the keys themselves are used as their
+                own indexes to determine how many of each there are: their
+                individual population                                       */
+                m = (i > 0)? bucket_ptrs[i-1] : 0;
+                for ( k = m; k < bucket_ptrs[i]; k++ )
+                    key_buff_ptr[key_buff_ptr2[k]]++;  /* Now they have individual key   */
+                /* population                     */
+
+                /*  To obtain ranks of each key, successively add the individual key
+                population, not forgetting to add m, the total of lesser keys,
+                to the first key population                                          */
+                key_buff_ptr[k1] += m;
+                for ( k = k1+1; k < k2; k++ )
+                    key_buff_ptr[k] += key_buff_ptr[k-1];
+            }
+            busy_stop( t0 );
+        }, tbb::simple_partitioner());
 
-    for( i=0; i< NUM_BUCKETS; i++ ) {
+#else /*USE_BUCKETS*/
 
-        /*  Clear the work array section associated with each bucket */
-        k1 = i * num_bucket_keys;
-        k2 = k1 + num_bucket_keys;
-        for ( k = k1; k < k2; k++ )
-            key_buff1[k] = 0;
+        int num_procs = num_workers;
+        INT_TYPE mq = (NUM_KEYS + num_procs - 1) / num_procs;
 
         /*  Ranking of all keys occurs in this section:                 */
 
         /*  In this section, the keys themselves are used as their
         own indexes to determine how many of each there are: their
-        individual population                                       */
-        m = (i > 0)? bucket_ptrs[i-1] : 0;
-        for ( k = m; k < bucket_ptrs[i]; k++ )
-            key_buff1[key_buff2[k]]++;  /* Now they have individual key   */
-        /* population                     */
+        individual population; every block counts into its own array */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_procs, 1), [&](const tbb::blocked_range<size_t>& r_tbb){
+            double t0 = busy_start();
+            for (int myid = r_tbb.begin(); myid != r_tbb.end(); myid++) {
+                INT_TYPE *work_buff = key_buff1_aptr[myid];
+                INT_TYPE i, k1, k2;
+
+                k1 = mq * myid;
+                k2 = k1 + mq;
+                if ( k2 > NUM_KEYS ) k2 = NUM_KEYS;
+
+                /*  Clear the work array */
+                for( i=0; i<MAX_KEY; i++ )
+                    work_buff[i] = 0;
+
+                for( i=k1; i<k2; i++ )
+                    work_buff[key_buff_ptr2[i]]++;  /* Now they have individual key   */
+                /* population                     */
+            }
+            busy_stop( t0 );
+        });
+
+        /*  Accumulate the global key population */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, MAX_KEY), [&](const tbb::blocked_range<size_t>& r_tbb){
+            double t0 = busy_start();
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++)
+                for( int k=1; k<num_procs; k++ )
+                    key_buff_ptr[i] += key_buff1_aptr[k][i];
+            busy_stop( t0 );
+        });
 
         /*  To obtain ranks of each key, successively add the individual key
-        population, not forgetting to add m, the total of lesser keys,
-        to the first key population                                          */
-        key_buff1[k1] += m;
-        for ( k = k1+1; k < k2; k++ )
-            key_buff1[k] += key_buff1[k-1];
-
-    }
-
-#else /*USE_BUCKETS*/
-
-
-    work_buff = key_buff1_aptr[myid];
-
-
-    /*  Clear the work array */
-    for( i=0; i<MAX_KEY; i++ )
-        work_buff[i] = 0;
-
-
-    /*  Ranking of all keys occurs in this section:                 */
-
-    /*  In this section, the keys themselves are used as their
-    own indexes to determine how many of each there are: their
-    individual population                                       */
-
-    for( i=0; i<NUM_KEYS; i++ )
-        work_buff[key_buff_ptr2[i]]++;  /* Now they have individual key   */
-    /* population                     */
-
-    /*  To obtain ranks of each key, successively add the individual key
-    population                                          */
-
-    for( i=0; i<MAX_KEY-1; i++ )
-        work_buff[i+1] += work_buff[i];
-
-
-    /*  Accumulate the global key population */
-    for( k=1; k<num_procs; k++ ) {
-        for( i=0; i<MAX_KEY; i++ )
-            key_buff_ptr[i] += key_buff1_aptr[k][i];
-    }
+        population                                          */
+        tbb::parallel_scan(tbb::blocked_range<size_t>(0, MAX_KEY), (INT_TYPE)0,
+            [&](const tbb::blocked_range<size_t>& r_tbb, INT_TYPE sum, bool is_final) -> INT_TYPE {
+            double t0 = busy_start();
+            for (INT_TYPE i = r_tbb.begin(); i != r_tbb.end(); i++) {
+                sum += key_buff_ptr[i];
+                if (is_final) key_buff_ptr[i] = sum;
+            }
+            busy_stop( t0 );
+            return sum;
+        }, [](INT_TYPE x, INT_TYPE y) { return x + y; } );
 
 #endif /*USE_BUCKETS*/
+    }
 
 
     /* This is the partial verify test section */
     /* Observe that test_rank_array vals are   */
     /* shifted differently for different cases */
-    for( i=0; i<TEST_ARRAY_SIZE; i++ )
+    /* The test ranks hold for the NPB keys only */
+    for( i=0; key_dist == KEYS_NPB && i<TEST_ARRAY_SIZE; i++ )
     {
         k = partial_verify_vals[i];          /* test vals were put here */
         if( 0 < k  &&  k <= NUM_KEYS-1 )
         {
-            INT_TYPE key_rank = key_buff_ptr[k-1];
+            INT_TYPE key_rank;
+            if (radix_bits > 0)
+                key_rank = std::upper_bound(radix_sorted, radix_sorted+NUM_KEYS, k-1) - radix_sorted;
+            else
+                key_rank = key_buff_ptr[k-1];
             int failed = 0;
 
             switch( CLASS )
@@ -801,18 +1517,129 @@ void rank( int iteration )
 }
 
 
+/*****************************************************************/
+/*************    S  K  E  W     B  E  N  C  H     **************/
+/*****************************************************************/
+
+/*
+ * Ranks every key distribution MAX_ITERATIONS times and reports the
+ * time, the spread of the busy time of the threads in rank() (largest
+ * over mean) and, for the bucketed ranking, the size of the largest
+ * bucket over the mean one.  The NPB keys are verified in full, the
+ * others by full_verify only.
+ */
+void skew_benchmark( void )
+{
+    int    d, t, iteration;
+    double time, busy_max, busy_sum;
+
+    thread_busy = (double *)alloc_mem(sizeof(double) * BUSY_STRIDE * num_workers);
+
+    printf( " %-10s %10s %10s %10s %10s  %s\n",
+            "Keys", "Time (s)", "Mop/s", "Imbalance", "Bucket", "Verification" );
+
+    for (d = 0; d < NUM_KEY_DISTS; d++) {
+        key_dist = d;
+        create_seq( 314159265.00,                    /* Random number gen seed */
+                    1220703125.00 );                 /* Random number gen mult */
+        rank( 1 );
+
+        passed_verification = 0;
+        for (t = 0; t < num_workers; t++)
+            thread_busy[BUSY_STRIDE*t] = 0.0;
+
+        timer_clear( 4 );
+        timer_start( 4 );
+        for( iteration=1; iteration<=MAX_ITERATIONS; iteration++ )
+            rank( iteration );
+        timer_stop( 4 );
+        time = timer_read( 4 );
+
+        busy_max = busy_sum = 0.0;
+        for (t = 0; t < num_workers; t++) {
+            busy_sum += thread_busy[BUSY_STRIDE*t];
+            if (thread_busy[BUSY_STRIDE*t] > busy_max)
+                busy_max = thread_busy[BUSY_STRIDE*t];
+        }
+
+        char bucket[16] = "-";
+#ifdef USE_BUCKETS
+        if (radix_bits == 0) {
+            INT_TYPE i, size, largest = bucket_ptrs[0];
+            for( i=1; i< num_buckets; i++ ) {
+                size = bucket_ptrs[i] - bucket_ptrs[i-1];
+                if (size > largest) largest = size;
+            }
+            snprintf(bucket, sizeof(bucket), "%.2f", (double)largest * num_buckets / NUM_KEYS);
+        }
+#endif
+
+        full_verify();
+        if( passed_verification != ((d == KEYS_NPB)? 5*MAX_ITERATIONS : 0) + 1 )
+            passed_verification = 0;
+
+        printf( " %-10s %10.2f %10.2f %10.2f %10s  %s\n", key_dist_name[d], time,
+                ((double) (MAX_ITERATIONS*TOTAL_KEYS))/time/1000000.0,
+                (busy_sum > 0.0)? busy_max * num_workers / busy_sum : 1.0, bucket,
+                passed_verification? "SUCCESSFUL" : "UNSUCCESSFUL" );
+    }
+}
+
+
 /*****************************************************************/
 /*************             M  A  I  N             ****************/
 /*****************************************************************/
 
 int main( int argc, char **argv )
 {
-    int nthreads=1;
     int   i, iteration, timer_on;
     double  timecounter;
 
     FILE *fp;
 
+    if(const char * nw = std::getenv("TBB_NUM_THREADS")) {
+        num_workers = atoi(nw);
+    } else {
+        num_workers = 1;
+    }
+
+    tbb::task_scheduler_init init(num_workers);
+
+    radix_bits = 0;
+    if(const char * rk = std::getenv("IS_RANK")) {
+        if (strcmp(rk, "radix") == 0) {
+            radix_bits = 11;
+        } else if (strcmp(rk, "bucket") != 0) {
+            printf(" Unknown IS_RANK engine %s, using bucket\n", rk);
+        }
+    }
+    if(const char * rb = std::getenv("IS_RADIX_BITS")) {
+        if (radix_bits > 0) {
+            radix_bits = atoi(rb);
+            if (radix_bits != 8 && radix_bits != 11) {
+                printf(" IS_RADIX_BITS must be 8 or 11, using 11\n");
+                radix_bits = 11;
+            }
+        }
+    }
+    key_dist = KEYS_NPB;
+    if(const char * kd = std::getenv("IS_KEYS")) {
+        if (strcmp(kd, "all") == 0)
+            key_dist = KEYS_ALL;
+        for (i = 0; i < NUM_KEY_DISTS; i++)
+            if (strcmp(kd, key_dist_name[i]) == 0)
+                key_dist = i;
+        if (key_dist == KEYS_NPB && strcmp(kd, "npb") != 0)
+            printf(" Unknown IS_KEYS distribution %s, using npb\n", kd);
+    }
+#ifdef USE_BUCKETS
+    stream_dir = std::getenv("IS_STREAM");
+    if (stream_dir && radix_bits > 0) {
+        printf(" IS_STREAM ranks by buckets, IS_RANK=radix is ignored\n");
+        radix_bits = 0;
+    }
+#endif
+
 
     /*  Initialize timers  */
     timer_on = 0;
@@ -867,12 +1694,37 @@ int main( int argc, char **argv )
     printf("\n\n Developed by: Dalvan Griebler <dalvan.griebler@acad.pucrs.br>\n");
     printf( " Size:  %ld  (class %c)\n", (long)TOTAL_KEYS, CLASS );
     printf( " Iterations:  %d\n", MAX_ITERATIONS );
-#ifdef _OPENMP
-    printf( " Number of available threads:  %d\n", omp_get_max_threads() );
-    nthreads = omp_get_max_threads();
+    printf( " Number of available threads:  %d\n", num_workers );
+#ifdef USE_BUCKETS
+    num_buckets_log_2 = NUM_BUCKETS_LOG_2;
+    if(const char * nb = std::getenv("IS_BUCKETS"))
+        num_buckets_log_2 = buckets_log_2( nb );
+    num_buckets = (INT_TYPE)1 << num_buckets_log_2;
+    if (radix_bits == 0)
+        printf( " Number of buckets:  %ld\n", (long)num_buckets );
 #endif
+    if (radix_bits > 0)
+        printf( " Ranking:  LSD radix sort, %d-bit digits, %d passes\n",
+                radix_bits, (MAX_KEY_LOG_2 + radix_bits - 1) / radix_bits );
+#ifdef USE_BUCKETS
+    if (stream_dir)
+        printf( " Streaming:  keys in %s, chunks of %d keys\n", stream_dir, STREAM_CHUNK );
+#endif
+    if (key_dist != KEYS_NPB)
+        printf( " Keys:  %s\n", (key_dist == KEYS_ALL)? "all distributions" : key_dist_name[key_dist] );
     printf( "\n" );
 
+#ifdef USE_BUCKETS
+    if (stream_dir)
+        stream_open();
+#endif
+
+    if (key_dist == KEYS_ALL) {
+        alloc_key_buff();
+        skew_benchmark();
+        return 0;
+    }
+
     if (timer_on) timer_start( 1 );
 
     /*  Generate random number sequence and subsequent keys on all procs */
@@ -919,7 +1771,7 @@ int main( int argc, char **argv )
 
 
     /*  The final printout  */
-    if( passed_verification != 5*MAX_ITERATIONS + 1 )
+    if( passed_verification != ((key_dist == KEYS_NPB)? 5*MAX_ITERATIONS : 0) + 1 )
         passed_verification = 0;
     /*c_print_results( "IS", CLASS, (int)(TOTAL_KEYS/64), 64, 0, MAX_ITERATIONS, timecounter, ((double) (MAX_ITERATIONS*TOTAL_KEYS))
     /timecounter/1000000., "keys ranked", passed_verification, NPBVERSION, COMPILETIME, CC, CLINK, C_LIB, C_INC,
@@ -19,6 +19,7 @@
 #include <tbb/task_scheduler_init.h>
 #include <tbb/mutex.h>
 #include <iostream>
+#include <cstring>
 #include "npb-CPP.hpp"
 
 #include "globals.hpp"
@@ -26,27 +27,45 @@
 /* parameters */
 #define T_BENCH	1
 #define	T_INIT	2
+/* T_LEVEL+k times level k of mg3P */
+#define	T_LEVEL	3
+
+/* default tile height of resid_psinv */
+#define	FUSE_ROWS	16
 
 /* global variables */
 /* common /grid/ */
 static int is1, is2, is3, ie1, ie2, ie3;
+/* resid and psinv fused in tiles of fuse_rows rows, from MG_FUSE */
+static int mg_fuse = 0, fuse_rows = FUSE_ROWS;
+/* periodic borders written by the stencils, from MG_FOLD */
+static int mg_fold = 0;
+/* grid points per thread of a level, from MG_CUTOFF */
+static long mg_cutoff = 0;
+static int num_workers;
+static boolean timer_on;
 
 /* functions prototypes */
 static void setup(int *n1, int *n2, int *n3, int lt);
-static void mg3P(double ****u, double ***v, double ****r, double a[4], double c[4], int n1, int n2, int n3, int k);
-static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4], int k);
-static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3, double a[4], int k );
-static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j, int m2j, int m3j, int k );
-static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1, int n2, int n3, int k );
-static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz);
-static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk);
-static void comm3(double ***u, int n1, int n2, int n3, int kk);
-static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k);
-static void showall(double ***z, int n1, int n2, int n3);
+static grid3 alloc_grid(int n1, int n2, int n3);
+static const char *simd_setup(const char *isa);
+static void mg3P(grid3 *u, grid3 v, grid3 *r, double a[4], double c[4], int n1, int n2, int n3, int k);
+static void psinv( grid3 r, grid3 u, int n1, int n2, int n3, double c[4], int k);
+static void resid( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], int k );
+static void resid_psinv( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], double c[4], int k );
+static void rprj3( grid3 r, int m1k, int m2k, int m3k, grid3 s, int m1j, int m2j, int m3j, int k );
+static void interp( grid3 z, int mm1, int mm2, int mm3, grid3 u, int n1, int n2, int n3, int k );
+static void norm2u3(grid3 r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz);
+static void rep_nrm(grid3 u, int n1, int n2, int n3, char *title, int kk);
+static void comm3(grid3 u, int n1, int n2, int n3, int kk);
+static void comm3_plane(grid3 u, int n1, int n2, int n3, int i3);
+static void zran3(grid3 z, int n1, int n2, int n3, int nx, int ny, int k);
+static void showall(grid3 z, int n1, int n2, int n3);
 static double power( double a, int n );
 static void bubble( double ten[M][2], int j1[M][2], int j2[M][2], int j3[M][2], int m, int ind );
-static void zero3(double ***z, int n1, int n2, int n3);
-/*static void nonzero(double ***z, int n1, int n2, int n3);*/
+static void zero3(grid3 z, int n1, int n2, int n3);
+static int level_threads(long points);
+/*static void nonzero(grid3 z, int n1, int n2, int n3);*/
 
 tbb::mutex critical_region;
 
@@ -61,7 +80,7 @@ int main(int argc, char *argv[]) {
     c and is NOT global. it is the current iteration
     c------------------------------------------------------------------------*/
 
-    int k, it;
+    int it;
     double t, tinit, mflops;
 
     /*-------------------------------------------------------------------------
@@ -70,7 +89,7 @@ int main(int argc, char *argv[]) {
     c are always passed as subroutine args. 
     c------------------------------------------------------------------------*/
     
-    double ****u, ***v, ****r;
+    grid3 *u, v, *r;
     double a[4], c[4];
 
     double rnm2, rnmu;
@@ -79,13 +98,12 @@ int main(int argc, char *argv[]) {
     double verify_value;
     boolean verified;
 
-    int i, j, l;
+    int i, l;
     FILE *fp;
 
     timer_clear(T_BENCH);
     timer_clear(T_INIT);
 
-    int num_workers;
     if(const char * nw = std::getenv("TBB_NUM_THREADS")) {
         num_workers = atoi(nw);
     } else {
@@ -199,33 +217,41 @@ int main(int argc, char *argv[]) {
 
     setup(&n1,&n2,&n3,lt);
       
-    u = (double ****)malloc((lt+1)*sizeof(double ***));
-    for (l = lt; l >=1; l--) {
-    	u[l] = (double ***)malloc(m3[l]*sizeof(double **));
-    	for (k = 0; k < m3[l]; k++) {
-    	    u[l][k] = (double **)malloc(m2[l]*sizeof(double *));
-    	    for (j = 0; j < m2[l]; j++) {
-    		  u[l][k][j] = (double *)malloc(m1[l]*sizeof(double));
-    	    }
-    	}
+    if (const char *pad = std::getenv("MG_PAD")) {
+    	grid_pad = max(0, atoi(pad));
+    	printf(" Row padding: %3d doubles\n", grid_pad);
     }
-    v = (double ***)malloc(m3[lt]*sizeof(double **));
-    for (k = 0; k < m3[lt]; k++) {
-	    v[k] = (double **)malloc(m2[lt]*sizeof(double *));
-	    for (j = 0; j < m2[lt]; j++) {
-	       v[k][j] = (double *)malloc(m1[lt]*sizeof(double));
-	    }
+
+    if (const char *fuse = std::getenv("MG_FUSE")) {
+    	mg_fuse = atoi(fuse);
     }
-    r = (double ****)malloc((lt+1)*sizeof(double ***));
-    for (l = lt; l >=1; l--) {
-    	r[l] = (double ***)malloc(m3[l]*sizeof(double **));
-    	for (k = 0; k < m3[l]; k++) {
-    	    r[l][k] = (double **)malloc(m2[l]*sizeof(double *));
-    	    for (j = 0; j < m2[l]; j++) {
-    		    r[l][k][j] = (double *)malloc(m1[l]*sizeof(double));
-    	    }
-    	}
+    if (const char *rows = std::getenv("MG_FUSE_ROWS")) {
+    	fuse_rows = max(1, atoi(rows));
+    }
+    if (const char *fold = std::getenv("MG_FOLD")) {
+    	mg_fold = atoi(fold);
+    }
+    if (const char *isa = std::getenv("MG_SIMD")) {
+    	printf(" Stencil kernels: %s\n", simd_setup(isa));
+    }
+    if (const char *cutoff = std::getenv("MG_CUTOFF")) {
+    	mg_cutoff = max(0L, atol(cutoff));
+    	printf(" Grid points per thread: %ld\n", mg_cutoff);
+    }
+    if (mg_fuse) {
+    	printf(" Fused resid and psinv in tiles of %d rows\n", fuse_rows);
+    }
+    if (mg_fold) {
+    	printf(" Periodic borders written by the stencils\n");
+    }
+
+    u = (grid3 *)malloc((lt+1)*sizeof(grid3));
+    r = (grid3 *)malloc((lt+1)*sizeof(grid3));
+    for (l = lt; l >= 1; l--) {
+    	u[l] = alloc_grid(m1[l], m2[l], m3[l]);
+    	r[l] = alloc_grid(m1[l], m2[l], m3[l]);
     }
+    v = alloc_grid(m1[lt], m2[lt], m3[lt]);
 
     zero3(u[lt],n1,n2,n3);
     zran3(v,n1,n2,n3,nx[lt],ny[lt],lt);
@@ -257,6 +283,15 @@ int main(int argc, char *argv[]) {
 
     timer_stop(T_INIT);
 
+    timer_on = FALSE;
+    if ((fp = fopen("timer.flag", "r")) != NULL) {
+    	fclose(fp);
+    	timer_on = TRUE;
+    }
+    for (l = lt; l >= lb; l--) {
+    	timer_clear(T_LEVEL+l);
+    }
+
     timer_start(T_BENCH);
 
     resid(u[lt],v,r[lt],n1,n2,n3,a,lt);
@@ -320,6 +355,19 @@ int main(int argc, char *argv[]) {
 
     c_print_results((char*)"MG", class_npb, nx[lt], ny[lt], nz[lt], nit, t, mflops, (char*)"          floating point", 
 		    verified, (char*)NPBVERSION, (char*)COMPILETIME, (char*)CS1, (char*)CS2, (char*)CS3, (char*)CS4, (char*)CS5, (char*)CS6, (char*)CS7);
+
+    /*--------------------------------------------------------------------
+    c     time of each level of mg3P, with the threads it ran on
+    c-------------------------------------------------------------------*/
+    if (timer_on) {
+    	printf("\nAdditional timers -\n");
+    	printf(" Level  Grid           Threads       Time\n");
+    	for (l = lt; l >= lb; l--) {
+    	    double tl = timer_read(T_LEVEL+l);
+    	    printf(" %5d  %4dx%4dx%4d  %7d  %9.4f (%5.2f%%)\n", l, nx[l], ny[l], nz[l],
+    		   level_threads((long)m1[l]*m2[l]*m3[l]), tl, t != 0.0 ? tl*100.0/t : 0.0);
+    	}
+    }
     return 0;
 }
 
@@ -364,9 +412,30 @@ static void setup(int *n1, int *n2, int *n3, int lt) {
 }
 
 /*--------------------------------------------------------------------
+c     alloc_grid allocates an n3 x n2 x n1 grid as one block aligned to
+c     GRID_ALIGN bytes.  Rows are rounded up to whole cache lines, so
+c     that each of them starts on one, and then padded with grid_pad
+c     more doubles
 c-------------------------------------------------------------------*/
 
-static void mg3P(double ****u, double ***v, double ****r, double a[4],
+static grid3 alloc_grid(int n1, int n2, int n3) {
+
+    grid3 z;
+    long line = GRID_ALIGN/sizeof(double);
+
+    z.ld1 = (n1 + line - 1)/line*line + grid_pad;
+    z.ld2 = z.ld1*n2;
+    if (posix_memalign((void **)&z.base, GRID_ALIGN, sizeof(double)*z.ld2*n3) != 0) {
+    	perror("Memory allocation error");
+    	exit(1);
+    }
+    return z;
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void mg3P(grid3 *u, grid3 v, grid3 *r, double a[4],
 		 double c[4], int n1, int n2, int n3, int k) {
 
     /*--------------------------------------------------------------------
@@ -383,21 +452,30 @@ static void mg3P(double ****u, double ***v, double ****r, double a[4],
     c     restrict the residual from the find grid to the coarse
     c-------------------------------------------------------------------*/
 
+    /*--------------------------------------------------------------------
+    c     the time of each step goes to the level of the grid it writes
+    c-------------------------------------------------------------------*/
+
     for (k = lt; k >= lb+1; k--) {
     	j = k-1;
+    	if (timer_on) timer_start(T_LEVEL+j);
     	rprj3(r[k], m1[k], m2[k], m3[k],
 	      r[j], m1[j], m2[j], m3[j], k);
+    	if (timer_on) timer_stop(T_LEVEL+j);
     }
 
     k = lb;
     /*--------------------------------------------------------------------
     c     compute an approximate solution on the coarsest grid
     c-------------------------------------------------------------------*/
+    if (timer_on) timer_start(T_LEVEL+k);
     zero3(u[k], m1[k], m2[k], m3[k]);
     psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+    if (timer_on) timer_stop(T_LEVEL+k);
 
     for (k = lb+1; k <= lt-1; k++) {
     	j = k-1;
+    	if (timer_on) timer_start(T_LEVEL+k);
         /*--------------------------------------------------------------------
         c        prolongate from level k-1  to k
         c-------------------------------------------------------------------*/
@@ -407,24 +485,477 @@ static void mg3P(double ****u, double ***v, double ****r, double a[4],
         /*--------------------------------------------------------------------
         c        compute residual for level k
         c-------------------------------------------------------------------*/
-    	resid(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, k);
-        /*--------------------------------------------------------------------
-        c        apply smoother
-        c-------------------------------------------------------------------*/
-    	psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+    	if (mg_fuse) {
+    	    resid_psinv(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, c, k);
+    	} else {
+    	    resid(u[k], r[k], r[k], m1[k], m2[k], m3[k], a, k);
+            /*--------------------------------------------------------------------
+            c        apply smoother
+            c-------------------------------------------------------------------*/
+    	    psinv(r[k], u[k], m1[k], m2[k], m3[k], c, k);
+    	}
+    	if (timer_on) timer_stop(T_LEVEL+k);
     }
 
     j = lt - 1;
     k = lt;
+    if (timer_on) timer_start(T_LEVEL+k);
     interp(u[j], m1[j], m2[j], m3[j], u[lt], n1, n2, n3, k);
-    resid(u[lt], v, r[lt], n1, n2, n3, a, k);
-    psinv(r[lt], u[lt], n1, n2, n3, c, k);
+    if (mg_fuse) {
+    	resid_psinv(u[lt], v, r[lt], n1, n2, n3, a, c, k);
+    } else {
+    	resid(u[lt], v, r[lt], n1, n2, n3, a, k);
+    	psinv(r[lt], u[lt], n1, n2, n3, c, k);
+    }
+    if (timer_on) timer_stop(T_LEVEL+k);
+}
+
+/*--------------------------------------------------------------------
+c     Row kernels.  psinv_row and resid_row apply psinv and resid to
+c     row (i3,i2), rprj3_row computes row (j3,j2) of s from rows i2..i2+2
+c     of planes i3..i3+2 of r, and interp_row adds the interpolation of
+c     row (i3,i2) of z to rows 2*i2 and 2*i2+1 of planes 2*i3 and 2*i3+1
+c     of u.  The scratch rows belong to the caller.  The kernels are
+c     pointers set by simd_setup to the scalar versions below or to the
+c     explicitly vectorized ones that follow them
+c-------------------------------------------------------------------*/
+
+typedef void (*psinv_row_t)( grid3 r, grid3 u, int n1, int i3, int i2, double c[4], double r1[], double r2[] );
+typedef void (*resid_row_t)( grid3 u, grid3 v, grid3 r, int n1, int i3, int i2, double a[4], double u1[], double u2[] );
+typedef void (*rprj3_row_t)( grid3 r, grid3 s, int m1k, int m1j, int i3, int i2, int j3, int j2, int d1, double x1[], double y1[] );
+typedef void (*interp_row_t)( grid3 z, grid3 u, int mm1, int i3, int i2, double z1[], double z2[], double z3[] );
+
+static void psinv_row_scalar( grid3 r, grid3 u, int n1, int i3, int i2, double c[4], double r1[], double r2[] ) {
+
+    int i1;
+
+    for (i1 = 0; i1 < n1; i1++) {
+    	r1[i1] = r(i3,i2-1,i1) + r(i3,i2+1,i1)
+    	    + r(i3-1,i2,i1) + r(i3+1,i2,i1);
+    	r2[i1] = r(i3-1,i2-1,i1) + r(i3-1,i2+1,i1)
+    	    + r(i3+1,i2-1,i1) + r(i3+1,i2+1,i1);
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+    	u(i3,i2,i1) = u(i3,i2,i1)
+    	    + c[0] * r(i3,i2,i1)
+    	    + c[1] * ( r(i3,i2,i1-1) + r(i3,i2,i1+1)
+    		       + r1[i1] )
+    	    + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+        /*--------------------------------------------------------------------
+        c  Assume c(3) = 0    (Enable line below if c(3) not= 0)
+        c---------------------------------------------------------------------
+        c    >                     + c(3) * ( r2(i1-1) + r2(i1+1) )
+        c-------------------------------------------------------------------*/
+    }
+}
+
+static void resid_row_scalar( grid3 u, grid3 v, grid3 r, int n1, int i3, int i2, double a[4], double u1[], double u2[] ) {
+
+    int i1;
+
+    for (i1 = 0; i1 < n1; i1++) {
+    	u1[i1] = u(i3,i2-1,i1) + u(i3,i2+1,i1)
+    	       + u(i3-1,i2,i1) + u(i3+1,i2,i1);
+    	u2[i1] = u(i3-1,i2-1,i1) + u(i3-1,i2+1,i1)
+    	       + u(i3+1,i2-1,i1) + u(i3+1,i2+1,i1);
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+    	r(i3,i2,i1) = v(i3,i2,i1)
+    	    - a[0] * u(i3,i2,i1)
+        /*--------------------------------------------------------------------
+        c  Assume a(1) = 0      (Enable 2 lines below if a(1) not= 0)
+        c---------------------------------------------------------------------
+        c    >                     - a(1) * ( u(i1-1,i2,i3) + u(i1+1,i2,i3)
+        c    >                              + u1(i1) )
+        c-------------------------------------------------------------------*/
+    	    - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+    	    - a[3] * ( u2[i1-1] + u2[i1+1] );
+    }
+}
+
+static void rprj3_row_scalar( grid3 r, grid3 s, int, int m1j, int i3, int i2, int j3, int j2, int d1, double x1[], double y1[] ) {
+
+    int j1, i1;
+    double x2, y2;
+
+    for (j1 = 1; j1 < m1j; j1++) {
+    	i1 = 2*j1-d1;
+        /*C             i1 = 2*j1-1*/
+    	x1[i1] = r(i3+1,i2,i1) + r(i3+1,i2+2,i1)
+    	    + r(i3,i2+1,i1) + r(i3+2,i2+1,i1);
+    	y1[i1] = r(i3,i2,i1) + r(i3+2,i2,i1)
+    	    + r(i3,i2+2,i1) + r(i3+2,i2+2,i1);
+    }
+
+    for (j1 = 1; j1 < m1j-1; j1++) {
+    	i1 = 2*j1-d1;
+        /*C             i1 = 2*j1-1*/
+    	y2 = r(i3,i2,i1+1) + r(i3+2,i2,i1+1)
+    	    + r(i3,i2+2,i1+1) + r(i3+2,i2+2,i1+1);
+    	x2 = r(i3+1,i2,i1+1) + r(i3+1,i2+2,i1+1)
+    	    + r(i3,i2+1,i1+1) + r(i3+2,i2+1,i1+1);
+    	s(j3,j2,j1) =
+    	    0.5 * r(i3+1,i2+1,i1+1)
+    	    + 0.25 * ( r(i3+1,i2+1,i1) + r(i3+1,i2+1,i1+2) + x2)
+    	    + 0.125 * ( x1[i1] + x1[i1+2] + y2)
+    	    + 0.0625 * ( y1[i1] + y1[i1+2] );
+    }
+}
+
+static void interp_row_scalar( grid3 z, grid3 u, int mm1, int i3, int i2, double z1[], double z2[], double z3[] ) {
+
+    int i1;
+
+    for (i1 = 0; i1 < mm1; i1++) {
+    	z1[i1] = z(i3,i2+1,i1) + z(i3,i2,i1);
+    	z2[i1] = z(i3+1,i2,i1) + z(i3,i2,i1);
+    	z3[i1] = z(i3+1,i2+1,i1) + z(i3+1,i2,i1) + z1[i1];
+    }
+    for (i1 = 0; i1 < mm1-1; i1++) {
+    	u(2*i3,2*i2,2*i1) = u(2*i3,2*i2,2*i1)
+    	    +z(i3,i2,i1);
+    	u(2*i3,2*i2,2*i1+1) = u(2*i3,2*i2,2*i1+1)
+    	    +0.5*(z(i3,i2,i1+1)+z(i3,i2,i1));
+    }
+    for (i1 = 0; i1 < mm1-1; i1++) {
+    	u(2*i3,2*i2+1,2*i1) = u(2*i3,2*i2+1,2*i1)
+    	    +0.5 * z1[i1];
+    	u(2*i3,2*i2+1,2*i1+1) = u(2*i3,2*i2+1,2*i1+1)
+    	    +0.25*( z1[i1] + z1[i1+1] );
+    }
+    for (i1 = 0; i1 < mm1-1; i1++) {
+    	u(2*i3+1,2*i2,2*i1) = u(2*i3+1,2*i2,2*i1)
+    	    +0.5 * z2[i1];
+    	u(2*i3+1,2*i2,2*i1+1) = u(2*i3+1,2*i2,2*i1+1)
+    	    +0.25*( z2[i1] + z2[i1+1] );
+    }
+    for (i1 = 0; i1 < mm1-1; i1++) {
+    	u(2*i3+1,2*i2+1,2*i1) = u(2*i3+1,2*i2+1,2*i1)
+    	    +0.25* z3[i1];
+    	u(2*i3+1,2*i2+1,2*i1+1) = u(2*i3+1,2*i2+1,2*i1+1)
+    	    +0.125*( z3[i1] + z3[i1+1] );
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*--------------------------------------------------------------------
+c     The vectorized kernels are written once over simd<W>, vectors of
+c     W doubles with unaligned loads and stores, and compiled for SSE2,
+c     AVX2 and AVX-512F.  Each element goes through the same operations
+c     in the same order as in the scalar kernels, and multiplies are not
+c     contracted into FMAs, so the norms do not depend on the kernels.
+c     The row tails are done one element at a time
+c-------------------------------------------------------------------*/
+
+template <int W> struct simd;
+template <> struct simd<2> {
+    typedef double vd __attribute__((vector_size(16), aligned(8), may_alias));
+    typedef long vl __attribute__((vector_size(16)));
+};
+template <> struct simd<4> {
+    typedef double vd __attribute__((vector_size(32), aligned(8), may_alias));
+    typedef long vl __attribute__((vector_size(32)));
+};
+template <> struct simd<8> {
+    typedef double vd __attribute__((vector_size(64), aligned(8), may_alias));
+    typedef long vl __attribute__((vector_size(64)));
+};
+
+#define VLOAD(p)	(*(const vd *)(p))
+#define VSTORE(p, x)	(*(vd *)(p) = (x))
+
+template <int W>
+static inline __attribute__((always_inline)) void psinv_row_simd( grid3 r, grid3 u, int n1, int i3, int i2, double c[4], double r1[], double r2[] ) {
+
+    typedef typename simd<W>::vd vd;
+    const double *rc = &r(i3,i2,0), *rs = &r(i3,i2-1,0), *rn = &r(i3,i2+1,0);
+    const double *rb = &r(i3-1,i2,0), *rt = &r(i3+1,i2,0);
+    const double *rbs = &r(i3-1,i2-1,0), *rbn = &r(i3-1,i2+1,0);
+    const double *rts = &r(i3+1,i2-1,0), *rtn = &r(i3+1,i2+1,0);
+    double *uc = &u(i3,i2,0);
+    int i1;
+
+    for (i1 = 0; i1+W <= n1; i1 += W) {
+    	VSTORE(&r1[i1], VLOAD(&rs[i1]) + VLOAD(&rn[i1]) + VLOAD(&rb[i1]) + VLOAD(&rt[i1]));
+    	VSTORE(&r2[i1], VLOAD(&rbs[i1]) + VLOAD(&rbn[i1]) + VLOAD(&rts[i1]) + VLOAD(&rtn[i1]));
+    }
+    for (; i1 < n1; i1++) {
+    	r1[i1] = rs[i1] + rn[i1] + rb[i1] + rt[i1];
+    	r2[i1] = rbs[i1] + rbn[i1] + rts[i1] + rtn[i1];
+    }
+    for (i1 = 1; i1+W <= n1-1; i1 += W) {
+    	VSTORE(&uc[i1], VLOAD(&uc[i1])
+    	    + c[0] * VLOAD(&rc[i1])
+    	    + c[1] * ( VLOAD(&rc[i1-1]) + VLOAD(&rc[i1+1]) + VLOAD(&r1[i1]) )
+    	    + c[2] * ( VLOAD(&r2[i1]) + VLOAD(&r1[i1-1]) + VLOAD(&r1[i1+1]) ));
+    }
+    for (; i1 < n1-1; i1++) {
+    	uc[i1] = uc[i1]
+    	    + c[0] * rc[i1]
+    	    + c[1] * ( rc[i1-1] + rc[i1+1] + r1[i1] )
+    	    + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+    }
+}
+
+template <int W>
+static inline __attribute__((always_inline)) void resid_row_simd( grid3 u, grid3 v, grid3 r, int n1, int i3, int i2, double a[4], double u1[], double u2[] ) {
+
+    typedef typename simd<W>::vd vd;
+    const double *uc = &u(i3,i2,0), *us = &u(i3,i2-1,0), *un = &u(i3,i2+1,0);
+    const double *ub = &u(i3-1,i2,0), *ut = &u(i3+1,i2,0);
+    const double *ubs = &u(i3-1,i2-1,0), *ubn = &u(i3-1,i2+1,0);
+    const double *uts = &u(i3+1,i2-1,0), *utn = &u(i3+1,i2+1,0);
+    const double *vc = &v(i3,i2,0);
+    double *rc = &r(i3,i2,0);
+    int i1;
+
+    for (i1 = 0; i1+W <= n1; i1 += W) {
+    	VSTORE(&u1[i1], VLOAD(&us[i1]) + VLOAD(&un[i1]) + VLOAD(&ub[i1]) + VLOAD(&ut[i1]));
+    	VSTORE(&u2[i1], VLOAD(&ubs[i1]) + VLOAD(&ubn[i1]) + VLOAD(&uts[i1]) + VLOAD(&utn[i1]));
+    }
+    for (; i1 < n1; i1++) {
+    	u1[i1] = us[i1] + un[i1] + ub[i1] + ut[i1];
+    	u2[i1] = ubs[i1] + ubn[i1] + uts[i1] + utn[i1];
+    }
+    for (i1 = 1; i1+W <= n1-1; i1 += W) {
+    	VSTORE(&rc[i1], VLOAD(&vc[i1])
+    	    - a[0] * VLOAD(&uc[i1])
+    	    - a[2] * ( VLOAD(&u2[i1]) + VLOAD(&u1[i1-1]) + VLOAD(&u1[i1+1]) )
+    	    - a[3] * ( VLOAD(&u2[i1-1]) + VLOAD(&u2[i1+1]) ));
+    }
+    for (; i1 < n1-1; i1++) {
+    	rc[i1] = vc[i1]
+    	    - a[0] * uc[i1]
+    	    - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+    	    - a[3] * ( u2[i1-1] + u2[i1+1] );
+    }
+}
+
+/*--------------------------------------------------------------------
+c     rprj3_row_simd computes x1 and y1 at every point of the fine row,
+c     where the sums x2 and y2 of the scalar kernel are x1 and y1 at
+c     i1+1, then the projection at every point, overwriting x1 (each
+c     step reads x1 only at and after the points it writes), and keeps
+c     the points 2*j1-d1
+c-------------------------------------------------------------------*/
+
+template <int W>
+static inline __attribute__((always_inline)) void rprj3_row_simd( grid3 r, grid3 s, int m1k, int m1j, int i3, int i2, int j3, int j2, int d1, double x1[], double y1[] ) {
+
+    typedef typename simd<W>::vd vd;
+    const double *r00 = &r(i3,i2,0), *r02 = &r(i3,i2+2,0), *r20 = &r(i3+2,i2,0), *r22 = &r(i3+2,i2+2,0);
+    const double *r10 = &r(i3+1,i2,0), *r12 = &r(i3+1,i2+2,0), *r01 = &r(i3,i2+1,0), *r21 = &r(i3+2,i2+1,0);
+    const double *r11 = &r(i3+1,i2+1,0);
+    double *sc = &s(j3,j2,0);
+    int i1, j1;
+
+    for (i1 = 0; i1+W <= m1k; i1 += W) {
+    	VSTORE(&x1[i1], VLOAD(&r10[i1]) + VLOAD(&r12[i1]) + VLOAD(&r01[i1]) + VLOAD(&r21[i1]));
+    	VSTORE(&y1[i1], VLOAD(&r00[i1]) + VLOAD(&r20[i1]) + VLOAD(&r02[i1]) + VLOAD(&r22[i1]));
+    }
+    for (; i1 < m1k; i1++) {
+    	x1[i1] = r10[i1] + r12[i1] + r01[i1] + r21[i1];
+    	y1[i1] = r00[i1] + r20[i1] + r02[i1] + r22[i1];
+    }
+    for (i1 = 0; i1+W <= m1k-2; i1 += W) {
+    	VSTORE(&x1[i1],
+    	    0.5 * VLOAD(&r11[i1+1])
+    	    + 0.25 * ( VLOAD(&r11[i1]) + VLOAD(&r11[i1+2]) + VLOAD(&x1[i1+1]) )
+    	    + 0.125 * ( VLOAD(&x1[i1]) + VLOAD(&x1[i1+2]) + VLOAD(&y1[i1+1]) )
+    	    + 0.0625 * ( VLOAD(&y1[i1]) + VLOAD(&y1[i1+2]) ));
+    }
+    for (; i1 < m1k-2; i1++) {
+    	x1[i1] =
+    	    0.5 * r11[i1+1]
+    	    + 0.25 * ( r11[i1] + r11[i1+2] + x1[i1+1] )
+    	    + 0.125 * ( x1[i1] + x1[i1+2] + y1[i1+1] )
+    	    + 0.0625 * ( y1[i1] + y1[i1+2] );
+    }
+    for (j1 = 1; j1 < m1j-1; j1++) {
+    	sc[j1] = x1[2*j1-d1];
+    }
+}
+
+/*--------------------------------------------------------------------
+c     interp_row_simd computes the contributions to the even and the odd
+c     points of each fine row as two vectors, and interleaves them with
+c     the shuffles lo and hi before adding them to u
+c-------------------------------------------------------------------*/
+
+template <int W>
+static inline __attribute__((always_inline)) void interp_row_simd( grid3 z, grid3 u, int mm1, int i3, int i2, double z1[], double z2[], double z3[] ) {
+
+    typedef typename simd<W>::vd vd;
+    typedef typename simd<W>::vl vl;
+    const double *z00 = &z(i3,i2,0), *z01 = &z(i3,i2+1,0), *z10 = &z(i3+1,i2,0), *z11 = &z(i3+1,i2+1,0);
+    double *u00 = &u(2*i3,2*i2,0), *u01 = &u(2*i3,2*i2+1,0);
+    double *u10 = &u(2*i3+1,2*i2,0), *u11 = &u(2*i3+1,2*i2+1,0);
+    vl lo, hi;
+    vd e, o;
+    int i1, l;
+
+    for (l = 0; l < W; l++) {
+    	lo[l] = l/2 + (l%2)*W;
+    	hi[l] = lo[l] + W/2;
+    }
+
+    for (i1 = 0; i1+W <= mm1; i1 += W) {
+    	VSTORE(&z1[i1], VLOAD(&z01[i1]) + VLOAD(&z00[i1]));
+    	VSTORE(&z2[i1], VLOAD(&z10[i1]) + VLOAD(&z00[i1]));
+    	VSTORE(&z3[i1], VLOAD(&z11[i1]) + VLOAD(&z10[i1]) + VLOAD(&z1[i1]));
+    }
+    for (; i1 < mm1; i1++) {
+    	z1[i1] = z01[i1] + z00[i1];
+    	z2[i1] = z10[i1] + z00[i1];
+    	z3[i1] = z11[i1] + z10[i1] + z1[i1];
+    }
+    for (i1 = 0; i1+W <= mm1-1; i1 += W) {
+    	e = VLOAD(&z00[i1]);
+    	o = 0.5*(VLOAD(&z00[i1+1])+VLOAD(&z00[i1]));
+    	VSTORE(&u00[2*i1], VLOAD(&u00[2*i1]) + __builtin_shuffle(e, o, lo));
+    	VSTORE(&u00[2*i1+W], VLOAD(&u00[2*i1+W]) + __builtin_shuffle(e, o, hi));
+    	e = 0.5 * VLOAD(&z1[i1]);
+    	o = 0.25*( VLOAD(&z1[i1]) + VLOAD(&z1[i1+1]) );
+    	VSTORE(&u01[2*i1], VLOAD(&u01[2*i1]) + __builtin_shuffle(e, o, lo));
+    	VSTORE(&u01[2*i1+W], VLOAD(&u01[2*i1+W]) + __builtin_shuffle(e, o, hi));
+    	e = 0.5 * VLOAD(&z2[i1]);
+    	o = 0.25*( VLOAD(&z2[i1]) + VLOAD(&z2[i1+1]) );
+    	VSTORE(&u10[2*i1], VLOAD(&u10[2*i1]) + __builtin_shuffle(e, o, lo));
+    	VSTORE(&u10[2*i1+W], VLOAD(&u10[2*i1+W]) + __builtin_shuffle(e, o, hi));
+    	e = 0.25* VLOAD(&z3[i1]);
+    	o = 0.125*( VLOAD(&z3[i1]) + VLOAD(&z3[i1+1]) );
+    	VSTORE(&u11[2*i1], VLOAD(&u11[2*i1]) + __builtin_shuffle(e, o, lo));
+    	VSTORE(&u11[2*i1+W], VLOAD(&u11[2*i1+W]) + __builtin_shuffle(e, o, hi));
+    }
+    for (; i1 < mm1-1; i1++) {
+    	u00[2*i1] = u00[2*i1] + z00[i1];
+    	u00[2*i1+1] = u00[2*i1+1] + 0.5*(z00[i1+1]+z00[i1]);
+    	u01[2*i1] = u01[2*i1] + 0.5 * z1[i1];
+    	u01[2*i1+1] = u01[2*i1+1] + 0.25*( z1[i1] + z1[i1+1] );
+    	u10[2*i1] = u10[2*i1] + 0.5 * z2[i1];
+    	u10[2*i1+1] = u10[2*i1+1] + 0.25*( z2[i1] + z2[i1+1] );
+    	u11[2*i1] = u11[2*i1] + 0.25* z3[i1];
+    	u11[2*i1+1] = u11[2*i1+1] + 0.125*( z3[i1] + z3[i1+1] );
+    }
+}
+
+#undef VLOAD
+#undef VSTORE
+
+/* one set of kernels for the instruction set isa, with vectors of w doubles */
+#define SIMD_KERNELS(isa, w, attr) \
+    attr static void psinv_row_##isa( grid3 r, grid3 u, int n1, int i3, int i2, double c[4], double r1[], double r2[] ) { \
+    	psinv_row_simd<w>(r, u, n1, i3, i2, c, r1, r2); \
+    } \
+    attr static void resid_row_##isa( grid3 u, grid3 v, grid3 r, int n1, int i3, int i2, double a[4], double u1[], double u2[] ) { \
+    	resid_row_simd<w>(u, v, r, n1, i3, i2, a, u1, u2); \
+    } \
+    attr static void rprj3_row_##isa( grid3 r, grid3 s, int m1k, int m1j, int i3, int i2, int j3, int j2, int d1, double x1[], double y1[] ) { \
+    	rprj3_row_simd<w>(r, s, m1k, m1j, i3, i2, j3, j2, d1, x1, y1); \
+    } \
+    attr static void interp_row_##isa( grid3 z, grid3 u, int mm1, int i3, int i2, double z1[], double z2[], double z3[] ) { \
+    	interp_row_simd<w>(z, u, mm1, i3, i2, z1, z2, z3); \
+    }
+
+SIMD_KERNELS(sse2, 2, )
+SIMD_KERNELS(avx2, 4, __attribute__((target("avx2"))))
+SIMD_KERNELS(avx512, 8, __attribute__((target("avx512f"), optimize("fp-contract=off"))))
+
+#undef SIMD_KERNELS
+#endif
+
+static psinv_row_t psinv_row = psinv_row_scalar;
+static resid_row_t resid_row = resid_row_scalar;
+static rprj3_row_t rprj3_row = rprj3_row_scalar;
+static interp_row_t interp_row = interp_row_scalar;
+
+/*--------------------------------------------------------------------
+c     simd_setup picks the kernels of the widest instruction set the
+c     cpu has, up to isa (sse2, avx2 or avx512; auto for no limit, or
+c     scalar), and returns the name of the set it picked
+c-------------------------------------------------------------------*/
+
+static const char *simd_setup(const char *isa) {
+
+    if (strcmp(isa, "scalar") == 0) {
+    	return "scalar";
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2");
+
+    if (strcmp(isa, "sse2") == 0) {
+    	avx512 = avx2 = false;
+    } else if (strcmp(isa, "avx2") == 0) {
+    	avx512 = false;
+    }
+    if (avx512) {
+    	psinv_row = psinv_row_avx512;
+    	resid_row = resid_row_avx512;
+    	rprj3_row = rprj3_row_avx512;
+    	interp_row = interp_row_avx512;
+    	return "avx512";
+    }
+    if (avx2) {
+    	psinv_row = psinv_row_avx2;
+    	resid_row = resid_row_avx2;
+    	rprj3_row = rprj3_row_avx2;
+    	interp_row = interp_row_avx2;
+    	return "avx2";
+    }
+    psinv_row = psinv_row_sse2;
+    resid_row = resid_row_sse2;
+    rprj3_row = rprj3_row_sse2;
+    interp_row = interp_row_sse2;
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/*--------------------------------------------------------------------
+c     level_threads gives the threads of a grid of points points: one
+c     per mg_cutoff points, at least one and at most num_workers (all
+c     of them when mg_cutoff is 0)
+c-------------------------------------------------------------------*/
+
+static int level_threads(long points) {
+
+    if (mg_cutoff == 0) {
+    	return num_workers;
+    }
+    return (int)max(1L, min((long)num_workers, points/mg_cutoff));
 }
 
 /*--------------------------------------------------------------------
+c     level_for runs body over the planes [lo, hi) of a grid of points
+c     points.  With mg_cutoff set, the planes are cut in one slice per
+c     thread of level_threads, so a coarse level runs on a few threads
+c     and one under mg_cutoff points runs here, without a parallel_for
 c-------------------------------------------------------------------*/
 
-static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4], int k) {
+template <typename Body>
+static void level_for(size_t lo, size_t hi, long points, const Body &body) {
+
+    if (mg_cutoff == 0) {
+    	tbb::parallel_for(tbb::blocked_range<size_t>(lo, hi), body);
+    	return;
+    }
+    int t = min(level_threads(points), (int)(hi-lo));
+    if (t <= 1) {
+    	body(tbb::blocked_range<size_t>(lo, hi));
+    	return;
+    }
+    tbb::parallel_for(0, t, [&](int p) {
+    	body(tbb::blocked_range<size_t>(lo + (hi-lo)*p/t, lo + (hi-lo)*(p+1)/t));
+    });
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void psinv( grid3 r, grid3 u, int n1, int n2, int n3, double c[4], int k) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -441,39 +972,20 @@ static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4]
     c     based machines.  
     c-------------------------------------------------------------------*/
 
-    int i3, i2, i1;
-    double r1[M], r2[M];
-
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, n3-1), [&](const tbb::blocked_range<size_t>& r_tbb){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r_tbb){
         double r1[M], r2[M];
         for (int i3 = r_tbb.begin(); i3 != r_tbb.end(); i3++) {
         	for (int i2 = 1; i2 < n2-1; i2++) {
-                    for (int i1 = 0; i1 < n1; i1++) {
-        		r1[i1] = r[i3][i2-1][i1] + r[i3][i2+1][i1]
-        		    + r[i3-1][i2][i1] + r[i3+1][i2][i1];
-        		r2[i1] = r[i3-1][i2-1][i1] + r[i3-1][i2+1][i1]
-        		    + r[i3+1][i2-1][i1] + r[i3+1][i2+1][i1];
-        	    }
-                    for (int i1 = 1; i1 < n1-1; i1++) {
-        		u[i3][i2][i1] = u[i3][i2][i1]
-        		    + c[0] * r[i3][i2][i1]
-        		    + c[1] * ( r[i3][i2][i1-1] + r[i3][i2][i1+1]
-        			       + r1[i1] )
-        		    + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
-                /*--------------------------------------------------------------------
-                c  Assume c(3) = 0    (Enable line below if c(3) not= 0)
-                c---------------------------------------------------------------------
-                c    >                     + c(3) * ( r2(i1-1) + r2(i1+1) )
-                c-------------------------------------------------------------------*/
-        	    }
+        	    psinv_row(r, u, n1, i3, i2, c, r1, r2);
         	}
+        	if (mg_fold) comm3_plane(u, n1, n2, n3, i3);
         }
     });
 
     /*--------------------------------------------------------------------
     c     exchange boundary points
     c-------------------------------------------------------------------*/
-    comm3(u,n1,n2,n3,k);
+    if (!mg_fold) comm3(u,n1,n2,n3,k);
 
     if (debug_vec[0] >= 1 ) {
     	rep_nrm(u,n1,n2,n3,(char*)"   psinv",k);
@@ -487,7 +999,7 @@ static void psinv( double ***r, double ***u, int n1, int n2, int n3, double c[4]
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3, double a[4], int k ) {
+static void resid( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -505,38 +1017,89 @@ static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3
     c     based machines.  
     c-------------------------------------------------------------------*/
 
-    
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, n3-1), [&](const tbb::blocked_range<size_t>& r_tbb){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r_tbb){
         double u1[M], u2[M];
         for (int i3 = r_tbb.begin(); i3 != r_tbb.end(); i3++) {
         	for (int i2 = 1; i2 < n2-1; i2++) {
-                for (int i1 = 0; i1 < n1; i1++) {
-            		u1[i1] = u[i3][i2-1][i1] + u[i3][i2+1][i1]
-            		       + u[i3-1][i2][i1] + u[i3+1][i2][i1];
-            		u2[i1] = u[i3-1][i2-1][i1] + u[i3-1][i2+1][i1]
-            		       + u[i3+1][i2-1][i1] + u[i3+1][i2+1][i1];
-            	    }
-            	    for (int i1 = 1; i1 < n1-1; i1++) {
-            		r[i3][i2][i1] = v[i3][i2][i1]
-            		    - a[0] * u[i3][i2][i1]
-                    /*--------------------------------------------------------------------
-                    c  Assume a(1) = 0      (Enable 2 lines below if a(1) not= 0)
-                    c---------------------------------------------------------------------
-                    c    >                     - a(1) * ( u(i1-1,i2,i3) + u(i1+1,i2,i3)
-                    c    >                              + u1(i1) )
-                    c-------------------------------------------------------------------*/
-            		- a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
-            		      - a[3] * ( u2[i1-1] + u2[i1+1] );
-        	    }
+        	    resid_row(u, v, r, n1, i3, i2, a, u1, u2);
         	}
+        	if (mg_fold) comm3_plane(r, n1, n2, n3, i3);
         }
     });
 
     /*--------------------------------------------------------------------
     c     exchange boundary data
     c--------------------------------------------------------------------*/
+    if (!mg_fold) comm3(r,n1,n2,n3,k);
+
+    if (debug_vec[0] >= 1 ) {
+    	rep_nrm(r,n1,n2,n3,(char*)"   resid",k);
+    }
+
+    if ( debug_vec[2] >= k ) {
+    	showall(r,n1,n2,n3);
+    }
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void resid_psinv( grid3 u, grid3 v, grid3 r, int n1, int n2, int n3, double a[4], double c[4], int k ) {
+
+    /*--------------------------------------------------------------------
+    c-------------------------------------------------------------------*/
+
+    /*--------------------------------------------------------------------
+    c     resid_psinv does resid followed by psinv in one pass.  The rows
+    c     are split in tiles of fuse_rows, and each tile goes down the
+    c     planes computing r; once plane i3 of r is done, plane i3-1 of u
+    c     is no longer read by resid and is smoothed while r is still in
+    c     cache.  The first and last row of a tile (which the neighbouring
+    c     tiles read) and the planes 1 and n3-2 (which need the periodic
+    c     planes of r) are smoothed in a second pass, after comm3(r).
+    c     Every point is computed as by resid and psinv.  The tiles are
+    c     made shorter than fuse_rows when there would be fewer of them
+    c     than threads, down to one row each, so up to n2-2 threads work
+    c     on the first pass; short tiles leave more rows to the second.
+    c-------------------------------------------------------------------*/
+
+    int threads = level_threads((long)n1*n2*n3);
+    int rows = min(fuse_rows, (n2-2 + threads-1)/threads);
+    int ntiles = (n2-2 + rows-1)/rows;
+
+    level_for(0, ntiles, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r_tbb){
+        double u1[M], u2[M], r1[M], r2[M];
+        for (int t = r_tbb.begin(); t != r_tbb.end(); t++) {
+            int c0 = 1 + t*rows, c1 = min(c0+rows, n2-1);
+            for (int i3 = 1; i3 < n3-1; i3++) {
+                for (int i2 = c0; i2 < c1; i2++) {
+                    resid_row(u, v, r, n1, i3, i2, a, u1, u2);
+                    r(i3,i2,n1-1) = r(i3,i2,1);
+                    r(i3,i2,0) = r(i3,i2,n1-2);
+                }
+                if (i3 >= 3) {
+                    for (int i2 = c0+1; i2 < c1-1; i2++) {
+                        psinv_row(r, u, n1, i3-1, i2, c, r1, r2);
+                    }
+                }
+            }
+        }
+    });
     comm3(r,n1,n2,n3,k);
 
+    level_for(1, n3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r_tbb){
+        double r1[M], r2[M];
+        for (int i3 = r_tbb.begin(); i3 != r_tbb.end(); i3++) {
+            for (int i2 = 1; i2 < n2-1; i2++) {
+                if (i3 == 1 || i3 == n3-2 || (i2-1)%rows == 0 || (i2-1)%rows == rows-1 || i2 == n2-2) {
+                    psinv_row(r, u, n1, i3, i2, c, r1, r2);
+                }
+            }
+            if (mg_fold) comm3_plane(u, n1, n2, n3, i3);
+        }
+    });
+    if (!mg_fold) comm3(u,n1,n2,n3,k);
+
     if (debug_vec[0] >= 1 ) {
     	rep_nrm(r,n1,n2,n3,(char*)"   resid",k);
     }
@@ -544,12 +1107,20 @@ static void resid( double ***u, double ***v, double ***r, int n1, int n2, int n3
     if ( debug_vec[2] >= k ) {
     	showall(r,n1,n2,n3);
     }
+
+    if (debug_vec[0] >= 1 ) {
+    	rep_nrm(u,n1,n2,n3,(char*)"   psinv",k);
+    }
+
+    if ( debug_vec[3] >= k ) {
+    	showall(u,n1,n2,n3);
+    }
 }
 
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j, int m2j, int m3j, int k ) {
+static void rprj3( grid3 r, int m1k, int m2k, int m3k, grid3 s, int m1j, int m2j, int m3j, int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -586,9 +1157,9 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
         d3 = 1;
     }
 
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, m3j-1), [&](const tbb::blocked_range<size_t>& r_tbb){
-        int j3, j2, j1, i3, i2, i1;
-        double x1[M], y1[M], x2, y2;
+    level_for(1, m3j-1, (long)m1j*m2j*m3j, [&](const tbb::blocked_range<size_t>& r_tbb){
+        int j3, j2, i3, i2;
+        double x1[M], y1[M];
 
         for (j3 = r_tbb.begin(); j3 != r_tbb.end(); j3++) {
         	i3 = 2*j3-d3;
@@ -596,33 +1167,12 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
     	    for (j2 = 1; j2 < m2j-1; j2++) {
                 i2 = 2*j2-d2;
                 /*C  i2 = 2*j2-1*/
-
-                for (j1 = 1; j1 < m1j; j1++) {
-            		i1 = 2*j1-d1;
-                /*C             i1 = 2*j1-1*/
-            		x1[i1] = r[i3+1][i2][i1] + r[i3+1][i2+2][i1]
-            		    + r[i3][i2+1][i1] + r[i3+2][i2+1][i1];
-            		y1[i1] = r[i3][i2][i1] + r[i3+2][i2][i1]
-            		    + r[i3][i2+2][i1] + r[i3+2][i2+2][i1];
-        	    }
-
-                for (j1 = 1; j1 < m1j-1; j1++) {
-            		i1 = 2*j1-d1;
-                    /*C             i1 = 2*j1-1*/
-            		y2 = r[i3][i2][i1+1] + r[i3+2][i2][i1+1]
-            		    + r[i3][i2+2][i1+1] + r[i3+2][i2+2][i1+1];
-            		x2 = r[i3+1][i2][i1+1] + r[i3+1][i2+2][i1+1]
-            		    + r[i3][i2+1][i1+1] + r[i3+2][i2+1][i1+1];
-            		s[j3][j2][j1] =
-            		    0.5 * r[i3+1][i2+1][i1+1]
-            		    + 0.25 * ( r[i3+1][i2+1][i1] + r[i3+1][i2+1][i1+2] + x2)
-            		    + 0.125 * ( x1[i1] + x1[i1+2] + y2)
-            		    + 0.0625 * ( y1[i1] + y1[i1+2] );
-        	    }
+                rprj3_row(r, s, m1k, m1j, i3, i2, j3, j2, d1, x1, y1);
     	    }
+    	    if (mg_fold) comm3_plane(s, m1j, m2j, m3j, j3);
         }
     });
-    comm3(s,m1j,m2j,m3j,k-1);
+    if (!mg_fold) comm3(s,m1j,m2j,m3j,k-1);
 
     if (debug_vec[0] >= 1 ) {
     	rep_nrm(s,m1j,m2j,m3j,(char*)"   rprj3",k-1);
@@ -636,7 +1186,7 @@ static void rprj3( double ***r, int m1k, int m2k, int m3k, double ***s, int m1j,
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1, int n2, int n3, int k ) {
+static void interp( grid3 z, int mm1, int mm2, int mm3, grid3 u, int n1, int n2, int n3, int k ) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -663,40 +1213,12 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
 
     double z1[M], z2[M], z3[M];
     if ( n1 != 3 && n2 != 3 && n3 != 3 ) {
-        tbb::parallel_for(tbb::blocked_range<size_t>(0, mm3-1), [&](const tbb::blocked_range<size_t>& r_tbb){
+        level_for(0, mm3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r_tbb){
             double z1[M], z2[M], z3[M];
 
         	for (int i3 = r_tbb.begin(); i3 != r_tbb.end(); i3++) {
                 for (int i2 = 0; i2 < mm2-1; i2++) {
-            		for (int i1 = 0; i1 < mm1; i1++) {
-            		    z1[i1] = z[i3][i2+1][i1] + z[i3][i2][i1];
-            		    z2[i1] = z[i3+1][i2][i1] + z[i3][i2][i1];
-            		    z3[i1] = z[i3+1][i2+1][i1] + z[i3+1][i2][i1] + z1[i1];
-            		}
-            		for (int i1 = 0; i1 < mm1-1; i1++) {
-            		    u[2*i3][2*i2][2*i1] = u[2*i3][2*i2][2*i1]
-            			+z[i3][i2][i1];
-            		    u[2*i3][2*i2][2*i1+1] = u[2*i3][2*i2][2*i1+1]
-            			+0.5*(z[i3][i2][i1+1]+z[i3][i2][i1]);
-            		}
-            		for (int i1 = 0; i1 < mm1-1; i1++) {
-            		    u[2*i3][2*i2+1][2*i1] = u[2*i3][2*i2+1][2*i1]
-            			+0.5 * z1[i1];
-            		    u[2*i3][2*i2+1][2*i1+1] = u[2*i3][2*i2+1][2*i1+1]
-            			+0.25*( z1[i1] + z1[i1+1] );
-            		}
-            		for (int i1 = 0; i1 < mm1-1; i1++) {
-            		    u[2*i3+1][2*i2][2*i1] = u[2*i3+1][2*i2][2*i1]
-            			+0.5 * z2[i1];
-            		    u[2*i3+1][2*i2][2*i1+1] = u[2*i3+1][2*i2][2*i1+1]
-            			+0.25*( z2[i1] + z2[i1+1] );
-            		}
-            		for (int i1 = 0; i1 < mm1-1; i1++) {
-            		    u[2*i3+1][2*i2+1][2*i1] = u[2*i3+1][2*i2+1][2*i1]
-            			+0.25* z3[i1];
-            		    u[2*i3+1][2*i2+1][2*i1+1] = u[2*i3+1][2*i2+1][2*i1+1]
-            			+0.125*( z3[i1] + z3[i1+1] );
-            		}
+                    interp_row(z, u, mm1, i3, i2, z1, z2, z3);
         	    }
         	}
         });
@@ -726,27 +1248,27 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
 	    for ( i3 = d3; i3 <= mm3-1; i3++) {
             for ( i2 = d2; i2 <= mm2-1; i2++) {
         		for ( i1 = d1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-d3-1][2*i2-d2-1][2*i1-d1-1] =
-        			u[2*i3-d3-1][2*i2-d2-1][2*i1-d1-1]
-        			+z[i3-1][i2-1][i1-1];
+        		    u(2*i3-d3-1,2*i2-d2-1,2*i1-d1-1) =
+        			u(2*i3-d3-1,2*i2-d2-1,2*i1-d1-1)
+        			+z(i3-1,i2-1,i1-1);
         		}
         		for ( i1 = 1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-d3-1][2*i2-d2-1][2*i1-t1-1] =
-        			u[2*i3-d3-1][2*i2-d2-1][2*i1-t1-1]
-        			+0.5*(z[i3-1][i2-1][i1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-d3-1,2*i2-d2-1,2*i1-t1-1) =
+        			u(2*i3-d3-1,2*i2-d2-1,2*i1-t1-1)
+        			+0.5*(z(i3-1,i2-1,i1)+z(i3-1,i2-1,i1-1));
         		}
 	        }
             for ( i2 = 1; i2 <= mm2-1; i2++) {
         		for ( i1 = d1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-d3-1][2*i2-t2-1][2*i1-d1-1] =
-        			u[2*i3-d3-1][2*i2-t2-1][2*i1-d1-1]
-        			+0.5*(z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-d3-1,2*i2-t2-1,2*i1-d1-1) =
+        			u(2*i3-d3-1,2*i2-t2-1,2*i1-d1-1)
+        			+0.5*(z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
         		}
                 for ( i1 = 1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-d3-1][2*i2-t2-1][2*i1-t1-1] =
-        			u[2*i3-d3-1][2*i2-t2-1][2*i1-t1-1]
-        			+0.25*(z[i3-1][i2][i1]+z[i3-1][i2-1][i1]
-        			       +z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-d3-1,2*i2-t2-1,2*i1-t1-1) =
+        			u(2*i3-d3-1,2*i2-t2-1,2*i1-t1-1)
+        			+0.25*(z(i3-1,i2,i1)+z(i3-1,i2-1,i1)
+        			       +z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
 	            }
 	       }
 	    }
@@ -754,31 +1276,31 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
 	    for ( i3 = 1; i3 <= mm3-1; i3++) {
             for ( i2 = d2; i2 <= mm2-1; i2++) {
         		for ( i1 = d1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-t3-1][2*i2-d2-1][2*i1-d1-1] =
-        			u[2*i3-t3-1][2*i2-d2-1][2*i1-d1-1]
-        			+0.5*(z[i3][i2-1][i1-1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-t3-1,2*i2-d2-1,2*i1-d1-1) =
+        			u(2*i3-t3-1,2*i2-d2-1,2*i1-d1-1)
+        			+0.5*(z(i3,i2-1,i1-1)+z(i3-1,i2-1,i1-1));
         		}
         		for ( i1 = 1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-t3-1][2*i2-d2-1][2*i1-t1-1] =
-        			u[2*i3-t3-1][2*i2-d2-1][2*i1-t1-1]
-        			+0.25*(z[i3][i2-1][i1]+z[i3][i2-1][i1-1]
-        			       +z[i3-1][i2-1][i1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-t3-1,2*i2-d2-1,2*i1-t1-1) =
+        			u(2*i3-t3-1,2*i2-d2-1,2*i1-t1-1)
+        			+0.25*(z(i3,i2-1,i1)+z(i3,i2-1,i1-1)
+        			       +z(i3-1,i2-1,i1)+z(i3-1,i2-1,i1-1));
         		}
             }
     	    for ( i2 = 1; i2 <= mm2-1; i2++) {
         		for ( i1 = d1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-t3-1][2*i2-t2-1][2*i1-d1-1] =
-        			u[2*i3-t3-1][2*i2-t2-1][2*i1-d1-1]
-        			+0.25*(z[i3][i2][i1-1]+z[i3][i2-1][i1-1]
-        			       +z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-t3-1,2*i2-t2-1,2*i1-d1-1) =
+        			u(2*i3-t3-1,2*i2-t2-1,2*i1-d1-1)
+        			+0.25*(z(i3,i2,i1-1)+z(i3,i2-1,i1-1)
+        			       +z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
         		}
         		for ( i1 = 1; i1 <= mm1-1; i1++) {
-        		    u[2*i3-t3-1][2*i2-t2-1][2*i1-t1-1] =
-        			u[2*i3-t3-1][2*i2-t2-1][2*i1-t1-1]
-        			+0.125*(z[i3][i2][i1]+z[i3][i2-1][i1]
-        				+z[i3][i2][i1-1]+z[i3][i2-1][i1-1]
-        				+z[i3-1][i2][i1]+z[i3-1][i2-1][i1]
-        				+z[i3-1][i2][i1-1]+z[i3-1][i2-1][i1-1]);
+        		    u(2*i3-t3-1,2*i2-t2-1,2*i1-t1-1) =
+        			u(2*i3-t3-1,2*i2-t2-1,2*i1-t1-1)
+        			+0.125*(z(i3,i2,i1)+z(i3,i2-1,i1)
+        				+z(i3,i2,i1-1)+z(i3,i2-1,i1-1)
+        				+z(i3-1,i2,i1)+z(i3-1,i2-1,i1)
+        				+z(i3-1,i2,i1-1)+z(i3-1,i2-1,i1-1));
         		}
     	    }
 	    }
@@ -796,7 +1318,7 @@ static void interp( double ***z, int mm1, int mm2, int mm3, double ***u, int n1,
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz) {
+static void norm2u3(grid3 r, int n1, int n2, int n3, double *rnm2, double *rnmu, int nx, int ny, int nz) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -822,8 +1344,8 @@ static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *r
         for (int i3 = r_tbb.begin(); i3 != r_tbb.end(); i3++) {
         	for (int i2 = 1; i2 < n2-1; i2++) {
                 for (int i1 = 1; i1 < n1-1; i1++) {
-            		p_s_tbb = p_s_tbb + r[i3][i2][i1] * r[i3][i2][i1];
-            		tmp = fabs(r[i3][i2][i1]);
+            		p_s_tbb = p_s_tbb + r(i3,i2,i1) * r(i3,i2,i1);
+            		tmp = fabs(r(i3,i2,i1));
             		if (tmp > p_a_tbb) p_a_tbb = tmp;
             	}
         	}
@@ -847,7 +1369,7 @@ static void norm2u3(double ***r, int n1, int n2, int n3, double *rnm2, double *r
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk) {
+static void rep_nrm(grid3 u, int n1, int n2, int n3, char *title, int kk) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -864,7 +1386,7 @@ static void rep_nrm(double ***u, int n1, int n2, int n3, char *title, int kk) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void comm3(double ***u, int n1, int n2, int n3, int kk) {
+static void comm3(grid3 u, int n1, int n2, int n3, int kk) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -875,29 +1397,29 @@ static void comm3(double ***u, int n1, int n2, int n3, int kk) {
 
     int i1, i2, i3;
     /* axis = 1 */
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, n3-1), [&](const tbb::blocked_range<size_t>& r){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r){
         for (int i3 = r.begin(); i3 != r.end(); i3++) {
         	for (int i2 = 1; i2 < n2-1; i2++) {
-        	    u[i3][i2][n1-1] = u[i3][i2][1];
-        	    u[i3][i2][0] = u[i3][i2][n1-2];
+        	    u(i3,i2,n1-1) = u(i3,i2,1);
+        	    u(i3,i2,0) = u(i3,i2,n1-2);
         	}
         }
     });
     /* axis = 2 */
-    tbb::parallel_for(tbb::blocked_range<size_t>(1, n3-1), [&](const tbb::blocked_range<size_t>& r){
+    level_for(1, n3-1, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r){
         for (int i3 = r.begin(); i3 != r.end(); i3++) {
         	for (int i1 = 0; i1 < n1; i1++) {
-        	    u[i3][n2-1][i1] = u[i3][1][i1];
-        	    u[i3][0][i1] = u[i3][n2-2][i1];
+        	    u(i3,n2-1,i1) = u(i3,1,i1);
+        	    u(i3,0,i1) = u(i3,n2-2,i1);
         	}
         }
     });
     /* axis = 3 */
-    tbb::parallel_for(tbb::blocked_range<size_t>(0, n2), [&](const tbb::blocked_range<size_t>& r){
+    level_for(0, n2, (long)n1*n2*n3, [&](const tbb::blocked_range<size_t>& r){
         for (int i2 = r.begin(); i2 != r.end(); i2++) {
         	for (int i1 = 0; i1 < n1; i1++) {
-        	    u[n3-1][i2][i1] = u[1][i2][i1];
-        	    u[0][i2][i1] = u[n3-2][i2][i1];
+        	    u(n3-1,i2,i1) = u(1,i2,i1);
+        	    u(0,i2,i1) = u(n3-2,i2,i1);
         	}
         }
     });
@@ -906,7 +1428,51 @@ static void comm3(double ***u, int n1, int n2, int n3, int kk) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
+static void comm3_plane(grid3 u, int n1, int n2, int n3, int i3) {
+
+    /*--------------------------------------------------------------------
+    c-------------------------------------------------------------------*/
+
+    /*--------------------------------------------------------------------
+    c     comm3_plane does the part of comm3 that depends on plane i3,
+    c     for a stencil that has just finished it: the borders of the
+    c     plane and, for planes 1 and n3-2, the periodic plane made of
+    c     them.  Called on every plane, it leaves u as comm3 does
+    c-------------------------------------------------------------------*/
+
+    int i1, i2;
+
+    /* axis = 1 */
+    for (i2 = 1; i2 < n2-1; i2++) {
+    	u(i3,i2,n1-1) = u(i3,i2,1);
+    	u(i3,i2,0) = u(i3,i2,n1-2);
+    }
+    /* axis = 2 */
+    for (i1 = 0; i1 < n1; i1++) {
+    	u(i3,n2-1,i1) = u(i3,1,i1);
+    	u(i3,0,i1) = u(i3,n2-2,i1);
+    }
+    /* axis = 3 */
+    if (i3 == 1) {
+    	for (i2 = 0; i2 < n2; i2++) {
+    	    for (i1 = 0; i1 < n1; i1++) {
+    		u(n3-1,i2,i1) = u(1,i2,i1);
+    	    }
+    	}
+    }
+    if (i3 == n3-2) {
+    	for (i2 = 0; i2 < n2; i2++) {
+    	    for (i1 = 0; i1 < n1; i1++) {
+    		u(0,i2,i1) = u(n3-2,i2,i1);
+    	    }
+    	}
+    }
+}
+
+/*--------------------------------------------------------------------
+c-------------------------------------------------------------------*/
+
+static void zran3(grid3 z, int n1, int n2, int n3, int nx, int ny, int k) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -951,7 +1517,7 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
 	   x1 = x0;
     	for (i2 = 1; i2 < e2; i2++) {
             xx = x1;
-            vranlc( d1, &xx, A, &(z[i3][i2][0]));
+            vranlc( d1, &xx, A, &(z(i3,i2,0)));
             /*rdummy = */randlc( &x1, a1 );
     	}
 	   /*rdummy = */randlc( &x0, a2 );
@@ -979,15 +1545,15 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     for (i3 = 1; i3 < n3-1; i3++) {
     	for (i2 = 1; i2 < n2-1; i2++) {
             for (i1 = 1; i1 < n1-1; i1++) {
-        		if ( z[i3][i2][i1] > ten[0][1] ) {
-        		    ten[0][1] = z[i3][i2][i1];
+        		if ( z(i3,i2,i1) > ten[0][1] ) {
+        		    ten[0][1] = z(i3,i2,i1);
         		    j1[0][1] = i1;
         		    j2[0][1] = i2;
         		    j3[0][1] = i3;
         		    bubble( ten, j1, j2, j3, MM, 1 );
         		}
-        		if ( z[i3][i2][i1] < ten[0][0] ) {
-        		    ten[0][0] = z[i3][i2][i1];
+        		if ( z(i3,i2,i1) < ten[0][0] ) {
+        		    ten[0][0] = z(i3,i2,i1);
         		    j1[0][0] = i1;
         		    j2[0][0] = i2;
         		    j3[0][0] = i3;
@@ -1004,8 +1570,8 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     i0 = MM - 1;
     int jg[4][MM][2];
     for (i = MM - 1 ; i >= 0; i--) {
-    	best = z[j3[i1][1]][j2[i1][1]][j1[i1][1]];
-    	if (best == z[j3[i1][1]][j2[i1][1]][j1[i1][1]]) {
+    	best = z(j3[i1][1],j2[i1][1],j1[i1][1]);
+    	if (best == z(j3[i1][1],j2[i1][1],j1[i1][1])) {
             jg[0][i][1] = 0;
             jg[1][i][1] = is1 - 1 + j1[i1][1];
             jg[2][i][1] = is2 - 1 + j2[i1][1];
@@ -1018,8 +1584,8 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
             jg[3][i][1] = 0;
     	}
     	ten[i][1] = best;
-    	best = z[j3[i0][0]][j2[i0][0]][j1[i0][0]];
-    	if (best == z[j3[i0][0]][j2[i0][0]][j1[i0][0]]) {
+    	best = z(j3[i0][0],j2[i0][0],j1[i0][0]);
+    	if (best == z(j3[i0][0],j2[i0][0],j1[i0][0])) {
             jg[0][i][0] = 0;
             jg[1][i][0] = is1 - 1 + j1[i0][0];
             jg[2][i][0] = is2 - 1 + j2[i0][0];
@@ -1067,15 +1633,15 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
     for (i3 = 0; i3 < n3; i3++) {
     	for (i2 = 0; i2 < n2; i2++) {
             for (i1 = 0; i1 < n1; i1++) {
-    		  z[i3][i2][i1] = 0.0;
+    		  z(i3,i2,i1) = 0.0;
     	    }
     	}
     }
     for (i = MM-1; i >= m0; i--) {
-	   z[j3[i][0]][j2[i][0]][j1[i][0]] = -1.0;
+	   z(j3[i][0],j2[i][0],j1[i][0]) = -1.0;
     }
     for (i = MM-1; i >= m1; i--) {
-	   z[j3[i][1]][j2[i][1]][j1[i][1]] = 1.0;
+	   z(j3[i][1],j2[i][1],j1[i][1]) = 1.0;
     }
     comm3(z,n1,n2,n3,k);
 
@@ -1087,7 +1653,7 @@ static void zran3(double ***z, int n1, int n2, int n3, int nx, int ny, int k) {
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void showall(double ***z, int n1, int n2, int n3) {
+static void showall(grid3 z, int n1, int n2, int n3) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -1103,7 +1669,7 @@ static void showall(double ***z, int n1, int n2, int n3) {
     for (i3 = 0; i3 < m3; i3++) {
     	for (i1 = 0; i1 < m1; i1++) {
     	    for (i2 = 0; i2 < m2; i2++) {
-    		  printf("%6.3f", z[i3][i2][i1]);
+    		  printf("%6.3f", z(i3,i2,i1));
     	    }
     	    printf("\n");
     	}
@@ -1206,7 +1772,7 @@ static void bubble( double ten[M][2], int j1[M][2], int j2[M][2], int j3[M][2],
 /*--------------------------------------------------------------------
 c-------------------------------------------------------------------*/
 
-static void zero3(double ***z, int n1, int n2, int n3) {
+static void zero3(grid3 z, int n1, int n2, int n3) {
 
     /*--------------------------------------------------------------------
     c-------------------------------------------------------------------*/
@@ -1215,7 +1781,7 @@ static void zero3(double ***z, int n1, int n2, int n3) {
     for (i3 = 0;i3 < n3; i3++) {
     	for (i2 = 0; i2 < n2; i2++) {
             for (i1 = 0; i1 < n1; i1++) {
-    		  z[i3][i2][i1] = 0.0;
+    		  z(i3,i2,i1) = 0.0;
     	    }
     	}
     }
@@ -179,9 +179,12 @@ void check_info(int type, char class_npb)
       class_npb != 'B' && 
       class_npb != 'R' && 
       class_npb != 'W' && 
-      class_npb != 'C') {
+      class_npb != 'C' &&
+      !(type == CG && (class_npb == 'D' || class_npb == 'E' || class_npb == 'F'))) {
     printf("setparams: Unknown benchmark class_npb %c\n", class_npb); 
-    printf("setparams: Allowed classes are \"S\", \"A\", \"B\" and \"C\"\n");
+    printf("setparams: Allowed classes are \"S\", \"A\", \"B\" and \"C\"");
+    if (type == CG) printf(", and \"D\" through \"F\" for CG");
+    printf("\n");
     exit(1);
   }
 
@@ -522,7 +525,10 @@ void write_cg_info(FILE *fp, char class_npb)
        *shiftW="12.0",
        *shiftA="20.0",
        *shiftB="60.0",
-       *shiftC="110.0";
+       *shiftC="110.0",
+       *shiftD="500.0",
+       *shiftE="1.5e3",
+       *shiftF="5.0e3";
 
 
   if( class_npb == 'S' )
@@ -535,6 +541,12 @@ void write_cg_info(FILE *fp, char class_npb)
   { na=75000; nonzer=13; niter=75; shift=shiftB; }
   else if( class_npb == 'C' )
   { na=150000; nonzer=15; niter=75; shift=shiftC; }
+  else if( class_npb == 'D' )
+  { na=1500000; nonzer=21; niter=100; shift=shiftD; }
+  else if( class_npb == 'E' )
+  { na=9000000; nonzer=26; niter=100; shift=shiftE; }
+  else if( class_npb == 'F' )
+  { na=54000000; nonzer=31; niter=100; shift=shiftF; }
   else
   {
     printf("setparams: Internal error: invalid class_npb type %c\n", class_npb);